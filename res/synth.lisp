@@ -0,0 +1,10 @@
+(synth
+ (seed 0)
+ (users 16)
+ (chunks 640)
+ (brains 1)
+ (mod launch)
+ (printers 2)
+ (ports 1)
+ (transmits 1)
+ (lanes 4))
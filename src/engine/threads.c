@@ -72,16 +72,23 @@ struct threads *threads_alloc(enum threads_pool pool)
     size_t first = 0, last = 0;
     const size_t cpus = threads_config.cpus;
 
+    // The publish pool only runs while the world is frozen between two steps so
+    // it shares the cpus of the shards which are parked at that point. The
+    // compile pool runs concurrently with the steps so it stays off the cpus
+    // of the shards and shares those of the sim thread, which mostly waits on
+    // the shards, and cpu 1 which only runs sound in the local profile.
     switch (threads_config.profile)
     {
 
     case threads_profile_local: {
         switch (pool) {
-        case threads_pool_nil:    { first = 0; last = 1; break; }
-        case threads_pool_engine: { first = 0; last = 0; break; }
-        case threads_pool_sound:  { first = 1; last = 2; break; }
-        case threads_pool_sim:    { first = 2; last = 3; break; }
-        case threads_pool_shards: { first = 3; last = cpus; break; }
+        case threads_pool_nil:     { first = 0; last = 1; break; }
+        case threads_pool_engine:  { first = 0; last = 0; break; }
+        case threads_pool_sound:   { first = 1; last = 2; break; }
+        case threads_pool_sim:     { first = 2; last = 3; break; }
+        case threads_pool_shards:  { first = 3; last = cpus; break; }
+        case threads_pool_compile: { first = 1; last = 3; break; }
+        case threads_pool_publish: { first = 3; last = cpus; break; }
         default: { assert(false); }
         }
         break;
@@ -89,11 +96,13 @@ struct threads *threads_alloc(enum threads_pool pool)
 
     case threads_profile_client: {
         switch (pool) {
-        case threads_pool_nil:    { first = 0; last = 1; break; }
-        case threads_pool_engine: { first = 1; last = 2; break; }
-        case threads_pool_sound:  { first = 2; last = 3; break; }
-        case threads_pool_sim:    { first = 0; last = 0; break; }
-        case threads_pool_shards: { first = 0; last = 0; break; }
+        case threads_pool_nil:     { first = 0; last = 1; break; }
+        case threads_pool_engine:  { first = 1; last = 2; break; }
+        case threads_pool_sound:   { first = 2; last = 3; break; }
+        case threads_pool_sim:     { first = 0; last = 0; break; }
+        case threads_pool_shards:  { first = 0; last = 0; break; }
+        case threads_pool_compile: { first = 0; last = 0; break; }
+        case threads_pool_publish: { first = 0; last = 0; break; }
         default: { assert(false); }
         }
         break;
@@ -101,11 +110,13 @@ struct threads *threads_alloc(enum threads_pool pool)
 
     case threads_profile_server: {
         switch (pool) {
-        case threads_pool_nil:    { first = 0; last = 1; break; }
-        case threads_pool_engine: { first = 0; last = 0; break; }
-        case threads_pool_sound:  { first = 0; last = 0; break; }
-        case threads_pool_sim:    { first = 2; last = 3; break; }
-        case threads_pool_shards: { first = 3; last = cpus; break; }
+        case threads_pool_nil:     { first = 0; last = 1; break; }
+        case threads_pool_engine:  { first = 0; last = 0; break; }
+        case threads_pool_sound:   { first = 0; last = 0; break; }
+        case threads_pool_sim:     { first = 2; last = 3; break; }
+        case threads_pool_shards:  { first = 3; last = cpus; break; }
+        case threads_pool_compile: { first = 1; last = 3; break; }
+        case threads_pool_publish: { first = 3; last = cpus; break; }
         default: { assert(false); }
         }
         break;
@@ -29,6 +29,8 @@ enum threads_pool : unsigned
     threads_pool_sound,
     threads_pool_sim,
     threads_pool_shards,
+    threads_pool_compile,
+    threads_pool_publish,
     threads_pool_len,
 };
 
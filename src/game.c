@@ -21,6 +21,7 @@
 #include <stdarg.h>
 #include <stdatomic.h>
 #include <unistd.h>
+#include <semaphore.h>
 
 #include "game/active.h"
 #include "game/types.c"
@@ -31,6 +32,7 @@
 #include "game/sector.c"
 #include "game/shards.c"
 #include "game/world.c"
+#include "game/synth.c"
 #include "game/tape.c"
 #include "game/chunk.c"
 #include "game/active.c"
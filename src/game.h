@@ -32,6 +32,7 @@
 #include "game/shards.h"
 #include "game/chunk.h"
 #include "game/world.h"
+#include "game/synth.h"
 
 #include "game/protocol.h"
 #include "game/sim.h"
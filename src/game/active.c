@@ -18,8 +18,7 @@ void active_init(struct active *active, enum item type)
         .skip = false,
         .type = type,
         .size = config->size,
-        .step = config->im.step,
-        .io = config->im.io,
+        .config = config,
     };
 
     bits_init(&active->free);
@@ -29,22 +28,35 @@ void active_free(struct active *active)
 {
     mem_free(active->arena);
     mem_free(active->ports);
+    mem_free(active->slots);
     bits_free(&active->free);
 
     bits_init(&active->free);
     active->arena = 0;
     active->ports = 0;
+    active->slots = 0;
+    active->changed = 0;
+    active->dirty = false;
+    active->parked = 0;
     active->count = 0;
     active->len = 0;
     active->cap = 0;
 }
 
+static void active_dirty(struct active *active, size_t index)
+{
+    active->slots[index].dirty = true;
+    active->dirty = true;
+}
+
 bool active_delete(struct active *active, im_id id)
 {
     size_t index = im_id_seq(id)-1;
     if (index >= active->len) return false;
     if (bits_test(&active->free, index)) return false;
 
+    active_unpark(active, id);
+    active_dirty(active, index);
     bits_set(&active->free, index);
     active->count--;
 
@@ -107,6 +119,7 @@ bool active_load(struct active *active, struct save *save, struct chunk *chunk)
     save_read_into(save, &active->len);
     save_read_into(save, &active->cap);
     save_read_into(save, &active->create);
+    active->parked = 0;
     if (!active->len && !active->create)
         return save_read_magic(save, save_magic_active);
     save_read_into(save, &active->count);
@@ -121,9 +134,19 @@ bool active_load(struct active *active, struct save *save, struct chunk *chunk)
     memset(active->ports + active->len, 0,
             (active->cap - active->len) * sizeof(*active->ports));
 
+    active->slots = mem_array_realloc_t(active->slots, old, active->cap);
+    memset(active->slots, 0, active->cap * sizeof(*active->slots));
+    active->changed = 0;
+    active->dirty = false;
+
     if (!bits_load(&active->free, save)) return false;
 
-    const struct im_config *config = im_config_assert(active->type);
+    for (size_t i = 0; i < active->len; ++i) {
+        if (bits_test(&active->free, i)) continue;
+        if (active->ports[i].parked) active->parked++;
+    }
+
+    const struct im_config *config = active->config;
     if (config->im.load) {
         for (size_t i = 0; i < active->len; ++i) {
             if (bits_test(&active->free, i)) continue;
@@ -134,6 +157,145 @@ bool active_load(struct active *active, struct save *save, struct chunk *chunk)
     return save_read_magic(save, save_magic_active);
 }
 
+
+// -----------------------------------------------------------------------------
+// delta
+// -----------------------------------------------------------------------------
+// Deltas contain the header of the active and only the slots stamped after
+// since or every slot if since is nil.
+
+// Slots are hashed a word at a time as every modification of the items in the
+// selected chunk leads to a hash.
+static hash_val active_hash_slot(const struct active *active, size_t index)
+{
+    uint32_t ports = 0;
+    memcpy(&ports, active->ports + index, sizeof(ports));
+    hash_val hash = hash_u64(ports);
+
+    const uint8_t *it = active->arena + (index * active->size);
+    const uint8_t *end = it + active->size;
+
+    uint64_t word = 0;
+    for (; it + sizeof(word) <= end; it += sizeof(word)) {
+        memcpy(&word, it, sizeof(word));
+        hash = hash_u64(hash ^ word);
+    }
+
+    word = 0;
+    memcpy(&word, it, end - it);
+    return hash_u64(hash ^ word);
+}
+
+world_ts active_stamp(struct active *active, world_ts now)
+{
+    if (!active->dirty) return active->changed;
+
+    for (size_t i = 0; i < active->len; ++i) {
+        struct active_slot *slot = active->slots + i;
+        if (!slot->dirty) continue;
+        slot->dirty = false;
+
+        hash_val hash = bits_test(&active->free, i) ? 0 : active_hash_slot(active, i);
+        if (hash == slot->hash) continue;
+
+        slot->hash = hash;
+        slot->stamp = active->changed = now;
+    }
+
+    active->dirty = false;
+    return active->changed;
+}
+
+hash_val active_hash_head(const struct active *active, hash_val hash)
+{
+    if (active->skip) return hash;
+
+    hash = hash_value(hash, active->type);
+    hash = hash_value(hash, active->len);
+    hash = hash_value(hash, active->cap);
+    hash = hash_value(hash, active->count);
+    hash = hash_value(hash, active->create);
+    hash = bits_hash(&active->free, hash);
+
+    return hash;
+}
+
+static bool active_delta_slot(const struct active *active, size_t index, world_ts since)
+{
+    if (bits_test(&active->free, index)) return false;
+    return !since || active->slots[index].stamp > since;
+}
+
+void active_save_delta(const struct active *active, struct save *save, world_ts since)
+{
+    save_write_magic(save, save_magic_active);
+
+    save_write_value(save, active->len);
+    save_write_value(save, active->cap);
+    save_write_value(save, active->create);
+    if (!active->len && !active->create)
+        return save_write_magic(save, save_magic_active);
+    save_write_value(save, active->count);
+    bits_save(&active->free, save);
+
+    uint8_t slots = 0;
+    for (size_t i = 0; i < active->len; ++i)
+        slots += active_delta_slot(active, i, since);
+    save_write_value(save, slots);
+
+    for (size_t i = 0; i < active->len; ++i) {
+        if (!active_delta_slot(active, i, since)) continue;
+
+        save_write_value(save, (uint8_t) i);
+        save_write(save, active->arena + (i * active->size), active->size);
+        save_write(save, active->ports + i, sizeof(*active->ports));
+    }
+
+    save_write_magic(save, save_magic_active);
+}
+
+bool active_load_delta(struct active *active, struct save *save, struct chunk *chunk)
+{
+    if (!save_read_magic(save, save_magic_active)) return false;
+
+    size_t old = active->cap;
+    save_read_into(save, &active->len);
+    save_read_into(save, &active->cap);
+    save_read_into(save, &active->create);
+    active->parked = 0;
+    if (!active->len && !active->create)
+        return save_read_magic(save, save_magic_active);
+    save_read_into(save, &active->count);
+    if (!bits_load(&active->free, save)) return false;
+
+    if (active->cap != old) {
+        active->arena = mem_array_realloc(active->arena, active->size, old, active->cap);
+        active->ports = mem_array_realloc_t(active->ports, old, active->cap);
+        active->slots = mem_array_realloc_t(active->slots, old, active->cap);
+    }
+
+    const struct im_config *config = active->config;
+    uint8_t slots = save_read_type(save, uint8_t);
+
+    for (size_t i = 0; i < slots; ++i) {
+        uint8_t index = save_read_type(save, uint8_t);
+        if (index >= active->len) return false;
+
+        void *item = active->arena + (index * active->size);
+        save_read(save, item, active->size);
+        save_read(save, active->ports + index, sizeof(*active->ports));
+        if (config->im.load && chunk) config->im.load(item, chunk);
+    }
+
+    for (size_t i = 0; i < active->len; ++i) {
+        if (bits_test(&active->free, i)) continue;
+        if (active->ports[i].parked) active->parked++;
+    }
+
+    return save_read_magic(save, save_magic_active);
+}
+
+
 size_t active_count(struct active *active)
 {
     return active->count;
@@ -167,14 +329,35 @@ void *active_get(struct active *active, im_id id)
     return active->arena + (index * active->size);
 }
 
+// The ports are modified through the returned pointer so the slot is assumed to
+// be modified.
 struct ports *active_ports(struct active *active, im_id id)
 {
     size_t index = im_id_seq(id)-1;
     if (index >= active->len || bits_test(&active->free, index)) return NULL;
 
+    active_dirty(active, index);
     return &active->ports[index];
 }
 
+void active_park(struct active *active, im_id id)
+{
+    struct ports *ports = active_ports(active, id);
+    if (!ports || ports->parked) return;
+
+    ports->parked = true;
+    active->parked++;
+}
+
+void active_unpark(struct active *active, im_id id)
+{
+    struct ports *ports = active_ports(active, id);
+    if (!ports || !ports->parked) return;
+
+    ports->parked = false;
+    active->parked--;
+}
+
 bool active_copy(struct active *active, im_id id, void *dst, size_t len)
 {
     assert(len >= active->size);
@@ -195,6 +378,7 @@ static void active_grow(struct active *active)
         active->cap = 1;
         active->arena = mem_array_alloc(active->size, active->cap);
         active->ports = mem_array_alloc_t(active->ports[0], active->cap);
+        active->slots = mem_array_alloc_t(active->slots[0], active->cap);
         bits_grow(&active->free, active->cap);
         return;
     }
@@ -202,6 +386,7 @@ static void active_grow(struct active *active)
     active->cap = u8_saturate_add(active->cap, active->cap);
     active->arena = mem_array_realloc(active->arena, active->size, active->len, active->cap);
     active->ports = mem_array_realloc_t(active->ports, active->len, active->cap);
+    active->slots = mem_array_realloc_t(active->slots, active->len, active->cap);
     bits_grow(&active->free, active->cap);
 }
 
@@ -239,6 +424,7 @@ bool active_create_from(
     void *item = active->arena + (index * active->size);
 
     config->im.make(item, chunk, id, data, len);
+    active_dirty(active, index);
     active->count++;
     return true;
 }
@@ -248,10 +434,13 @@ void active_step(
 {
     sys_ts mt = metric_now();
 
-    if (active->step) {
+    const struct im_config *config = active->config;
+    if (config->im.step && active->parked < active->count) {
         for (size_t i = 0; i < active->len; ++i) {
             if (bits_test(&active->free, i)) continue;
-            active->step(active->arena + (i * active->size), chunk);
+            if (active->ports[i].parked) continue;
+            config->im.step(active->arena + (i * active->size), chunk);
+            active_dirty(active, i);
         }
     }
 
@@ -265,9 +454,9 @@ void active_step(
 
         im_id id = make_im_id(active->type, index+1);
         void *item = active->arena + (index * active->size);
-        const struct im_config *config = im_config_assert(active->type);
 
         config->im.init(item, chunk, id);
+        active_dirty(active, index);
         active->create--;
         active->count++;
     }
@@ -285,6 +474,11 @@ bool active_io(
     void *state = active_get(active, dst);
     if (!state) return false;
 
-    active->io(state, chunk, io, src, args, len);
+    // The io could change the state of the item which would invalidate the
+    // reason it was parked.
+    active_unpark(active, dst);
+
+    active->config->im.io(state, chunk, io, src, args, len);
+    active_dirty(active, im_id_seq(dst)-1);
     return true;
 }
@@ -20,11 +20,13 @@ enum ports_state : uint8_t
     ports_received,
 };
 
+// parked is set when the item is blocked on its ports and doesn't need to be
+// stepped until the workers deliver its input or take its output.
 struct legion_packed ports
 {
     enum item in, out;
     enum ports_state in_state;
-    legion_pad(1);
+    bool parked;
 };
 
 static_assert(sizeof(struct ports) == 4);
@@ -34,12 +36,23 @@ static_assert(sizeof(struct ports) == 4);
 // active
 // -----------------------------------------------------------------------------
 
+// Modifications only mark the slot as dirty and the hash of the slot is checked
+// by active_stamp before a delta is saved to find the slots that actually
+// changed. The stamp is then used to only send the slots that changed since the
+// ack of the client.
+struct active_slot
+{
+    hash_val hash;
+    world_ts stamp;
+    bool dirty;
+};
+
 legion_packed struct active
 {
     bool skip;
     enum item type;
     uint8_t size;
-    legion_pad(1);
+    uint8_t parked;
 
     uint8_t count, len, cap;
     uint8_t create;
@@ -48,10 +61,12 @@ legion_packed struct active
     struct ports *ports;
     struct bits free;
 
-    im_step_fn step;
-    im_io_fn io;
+    const struct im_config *config;
 
-    legion_pad(8);
+    struct active_slot *slots;
+    world_ts changed;
+    bool dirty;
+    legion_pad(3);
 };
 
 static_assert(sizeof(struct active) == sys_cache_line_len);
@@ -63,12 +78,19 @@ hash_val active_hash(const struct active *, hash_val hash);
 bool active_load(struct active *, struct save *, struct chunk *);
 void active_save(const struct active *, struct save *save);
 
+world_ts active_stamp(struct active *, world_ts now);
+hash_val active_hash_head(const struct active *, hash_val hash);
+bool active_load_delta(struct active *, struct save *, struct chunk *);
+void active_save_delta(const struct active *, struct save *save, world_ts since);
+
 size_t active_count(struct active *);
 
 im_id active_last(struct active *);
 void active_list(struct active *, struct vec16 *ids);
 void *active_get(struct active *, im_id id);
 struct ports *active_ports(struct active *active, im_id id);
+void active_park(struct active *, im_id id);
+void active_unpark(struct active *, im_id id);
 
 bool active_copy(struct active *, im_id id, void *dst, size_t len);
 bool active_create(struct active *);
@@ -4,9 +4,18 @@
 */
 
 static void chunk_ports_step(struct chunk *);
+static void chunk_wake(struct chunk *);
+static bool chunk_sleeping(struct chunk *);
+static void chunk_sleep(struct chunk *);
 
 constexpr size_t chunk_log_cap = 8;
 
+// A chunk is put to sleep if two consecutive steps leave it in the same state
+// without interacting with the outside world. Since the check requires hashing
+// the entire chunk it's only attempted once every period.
+constexpr world_ts chunk_sleep_period = 16;
+constexpr world_ts chunk_sleep_timer = 1024;
+
 
 // -----------------------------------------------------------------------------
 // struct
@@ -23,6 +32,9 @@ struct chunk
 
     world_ts updated;
 
+    // Tick of the last delta which is used to stamp the modified items.
+    world_ts delta;
+
     struct log *log;
 
     // Ports
@@ -38,6 +50,14 @@ struct chunk
     struct htable listen;
 
     struct active active[items_active_len];
+
+    struct
+    {
+        bool asleep, busy;
+        world_ts since;
+        size_t tech;
+        hash_val hash;
+    } sleep;
 };
 
 
@@ -129,7 +149,6 @@ void chunk_free(struct chunk *chunk)
 
 void chunk_shard(struct chunk *chunk, struct shard *shard)
 {
-    assert(!chunk->shard || chunk->shard == shard);
     chunk->shard = shard;
     chunk->metrics = shard_metrics(shard);
     chunk->updated = shard_time(shard);
@@ -285,6 +304,7 @@ static bool chunk_create_logistics(struct chunk *chunk, enum item item)
 
 bool chunk_create(struct chunk *chunk, enum item item)
 {
+    chunk_wake(chunk);
     if (chunk_create_logistics(chunk, item)) return true;
     return active_create(active_index_assert(chunk, item));
 }
@@ -292,19 +312,30 @@ bool chunk_create(struct chunk *chunk, enum item item)
 bool chunk_create_from(
         struct chunk *chunk, enum item item, const vm_word *data, size_t len)
 {
-
+    chunk_wake(chunk);
     if (chunk_create_logistics(chunk, item)) { assert(!len); return true; }
     return active_create_from(active_index_assert(chunk, item), chunk, data, len);
 }
 
 bool chunk_delete(struct chunk *chunk, im_id id)
 {
+    chunk_wake(chunk);
     chunk_ports_reset(chunk, id);
     return active_delete(active_index_assert(chunk, im_id_item(id)), id);
 }
 
-void chunk_step(struct chunk *chunk)
+void chunk_step(struct chunk *chunk, struct metrics_shard *metrics)
 {
+    // Metrics belong to the shard executing the step which isn't necessarily
+    // the shard that owns the chunk.
+    chunk->metrics = metrics;
+
+    sys_ts mt = metric_now();
+    if (chunk_sleeping(chunk)) {
+        metric_inc(chunk->metrics, chunk.asleep, 1, mt);
+        return;
+    }
+
     energy_step_begin(&chunk->energy, &chunk->star);
 
     for (struct active *it = active_next(chunk, NULL); it; it = active_next(chunk, it))
@@ -312,12 +343,17 @@ void chunk_step(struct chunk *chunk)
     chunk_ports_step(chunk);
 
     energy_step_end(&chunk->energy);
+
+    chunk_sleep(chunk);
+    metric_inc(chunk->metrics, chunk.awake, 1, mt);
 }
 
 bool chunk_io(
         struct chunk *chunk,
         enum io io, im_id src, im_id dst, const vm_word *args, size_t len)
 {
+    chunk_wake(chunk);
+
     enum item item = im_id_item(dst);
     if (item == item_user) {
         struct user_io packet = { .io = io, .src = src, .len = len };
@@ -350,6 +386,7 @@ void chunk_log(struct chunk *chunk, im_id id, vm_word key, vm_word value)
     };
     log_push(chunk->log, line);
     shard_log_push(chunk->shard, chunk->owner, line);
+    chunk_wake(chunk);
 }
 
 const struct log *chunk_logs(struct chunk *chunk)
@@ -391,6 +428,7 @@ ssize_t chunk_count(struct chunk *chunk, enum item item)
 void chunk_probe(struct chunk *chunk, struct coord coord, enum item item)
 {
     shard_probe_push(chunk->shard, chunk->star.coord, coord, item);
+    chunk_wake(chunk);
 }
 
 ssize_t chunk_probe_value(struct chunk *chunk, struct coord coord, enum item item)
@@ -402,6 +440,7 @@ ssize_t chunk_probe_value(struct chunk *chunk, struct coord coord, enum item ite
 void chunk_scan(struct chunk *chunk, struct scan_it it)
 {
     shard_scan_push(chunk->shard, chunk->star.coord, it);
+    chunk_wake(chunk);
 }
 
 struct coord chunk_scan_value(struct chunk *chunk, struct scan_it it)
@@ -471,11 +510,24 @@ static void chunk_lanes_receive(
     chunk_io(chunk, io_recv, 0, dst, data, len);
 }
 
+// Arrivals are queued in the inbox of the shard owning the chunk and applied
+// via chunk_lanes_arrive by the shard thread before the chunk is stepped.
+void chunk_lanes_deliver(
+        struct chunk *chunk,
+        enum item item, struct coord src,
+        const vm_word *data, size_t len)
+{
+    assert(chunk->shard);
+    shard_lanes_arrive(chunk->shard, chunk, item, src, data, len);
+}
+
 void chunk_lanes_arrive(
         struct chunk *chunk,
         enum item item, struct coord src,
         const vm_word *data, size_t len)
 {
+    chunk_wake(chunk);
+
     switch (item)
     {
 
@@ -544,6 +596,93 @@ void chunk_lanes_launch(
                 .len = len,
                 .data = data
             });
+    chunk_wake(chunk);
+}
+
+
+// -----------------------------------------------------------------------------
+// sleep
+// -----------------------------------------------------------------------------
+
+// Hashed by content instead of by head and tail since failed port requests
+// are rotated through the ring on every step.
+static hash_val chunk_hash_ring(const struct ring16 *ring, hash_val hash)
+{
+    size_t len = ring16_len(ring);
+    hash = hash_value(hash, len);
+    for (size_t i = 0; i < len; ++i)
+        hash = hash_value(hash, ring->vals[(ring->tail + i) % ring->cap]);
+    return hash;
+}
+
+static hash_val chunk_hash(struct chunk *chunk)
+{
+    hash_val hash = hash_init();
+
+    hash = hash_bytes(hash, &chunk->star, sizeof(chunk->star));
+    hash = hash_bytes(hash, &chunk->energy, sizeof(chunk->energy));
+    hash = pills_hash(&chunk->pills, hash);
+
+    hash = hash_value(hash, chunk->workers.count);
+    hash = hash_value(hash, chunk->workers.idle);
+    hash = hash_value(hash, chunk->workers.fail);
+    hash = hash_value(hash, chunk->workers.clean);
+    hash = hash_bytes(hash, chunk->workers.ops->vals,
+            chunk->workers.ops->len * sizeof(*chunk->workers.ops->vals));
+
+    hash = chunk_hash_ring(chunk->requested, hash);
+    hash = chunk_hash_ring(chunk->storage, hash);
+    for (const struct htable_bucket *it = htable_next(&chunk->provided, NULL);
+         it; it = htable_next(&chunk->provided, it))
+    {
+        hash = hash_value(hash, it->key);
+        hash = chunk_hash_ring((struct ring16 *) it->value, hash);
+    }
+
+    hash = hash_value(hash, chunk->listen.len);
+    for (struct active *it = active_next(chunk, NULL); it; it = active_next(chunk, it))
+        hash = active_hash(it, hash);
+
+    return hash;
+}
+
+// Steps only depend on the state of the chunk, on the tech of the owner and on
+// input from the outside world which always goes through chunk_wake. The timer
+// is a safety net for anything else that could affect a step.
+static void chunk_wake(struct chunk *chunk)
+{
+    chunk->sleep.asleep = false;
+    chunk->sleep.busy = true;
+}
+
+static bool chunk_sleeping(struct chunk *chunk)
+{
+    if (!chunk->sleep.asleep) return false;
+
+    if (chunk_time(chunk) - chunk->sleep.since < chunk_sleep_timer &&
+            shard_tech_learned(chunk->shard) == chunk->sleep.tech)
+        return true;
+
+    chunk_wake(chunk);
+    return false;
+}
+
+static void chunk_sleep(struct chunk *chunk)
+{
+    const world_ts now = chunk_time(chunk);
+
+    if (now % chunk_sleep_period == 0) {
+        chunk->sleep.hash = chunk_hash(chunk);
+        chunk->sleep.busy = false;
+        return;
+    }
+
+    if (now % chunk_sleep_period != 1 || chunk->sleep.busy) return;
+    if (chunk_hash(chunk) != chunk->sleep.hash) return;
+
+    chunk->sleep.asleep = true;
+    chunk->sleep.since = now;
+    chunk->sleep.tech = shard_tech_learned(chunk->shard);
 }
 
 
@@ -583,6 +722,7 @@ void chunk_ports_reset(struct chunk *chunk, im_id id)
         ring16_replace((struct ring16 *) ret.value, id, 0);
     }
 
+    active_unpark(active, id);
     *ports = (struct ports) {0};
 }
 
@@ -639,6 +779,25 @@ void chunk_ports_request(struct chunk *chunk, im_id id, enum item item)
     else chunk->requested = ring16_push(chunk->requested, id);
 }
 
+// Stops stepping the item until its pending request is delivered or its output
+// is picked up. Should only be called if the step is a noop while waiting.
+void chunk_ports_park(struct chunk *chunk, im_id id)
+{
+    struct active *active = active_index_assert(chunk, im_id_item(id));
+    struct ports *ports = active_ports(active, id);
+    if (!ports) return;
+
+    if (ports->in_state == ports_requested || ports->out != item_nil)
+        active_park(active, id);
+}
+
+bool chunk_ports_parked(struct chunk *chunk, im_id id)
+{
+    struct active *active = active_index_assert(chunk, im_id_item(id));
+    struct ports *ports = active_ports(active, id);
+    return ports && ports->parked;
+}
+
 enum item chunk_ports_consume(struct chunk *chunk, im_id id)
 {
     struct active *active = active_index_assert(chunk, im_id_item(id));
@@ -661,7 +820,8 @@ static bool chunk_ports_step_queue(
     im_id dst = ring16_pop(requested);
     if (!dst)  { chunk->workers.clean++; return true; }
 
-    struct ports *in = active_ports(active_index_assert(chunk, im_id_item(dst)), dst);
+    struct active *dst_active = active_index_assert(chunk, im_id_item(dst));
+    struct ports *in = active_ports(dst_active, dst);
     assert(in && in->in_state == ports_requested);
 
     struct htable_ret hret = htable_get(&chunk->provided, in->in);
@@ -680,12 +840,16 @@ static bool chunk_ports_step_queue(
         goto nomatch;
     }
 
-    struct ports *out = active_ports(active_index_assert(chunk, im_id_item(src)), src);
+    struct active *src_active = active_index_assert(chunk, im_id_item(src));
+    struct ports *out = active_ports(src_active, src);
     assert(out && out->out == in->in);
 
     out->out = item_nil;
     in->in_state = ports_received;
 
+    active_unpark(src_active, src);
+    active_unpark(dst_active, dst);
+
     chunk->workers.ops =
         vec32_append(chunk->workers.ops, ((uint32_t) src << 16) | dst);
 
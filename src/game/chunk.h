@@ -43,6 +43,9 @@ struct metrics_shard *chunk_metrics(struct chunk *);
 void chunk_save(struct chunk *, struct save *);
 struct chunk *chunk_load(struct save *, struct shard *);
 
+// Deltas only pick up the modifications stamped by the last chunk_stamp which
+// leaves chunk_save_delta free of side effects.
+void chunk_stamp(struct chunk *);
 void chunk_save_delta(struct chunk *, struct save *, const struct ack *);
 bool chunk_load_delta(struct chunk *, struct save *, struct ack *);
 
@@ -81,7 +84,7 @@ bool chunk_delete(struct chunk *, im_id id);
 bool chunk_create(struct chunk *, enum item);
 bool chunk_create_from(struct chunk *, enum item, const vm_word *data, size_t len);
 
-void chunk_step(struct chunk *);
+void chunk_step(struct chunk *, struct metrics_shard *);
 bool chunk_io(
         struct chunk *,
         enum io io, im_id src, im_id dst,
@@ -119,6 +122,8 @@ bool chunk_pills_undock(struct chunk *, struct coord, struct cargo);
 
 void chunk_lanes_listen(struct chunk *, im_id, struct coord src, uint8_t chan);
 void chunk_lanes_unlisten(struct chunk *, im_id, struct coord src, uint8_t chan);
+void chunk_lanes_deliver(
+        struct chunk *, enum item, struct coord src, const vm_word *, size_t len);
 void chunk_lanes_arrive(
         struct chunk *,
         enum item, struct coord src,
@@ -156,3 +161,5 @@ bool chunk_ports_produce(struct chunk *, im_id, enum item);
 bool chunk_ports_consumed(struct chunk *, im_id);
 enum item chunk_ports_consume(struct chunk *, im_id);
 void chunk_ports_request(struct chunk *, im_id, enum item);
+void chunk_ports_park(struct chunk *, im_id);
+bool chunk_ports_parked(struct chunk *, im_id);
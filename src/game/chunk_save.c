@@ -234,16 +234,32 @@ static bool chunk_load_delta_provided(
     return true;
 }
 
+void chunk_stamp(struct chunk *chunk)
+{
+    // A client could already have acked a delta for the current tick if the
+    // world is paused in which case any new modifications must be stamped
+    // after the tick to be picked up.
+    const world_ts now = chunk_time(chunk);
+    const world_ts stamp = chunk->delta == now ? now + 1 : now;
+    chunk->delta = now;
+
+    for (struct active *it = active_next(chunk, NULL); it; it = active_next(chunk, it))
+        active_stamp(it, stamp);
+}
+
 static void chunk_save_delta_active(
         struct chunk *chunk, struct save *save, const struct chunk_ack *ack)
 {
     for (struct active *it = active_next(chunk, NULL); it; it = active_next(chunk, it)) {
-        hash_val hash = active_hash(it, hash_init());
-        if (ack->active[it->type - items_active_first] == hash) continue;
+        world_ts changed = it->changed;
+        hash_val hash = active_hash_head(it, hash_init());
+
+        hash_val acked = ack->active[it->type - items_active_first];
+        if (acked == hash && changed <= ack->time) continue;
 
         save_write_value(save, it->type);
         save_write_value(save, hash);
-        active_save(it, save);
+        active_save_delta(it, save, acked ? ack->time : 0);
     }
     save_write_value(save, (enum item) 0);
 }
@@ -258,7 +274,7 @@ static bool chunk_load_delta_active(
         struct active *active = active_index(chunk, type);
         assert(active && !active->skip);
 
-        if (!active_load(active, save, NULL)) return false;
+        if (!active_load_delta(active, save, NULL)) return false;
         ack->active[type - items_active_first] = hash;
     }
 
@@ -7,6 +7,7 @@
 
 #include "common.h"
 #include "utils/bits.h"
+#include "utils/save.h"
 
 
 // -----------------------------------------------------------------------------
@@ -121,6 +122,22 @@ inline struct coord coord_from_u64(uint64_t id)
     };
 }
 
+// Sorted lists of coordinates are written as the difference with the previous
+// coordinate on each axis which clustered coordinates keep to a few bytes.
+inline void coord_save_delta(struct save *save, struct coord *prev, struct coord coord)
+{
+    save_write_svar(save, (int32_t) (coord.x - prev->x));
+    save_write_svar(save, (int32_t) (coord.y - prev->y));
+    *prev = coord;
+}
+
+inline struct coord coord_load_delta(struct save *save, struct coord *prev)
+{
+    prev->x += (uint32_t) save_read_svar(save);
+    prev->y += (uint32_t) save_read_svar(save);
+    return *prev;
+}
+
 enum : size_t { coord_str_len = (2+1+2+1+4)*2 + 3 };
 
 size_t coord_str(struct coord coord, char *str, size_t len);
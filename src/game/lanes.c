@@ -26,9 +26,11 @@ static size_t lane_data_len(size_t len)
 
 
 // -----------------------------------------------------------------------------
-// lanes
+// lane
 // -----------------------------------------------------------------------------
 
+// Only used as the save format of the packets in flight on a lane which was
+// originally stored as a heap in each lane.
 legion_packed struct lane_queue
 {
     world_ts ts;
@@ -38,135 +40,108 @@ legion_packed struct lane_queue
 static_assert(sizeof(struct lane_queue) == 8);
 
 
+// The packets themselves live in the timing wheel so a lane only tracks how
+// many packets are in flight to know when it can be removed.
 struct lane
 {
     struct coord src, dst;
-
-    uint16_t len, cap;
-    struct lane_queue *queue;
+    uint16_t len;
 };
 
 
 static struct lane *lane_alloc(struct coord src, struct coord dst)
 {
-    constexpr size_t cap_default = 1;
-
     struct lane *lane = mem_alloc_t(lane);
-    *lane = (struct lane) {
-        .src = src,
-        .dst = dst,
-        .cap = cap_default,
-        .queue = mem_array_alloc_t(struct lane_queue, cap_default),
-    };
+    *lane = (struct lane) { .src = src, .dst = dst };
     return lane;
 }
 
 static void lane_free(struct lane *lane)
 {
-    mem_free(lane->queue);
     mem_free(lane);
 }
 
-static struct lane *lane_load(struct save *save)
-{
-    if (!save_read_magic(save, save_magic_lane)) return NULL;
 
-    struct lane *lane = mem_alloc_t(lane);
-    save_read_into(save, &lane->src);
-    save_read_into(save, &lane->dst);
-    save_read_into(save, &lane->len);
-    save_read_into(save, &lane->cap);
+// -----------------------------------------------------------------------------
+// wheel
+// -----------------------------------------------------------------------------
+// Hierarchical timing wheel where each level covers 8 bits of the arrival
+// timestamp. A packet is placed in the level of the most significant byte
+// where its arrival differs from the current time and is cascaded into the
+// lower levels as time catches up. A tick therefore only touches the packets
+// that arrive on that tick along with the occasional cascade.
 
-    lane->queue = mem_array_alloc_t(*lane->queue, lane->cap);
-    save_read(save, lane->queue, lane->cap * sizeof(*lane->queue));
+legion_packed struct lanes_event
+{
+    uint64_t lane;
+    world_ts ts;
+    heap_ix data;
+};
 
-    if (!save_read_magic(save, save_magic_lane)) goto fail;
-    return lane;
+static_assert(sizeof(struct lanes_event) == 16);
 
-  fail:
-    mem_free(lane->queue);
-    mem_free(lane);
-    return NULL;
-}
-
-static void lane_save(struct lane *lane, struct save *save)
+static void lanes_wheel_free(struct lanes *lanes)
 {
-    save_write_magic(save, save_magic_lane);
-    save_write_value(save, lane->src);
-    save_write_value(save, lane->dst);
-    save_write_value(save, lane->len);
-    save_write_value(save, lane->cap);
-    save_write(save, lane->queue, lane->cap * sizeof(*lane->queue));
-    save_write_magic(save, save_magic_lane);
+    for (size_t level = 0; level < lanes_wheel_levels; ++level) {
+        for (size_t slot = 0; slot < lanes_wheel_slots; ++slot) {
+            struct lanes_slot *it = &lanes->wheel[level][slot];
+            mem_free(it->list);
+            *it = (struct lanes_slot) {0};
+        }
+    }
 }
 
-static void lane_grow(struct lane *lane)
+static void lanes_wheel_push(struct lanes_slot *slot, struct lanes_event event)
 {
-    if (likely(lane->len != lane->cap)) return;
+    if (slot->len == slot->cap) {
+        size_t old = slot->cap;
+        slot->cap = old ? old * 2 : 4;
+        slot->list = mem_array_realloc_t(slot->list, old, slot->cap);
+    }
 
-    size_t old = lane->cap;
-    lane->queue = mem_array_realloc_t(lane->queue, old, lane->cap *= 2);
+    slot->list[slot->len++] = event;
 }
 
-static void lane_push(struct lane *lane, world_ts ts, heap_ix data)
+static void lanes_wheel_put(struct lanes *lanes, struct lanes_event event)
 {
-    lane_grow(lane);
+    assert(event.ts >= lanes->now);
 
-    size_t index = lane->len++;
-    struct lane_queue *it = &lane->queue[index];
-    *it = (struct lane_queue) { .ts = ts, .data = data };
+    const world_ts diff = event.ts ^ lanes->now;
+    const size_t level = diff ? u64_log2(diff) / lanes_wheel_bits : 0;
+    const size_t slot =
+        (event.ts >> (level * lanes_wheel_bits)) & (lanes_wheel_slots - 1);
 
-    while (index) {
-        struct lane_queue *parent = lane->queue + (index / 2);
-        if (parent->ts < it->ts) break;
-
-        legion_swap(it, parent);
-        it = parent;
-        index /= 2;
-    }
+    lanes_wheel_push(&lanes->wheel[level][slot], event);
 }
 
-static world_ts lane_peek(struct lane *lane)
+static void lanes_wheel_cascade(struct lanes *lanes, world_ts now)
 {
-    return lane->len ? lane->queue[0].ts : (world_ts) -1;
+    for (size_t level = lanes_wheel_levels - 1; level > 0; --level) {
+        const size_t shift = level * lanes_wheel_bits;
+        if (now & ((1ULL << shift) - 1)) continue;
+
+        struct lanes_slot *slot =
+            &lanes->wheel[level][(now >> shift) & (lanes_wheel_slots - 1)];
+
+        // Cascading can't put anything back into the same slot so we can
+        // iterate in place and reset afterwards.
+        for (size_t i = 0; i < slot->len; ++i)
+            lanes_wheel_put(lanes, slot->list[i]);
+        slot->len = 0;
+    }
 }
 
-static heap_ix lane_pop(struct lane *lane)
+static void lanes_wheel_sort(struct lanes_event *list, size_t len)
 {
-    assert(lane->len);
-
-    heap_ix ret = lane->queue[0].data;
-    lane->queue[0] = lane->queue[--lane->len];
-
-    size_t index = 0;
-    while (index < lane->len) {
-        struct lane_queue *it = lane->queue + index;
-
-        size_t li = index * 2;
-        size_t ri = index * 2 + 1;
-
-        struct lane_queue *lp = li < lane->len ? lane->queue + li : NULL;
-        struct lane_queue *rp = ri < lane->len ? lane->queue + ri : NULL;
-
-        size_t child = 0;
-        struct lane_queue *ptr = NULL;
-
-        if ((lp && lp->ts < it->ts) && (!rp || lp->ts < rp->ts)) {
-            child = li;
-            ptr = lp;
-        }
-        else if (rp && rp->ts < it->ts) {
-            child = ri;
-            ptr = rp;
-        }
-        else break;
-
-        legion_swap(it, ptr);
-        index = child;
-        it = ptr;
+    int cmp(const void *lhs_, const void *rhs_)
+    {
+        const struct lanes_event *lhs = lhs_, *rhs = rhs_;
+        if (lhs->lane != rhs->lane) return lhs->lane < rhs->lane ? -1 : 1;
+        if (lhs->ts != rhs->ts) return lhs->ts < rhs->ts ? -1 : 1;
+        return lhs->data < rhs->data ? -1 : lhs->data > rhs->data;
     }
 
-    return ret;
+    qsort(list, len, sizeof(*list), cmp);
 }
 
 
@@ -177,6 +152,7 @@ static heap_ix lane_pop(struct lane *lane)
 void lanes_init(struct lanes *lanes, struct world *world)
 {
     lanes->world = world;
+    lanes->now = world_time(world);
     heap_init(&lanes->data);
 }
 
@@ -194,6 +170,7 @@ void lanes_free(struct lanes *lanes)
         hset_free((void *) it->value);
     htable_reset(&lanes->index);
 
+    lanes_wheel_free(lanes);
     heap_free(&lanes->data);
 }
 
@@ -233,38 +210,134 @@ static void lanes_index_del(struct lanes *lanes, struct coord key, struct coord
     }
 }
 
+static struct lane *lanes_get(struct lanes *lanes, struct coord src, struct coord dst)
+{
+    uint64_t key = lanes_key(src, dst);
+    struct htable_ret ret = htable_get(&lanes->lanes, key);
+    if (ret.ok) return (void *) ret.value;
+
+    struct lane *lane = lane_alloc(src, dst);
+    ret = htable_put(&lanes->lanes, key, (uintptr_t) lane);
+    assert(ret.ok);
+
+    lanes_index_put(lanes, src, dst);
+    lanes_index_put(lanes, dst, src);
+
+    return lane;
+}
+
+static void lanes_del(struct lanes *lanes, uint64_t key, struct lane *lane)
+{
+    lanes_index_del(lanes, lane->src, lane->dst);
+    lanes_index_del(lanes, lane->dst, lane->src);
+    lane_free(lane);
+
+    struct htable_ret ret = htable_del(&lanes->lanes, key);
+    assert(ret.ok);
+}
+
+// The save format predates the timing wheel and stores the packets of each
+// lane alongside the lane. We stick to it by regrouping the packets per lane
+// which also keeps older saves loadable. Packets are written in arrival order
+// which is also a valid heap for the original format.
 void lanes_save(struct lanes *lanes, struct save *save)
 {
+    size_t len = 0;
+    for (const struct htable_bucket *it = htable_next(&lanes->lanes, NULL);
+         it; it = htable_next(&lanes->lanes, it))
+        len += ((struct lane *) it->value)->len;
+
+    struct lanes_event *events = mem_array_alloc_t(*events, len);
+    {
+        size_t i = 0;
+        for (size_t level = 0; level < lanes_wheel_levels; ++level) {
+            for (size_t slot = 0; slot < lanes_wheel_slots; ++slot) {
+                const struct lanes_slot *it = &lanes->wheel[level][slot];
+                memcpy(events + i, it->list, it->len * sizeof(*it->list));
+                i += it->len;
+            }
+        }
+        assert(i == len);
+    }
+    lanes_wheel_sort(events, len);
+
     save_write_magic(save, save_magic_lanes);
     save_write_value(save, (uint32_t) lanes->lanes.len);
 
     for (const struct htable_bucket *it = htable_next(&lanes->lanes, NULL);
          it; it = htable_next(&lanes->lanes, it))
     {
-        lane_save((void *) it->value, save);
+        const struct lane *lane = (void *) it->value;
+
+        save_write_magic(save, save_magic_lane);
+        save_write_value(save, lane->src);
+        save_write_value(save, lane->dst);
+        save_write_value(save, lane->len);
+        save_write_value(save, lane->len);
+
+        size_t first = 0, last = len;
+        while (first < last) {
+            size_t mid = (first + last) / 2;
+            if (events[mid].lane < it->key) first = mid + 1;
+            else last = mid;
+        }
+
+        for (size_t i = first; i < first + lane->len; ++i) {
+            assert(events[i].lane == it->key);
+            save_write_value(save, ((struct lane_queue) {
+                        .ts = events[i].ts,
+                        .data = events[i].data }));
+        }
+
+        save_write_magic(save, save_magic_lane);
     }
 
     heap_save(&lanes->data, save);
     save_write_magic(save, save_magic_lanes);
+
+    mem_free(events);
+}
+
+static bool lanes_load_lane(struct lanes *lanes, struct save *save)
+{
+    if (!save_read_magic(save, save_magic_lane)) return false;
+
+    struct coord src = save_read_type(save, typeof(src));
+    struct coord dst = save_read_type(save, typeof(dst));
+    uint16_t len = save_read_type(save, typeof(len));
+    uint16_t cap = save_read_type(save, typeof(cap));
+    if (len > cap) return false;
+
+    struct lane *lane = lanes_get(lanes, src, dst);
+    lane->len = len;
+
+    // Packets are migrated from the heap of the original format into the
+    // wheel. Anything that should have already arrived is delivered on the
+    // next step.
+    const uint64_t key = lanes_key(src, dst);
+    for (size_t i = 0; i < cap; ++i) {
+        struct lane_queue it = save_read_type(save, typeof(it));
+        if (i >= len) continue;
+
+        lanes_wheel_put(lanes, (struct lanes_event) {
+                    .lane = key,
+                    .ts = legion_max(it.ts, lanes->now + 1),
+                    .data = it.data,
+                });
+    }
+
+    return save_read_magic(save, save_magic_lane);
 }
 
 bool lanes_load(struct lanes *lanes, struct world *world, struct save *save)
 {
     if (!save_read_magic(save, save_magic_lanes)) return false;
     lanes->world = world;
+    lanes->now = world_time(world);
 
     uint32_t len = save_read_type(save, typeof(len));
-    for (size_t i = 0; i < len; ++i) {
-        struct lane *lane = lane_load(save);
-        if (!lane) goto fail;
-
-        uint64_t key = lanes_key(lane->src, lane->dst);
-        struct htable_ret ret = htable_put(&lanes->lanes, key, (uintptr_t) lane);
-        assert(ret.ok);
-
-        lanes_index_put(lanes, lane->src, lane->dst);
-        lanes_index_put(lanes, lane->dst, lane->src);
-    }
+    for (size_t i = 0; i < len; ++i)
+        if (!lanes_load_lane(lanes, save)) goto fail;
 
     if (!heap_load(&lanes->data, save)) goto fail;
     if (!save_read_magic(save, save_magic_lanes)) goto fail;
@@ -282,19 +355,7 @@ world_ts_delta lanes_travel(size_t speed, struct coord src, struct coord dst)
 
 void lanes_launch(struct lanes *lanes, struct lanes_packet packet)
 {
-    uint64_t key = lanes_key(packet.src, packet.dst);
-    struct htable_ret ret = htable_get(&lanes->lanes, key);
-
-    struct lane *lane = NULL;
-    if (ret.ok) lane = (void *) ret.value;
-    else {
-        lane = lane_alloc(packet.src, packet.dst);
-        ret = htable_put(&lanes->lanes, key, (uintptr_t) lane);
-        assert(ret.ok);
-
-        lanes_index_put(lanes, packet.src, packet.dst);
-        lanes_index_put(lanes, packet.dst, packet.src);
-    }
+    struct lane *lane = lanes_get(lanes, packet.src, packet.dst);
 
     heap_ix data_index = heap_new(&lanes->data, lane_data_len(packet.len));
     {
@@ -311,45 +372,58 @@ void lanes_launch(struct lanes *lanes, struct lanes_packet packet)
     world_ts_delta travel = lanes_travel(packet.speed, packet.src, packet.dst);
     assert(travel > 0);
 
-    lane_push(lane, world_time(lanes->world) + travel, data_index);
+    assert(lane->len < UINT16_MAX);
+    lane->len++;
+
+    lanes_wheel_put(lanes, (struct lanes_event) {
+                .lane = lanes_key(packet.src, packet.dst),
+                .ts = world_time(lanes->world) + travel,
+                .data = data_index,
+            });
 }
 
-void lanes_step(struct lanes *lanes)
+static size_t lanes_step_tick(struct lanes *lanes, world_ts now)
 {
-    sys_ts mt = metric_now();
-    size_t mn = 0;
-
-    world_ts now = world_time(lanes->world);
+    lanes_wheel_cascade(lanes, now);
 
-    const struct htable_bucket *it = htable_next(&lanes->lanes, NULL);
-    for (; it; it = htable_next(&lanes->lanes, it)) {
-        struct lane *lane = (void *) it->value;
+    struct lanes_slot *slot = &lanes->wheel[0][now & (lanes_wheel_slots - 1)];
+    for (size_t i = 0; i < slot->len; ++i) {
+        const struct lanes_event *event = slot->list + i;
+        assert(event->ts == now);
 
-        for (; lane_peek(lane) <= now; ++mn) {
-            heap_ix data_index = lane_pop(lane);
-            struct lane_data *data = heap_ptr(&lanes->data, data_index);
+        struct htable_ret ret = htable_get(&lanes->lanes, event->lane);
+        assert(ret.ok);
+        struct lane *lane = (void *) ret.value;
 
-            struct coord src = data->forward ? lane->src : lane->dst;
-            struct coord dst = data->forward ? lane->dst : lane->src;
-            world_lanes_arrive(
-                    lanes->world,
-                    data->owner, data->item,
-                    src, dst,
-                    data->data, data->len);
+        struct lane_data *data = heap_ptr(&lanes->data, event->data);
 
-            heap_del(&lanes->data, data_index, lane_data_len(data->len));
-        }
+        struct coord src = data->forward ? lane->src : lane->dst;
+        struct coord dst = data->forward ? lane->dst : lane->src;
+        world_lanes_arrive(
+                lanes->world,
+                data->owner, data->item,
+                src, dst,
+                data->data, data->len);
 
-        if (!lane->len) {
-            lanes_index_del(lanes, lane->src, lane->dst);
-            lanes_index_del(lanes, lane->dst, lane->src);
-            lane_free(lane);
+        heap_del(&lanes->data, event->data, lane_data_len(data->len));
 
-            struct htable_ret ret = htable_del(&lanes->lanes, it->key);
-            assert(ret.ok);
-        }
+        assert(lane->len);
+        if (!--lane->len) lanes_del(lanes, event->lane, lane);
     }
 
+    size_t len = slot->len;
+    slot->len = 0;
+    return len;
+}
+
+void lanes_step(struct lanes *lanes)
+{
+    sys_ts mt = metric_now();
+    size_t mn = 0;
+
+    world_ts now = world_time(lanes->world);
+    while (lanes->now < now) mn += lanes_step_tick(lanes, ++lanes->now);
+
     metric_inc(world_metrics(lanes->world), world.lanes, mn, mt);
 }
 
@@ -376,6 +450,10 @@ void lanes_list_save(
 {
     save_write_magic(save, save_magic_lanes);
 
+    size_t len = 0;
+    struct lanes_list_item *items =
+        mem_array_alloc_t(*items, legion_max(lanes->lanes.len, 1UL));
+
     for (const struct htable_bucket *it = htable_next(&lanes->lanes, NULL);
          it; it = htable_next(&lanes->lanes, it))
     {
@@ -385,11 +463,30 @@ void lanes_list_save(
                 !world_user_access(world, filter, lane->dst))
             continue;
 
-        save_write_value(save, coord_to_u64(lane->src));
-        save_write_value(save, coord_to_u64(lane->dst));
+        items[len++] = (struct lanes_list_item) { .src = lane->src, .dst = lane->dst };
+    }
+
+    // Sorted on the source such that it can be delta encoded while the
+    // destination is encoded relative to its source.
+    int cmp(const void *lhs_, const void *rhs_)
+    {
+        const struct lanes_list_item *lhs = lhs_;
+        const struct lanes_list_item *rhs = rhs_;
+        int ret = coord_cmp(lhs->src, rhs->src);
+        return ret ? ret : coord_cmp(lhs->dst, rhs->dst);
     }
+    qsort(items, len, sizeof(*items), cmp);
 
-    save_write_value(save, (uint64_t) 0);
+    save_write_uvar(save, len);
+
+    struct coord prev = coord_nil();
+    for (size_t i = 0; i < len; ++i) {
+        coord_save_delta(save, &prev, items[i].src);
+        struct coord src = items[i].src;
+        coord_save_delta(save, &src, items[i].dst);
+    }
+
+    mem_free(items);
     save_write_magic(save, save_magic_lanes);
 }
 
@@ -406,9 +503,14 @@ bool lanes_list_load(struct lanes_list **list_, struct save *save)
 
     if (!save_read_magic(save, save_magic_lanes)) return NULL;
 
-    uint64_t src = 0;
-    while ((src = save_read_type(save, typeof(src)))) {
-        uint64_t dst = save_read_type(save, typeof(dst));
+    size_t len = save_read_uvar(save);
+    struct coord prev = coord_nil();
+
+    for (size_t i = 0; i < len; ++i) {
+        struct coord src = coord_load_delta(save, &prev);
+        struct coord dst = src;
+        coord_load_delta(save, &dst);
+        if (save_eof(save)) return false;
 
         if (list->len == list->cap) {
             const size_t old = legion_xchg(&list->cap, list->cap * 2);
@@ -416,8 +518,8 @@ bool lanes_list_load(struct lanes_list **list_, struct save *save)
         }
 
         struct lanes_list_item *item = list->items + list->len++;
-        item->src = coord_from_u64(src);
-        item->dst = coord_from_u64(dst);
+        item->src = src;
+        item->dst = dst;
     }
 
     if (!save_read_magic(save, save_magic_lanes)) assert(false);
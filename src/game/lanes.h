@@ -12,6 +12,18 @@ struct hset;
 // lanes
 // -----------------------------------------------------------------------------
 
+struct lanes_event;
+
+constexpr size_t lanes_wheel_bits = 8;
+constexpr size_t lanes_wheel_slots = 1 << lanes_wheel_bits;
+constexpr size_t lanes_wheel_levels = (sizeof(world_ts) * 8) / lanes_wheel_bits;
+
+struct lanes_slot
+{
+    uint32_t len, cap;
+    struct lanes_event *list;
+};
+
 struct lanes
 {
     struct world *world;
@@ -19,6 +31,9 @@ struct lanes
     struct htable lanes;
     struct htable index;
     struct heap data;
+
+    world_ts now;
+    struct lanes_slot wheel[lanes_wheel_levels][lanes_wheel_slots];
 };
 
 void lanes_init(struct lanes *, struct world *);
@@ -95,13 +95,13 @@ void log_save_delta(const struct log *log, struct save *save, world_ts ack)
          it; it = log_next(log, it))
     {
         if (it->time <= ack) continue;
-        save_write_value(save, it->time);
+        save_write_uvar(save, it->time);
         save_write_value(save, coord_to_u64(it->star));
         save_write_value(save, it->id);
-        save_write_value(save, it->key);
-        save_write_value(save, it->value);
+        save_write_svar(save, it->key);
+        save_write_svar(save, it->value);
     }
-    save_write_value(save, (world_ts) 0);
+    save_write_uvar(save, 0);
 
     save_write_magic(save, save_magic_log);
 }
@@ -110,13 +110,13 @@ void log_save_delta(const struct log *log, struct save *save, world_ts ack)
 // recursion to invert the order that items are pushed.
 static bool log_load_delta_item(struct log *log, struct save *save, world_ts ack)
 {
-    world_ts time = save_read_type(save, typeof(time));
+    world_ts time = save_read_uvar(save);
     if (!time) return true;
 
     struct coord star = coord_from_u64(save_read_type(save, uint64_t));
     im_id id = save_read_type(save, typeof(id));
-    vm_word key = save_read_type(save, typeof(key));
-    vm_word value = save_read_type(save, typeof(value));
+    vm_word key = save_read_svar(save);
+    vm_word value = save_read_svar(save);
 
     if (!log_load_delta_item(log, save, ack)) return false;
 
@@ -12,6 +12,7 @@ static struct
     bool dump;
     struct mfile_writer out;
     struct strbuf buf;
+    struct { atomic_uint_fast64_t frames, raw, wire, t; } stream;
 } metrics = {0};
 
 void metrics_open(const char *path)
@@ -28,6 +29,11 @@ void metrics_close(void)
     metrics.dump = false;
 }
 
+bool metrics_enabled(void)
+{
+    return metrics.dump;
+}
+
 inline void metric_add(struct metric *m, struct metric v)
 {
     m->n += v.n; m->t += v.t;
@@ -41,20 +47,182 @@ static const char *metric_rate(double value, uint64_t dt)
     return strbuf_scaled_f(&metrics.buf, rate);
 }
 
+void metrics_stream(size_t frames, size_t raw, size_t wire, sys_ts t)
+{
+    if (!metrics.dump) return;
+
+    atomic_fetch_add_explicit(&metrics.stream.frames, frames, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.stream.raw, raw, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.stream.wire, wire, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.stream.t, t, memory_order_relaxed);
+}
+
+static uint64_t metric_take(atomic_uint_fast64_t *value)
+{
+    return atomic_exchange_explicit(value, 0, memory_order_relaxed);
+}
+
 static const char *metric_percent(double value, uint64_t dt)
 {
     return strbuf_fmt(&metrics.buf, "%5.3lf", value / dt);
 }
 
-void metrics_dump(struct metrics *m)
+
+// -----------------------------------------------------------------------------
+// exec
+// -----------------------------------------------------------------------------
+
+// Probing is bounded to keep the cost of recording constant once the table
+// fills up.
+constexpr size_t metrics_exec_probes = 16;
+
+static struct metric_exec *metrics_exec_mod(struct metrics_exec *exec, mod_maj maj)
 {
-    if (!metrics.dump) return;
+    assert(maj);
+    const size_t mask = metrics_exec_mods_cap - 1;
 
-    sys_ts now = sys_now();
-    if (!m->t.next)
-        m->t.next = (m->t.start = now) + metrics_config_period;
-    if (now < m->t.next) return;
+    size_t index = hash_u64(maj) & mask;
+    for (size_t i = 0; i < metrics_exec_probes; ++i, index = (index + 1) & mask) {
+        if (exec->mod[index].maj == maj) return &exec->mod[index].exec;
+        if (exec->mod[index].maj) continue;
+
+        exec->mod[index].maj = maj;
+        return &exec->mod[index].exec;
+    }
+
+    return &exec->overflow;
+}
+
+static void metric_exec_add(struct metric_exec *m, const struct metric_exec *v)
+{
+    m->n += v->n; m->t += v->t;
+    m->cycles += v->cycles;
+    m->yields += v->yields;
+    m->io += v->io;
+    m->faults += v->faults;
+    m->mods += v->mods;
+}
+
+void metrics_exec_record(
+        struct metrics_exec *exec,
+        mod_maj maj, user_id owner, const struct metric_exec *value)
+{
+    metric_exec_add(metrics_exec_mod(exec, maj), value);
+    metric_exec_add(exec->user + owner, value);
+}
+
+// Orders by time spent and falls back on cycles if time isn't measured.
+static int metric_exec_cmp(const struct metric_exec *lhs, const struct metric_exec *rhs)
+{
+    if (lhs->t != rhs->t) return lhs->t > rhs->t ? -1 : 1;
+    if (lhs->cycles != rhs->cycles) return lhs->cycles > rhs->cycles ? -1 : 1;
+    return 0;
+}
+
+struct metrics_exec_row { mod_maj maj; struct metric_exec exec; };
+
+static void metrics_write_exec(
+        struct mfile_writer *out, struct strbuf *buf,
+        struct metrics *m, struct mods *mods, uint64_t dt, uint64_t div)
+{
+    size_t len = 0;
+    struct metric_exec overflow = {0};
+    struct metric_exec users[user_max] = {0};
+    struct metrics_exec_row *rows = mem_array_alloc_t(
+            *rows, shards_cap * metrics_exec_mods_cap);
+
+    for (size_t i = 0; i < shards_cap; ++i) {
+        const struct metrics_exec *exec = &m->shard[i].exec;
+        if (!m->shard[i].active) continue;
+
+        metric_exec_add(&overflow, &exec->overflow);
+        for (size_t j = 0; j < user_max; ++j)
+            metric_exec_add(users + j, exec->user + j);
+
+        for (size_t j = 0; j < metrics_exec_mods_cap; ++j) {
+            if (!exec->mod[j].maj) continue;
+            rows[len++] = (struct metrics_exec_row) {
+                .maj = exec->mod[j].maj,
+                .exec = exec->mod[j].exec,
+            };
+        }
+    }
+
+    // Shards record the same mods independently so they're merged by sorting
+    // on the mod before ordering them by cost.
+    int maj_cmp(const void *lhs_, const void *rhs_)
+    {
+        const struct metrics_exec_row *lhs = lhs_, *rhs = rhs_;
+        return lhs->maj < rhs->maj ? -1 : lhs->maj > rhs->maj ? 1 : 0;
+    }
+    qsort(rows, len, sizeof(*rows), maj_cmp);
 
+    size_t merged = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (merged && rows[merged - 1].maj == rows[i].maj)
+            metric_exec_add(&rows[merged - 1].exec, &rows[i].exec);
+        else rows[merged++] = rows[i];
+    }
+
+    int row_cmp(const void *lhs, const void *rhs)
+    {
+        return metric_exec_cmp(
+                &((const struct metrics_exec_row *) lhs)->exec,
+                &((const struct metrics_exec_row *) rhs)->exec);
+    }
+    qsort(rows, merged, sizeof(*rows), row_cmp);
+
+    void dump_exec(const char *name, const struct metric_exec *exec)
+    {
+        mfile_writef(out, "      (%-10s (steps %s) (t %s) (cycles %s) (yields %s)\n",
+                name,
+                metric_rate(exec->n, dt),
+                metric_percent(exec->t / div, dt),
+                metric_rate(exec->cycles, dt),
+                metric_rate(exec->yields, dt));
+
+        mfile_writef(out, "        (io %s) (faults %s) (mods %s))\n",
+                metric_rate(exec->io, dt),
+                metric_rate(exec->faults, dt),
+                metric_rate(exec->mods, dt));
+    }
+
+    mfile_write(out, "  (exec\n    (mods\n");
+    for (size_t i = 0; i < legion_min(merged, metrics_config_exec_top); ++i) {
+        struct symbol name = {0};
+        const char *str = mods_name(mods, rows[i].maj, &name) ?
+            strbuf_fmt(buf, "%.*s", (int) name.len, name.c) :
+            strbuf_fmt(buf, "%04x", rows[i].maj);
+        dump_exec(str, &rows[i].exec);
+    }
+    if (overflow.n) dump_exec("<overflow>", &overflow);
+    out->it--;
+    mfile_write(out, ")\n");
+
+    user_id order[user_max] = {0};
+    for (size_t i = 0; i < user_max; ++i) order[i] = i;
+
+    int user_cmp(const void *lhs, const void *rhs)
+    {
+        return metric_exec_cmp(
+                users + *((const user_id *) lhs),
+                users + *((const user_id *) rhs));
+    }
+    qsort(order, user_max, sizeof(*order), user_cmp);
+
+    mfile_write(out, "    (users\n");
+    for (size_t i = 0; i < metrics_config_exec_top; ++i) {
+        if (!users[order[i]].n) break;
+        dump_exec(strbuf_fmt(buf, "%02u", order[i]), users + order[i]);
+    }
+    out->it--;
+    mfile_write(out, "))\n");
+
+    mem_free(rows);
+}
+
+static void metrics_write(struct metrics *m, struct mods *mods, sys_ts now)
+{
     const uint64_t dt = now - m->t.start;
     const uint64_t dts = m->ts.now - m->ts.start;
 
@@ -67,7 +235,15 @@ void metrics_dump(struct metrics *m)
         shards++;
 
         metric_add(&sum.shard.idle, shard->shard.idle);
+        metric_add(&sum.shard.resolve, shard->shard.resolve);
+        metric_add(&sum.shard.inbox, shard->shard.inbox);
         metric_add(&sum.shard.chunks, shard->shard.chunks);
+        metric_add(&sum.shard.steal, shard->shard.steal);
+        metric_add(&sum.shard.apply, shard->shard.apply);
+        metric_add(&sum.shard.spin, shard->shard.spin);
+        metric_add(&sum.shard.park, shard->shard.park);
+        metric_add(&sum.chunk.awake, shard->chunk.awake);
+        metric_add(&sum.chunk.asleep, shard->chunk.asleep);
         metric_add(&sum.chunk.workers, shard->chunk.workers);
         for (size_t j = 0; j < items_active_len; ++j)
             metric_add(&sum.chunk.active[j], shard->chunk.active[j]);
@@ -85,32 +261,87 @@ void metrics_dump(struct metrics *m)
             strbuf_scaled(buf, dts),
             metric_rate(dts, dt));
 
-    mfile_writef(out, "  (sim (idle %s) (cmd %s) (pub %s))\n",
+    mfile_writef(out, "  (sim (idle %s) (cmd %s) (pub %s) (fan %s) (stall %s)\n",
             metric_percent(m->sim.idle.t, dt),
             metric_percent(m->sim.cmd.t, dt),
-            metric_percent(m->sim.publish.t, dt));
+            metric_percent(m->sim.publish.t, dt),
+            metric_percent(m->sim.fanout.t, dt),
+            metric_percent(m->sim.stall.t, dt));
+
+    // Compilation metrics are latencies averaged over the compilations.
+    mfile_writef(out, "    (compile %s (queue %s) (run %s)))\n",
+            metric_rate(m->sim.compile.n, dt),
+            strbuf_scaled(buf, m->sim.queue.t / legion_max(m->sim.queue.n, 1UL)),
+            strbuf_scaled(buf, m->sim.compile.t / legion_max(m->sim.compile.n, 1UL)));
+
+    // The ratio is raw over wire bytes so bigger is better.
+    uint64_t raw = metric_take(&metrics.stream.raw);
+    uint64_t wire = metric_take(&metrics.stream.wire);
+    mfile_writef(out, "  (stream (frames %s) (raw %s) (wire %s) (ratio %5.3lf) (lz %s))\n",
+            metric_rate(metric_take(&metrics.stream.frames), dt),
+            metric_rate(raw, dt),
+            metric_rate(wire, dt),
+            (double) raw / legion_max(wire, 1UL),
+            metric_percent(metric_take(&metrics.stream.t), dt));
 
     mfile_writef(out, "  (world (items %s) (lanes %s %s))\n",
             metric_rate(items, dt),
             metric_rate(m->world.lanes.n, dt),
             metric_percent(m->world.lanes.t, dt));
 
-    mfile_writef(out, "  (shards (begin %s) (wait %s) (end %s)\n\n",
+    mfile_writef(out, "  (shards (resolve %s %s) (begin %s) (wait %s) (end %s) (apply %s %s)\n",
+            metric_rate(m->shards.resolve.n, dt),
+            metric_percent(m->shards.resolve.t, dt),
             metric_percent(m->shards.begin.t, dt),
             metric_percent(m->shards.wait.t, dt),
-            metric_percent(m->shards.end.t, dt));
+            metric_percent(m->shards.end.t, dt),
+            metric_rate(m->shards.apply.n, dt),
+            metric_percent(m->shards.apply.t, dt));
+
+    mfile_writef(out, "    (spin %s %s) (park %s %s)\n",
+            metric_rate(m->shards.spin.n, dt),
+            metric_percent(m->shards.spin.t, dt),
+            metric_rate(m->shards.park.n, dt),
+            metric_percent(m->shards.park.t, dt));
+
+    mfile_writef(out, "    (balance %s %s) (imbalance %s)\n\n",
+            metric_rate(m->shards.balance.n, dt),
+            metric_percent(m->shards.balance.t, dt),
+            metric_percent(m->shards.imbalance.t, dt));
 
     void dump_shard(const char *name, const struct metrics_shard *ms, uint64_t div)
     {
         if (!div) return;
 
         double idle = ((double) ms->shard.idle.t) / sys_sec;
-        mfile_writef(out, "    (%s (idle %s %s) (chunks %s %s)\n",
+        mfile_writef(out, "    (%s (idle %s %s) (chunks %s %s) (steal %s %s)\n",
                 name,
                 metric_percent(ms->shard.idle.t / div, dt),
                 metric_rate(idle / div, dt),
                 metric_percent(ms->shard.chunks.t / div, dt),
-                metric_rate(ms->shard.chunks.n, dt));
+                metric_rate(ms->shard.chunks.n, dt),
+                metric_percent(ms->shard.steal.t / div, dt),
+                metric_rate(ms->shard.steal.n, dt));
+
+        mfile_writef(out, "      (resolve %s %s) (inbox %s %s) (apply %s %s)\n",
+                metric_rate(ms->shard.resolve.n, dt),
+                metric_percent(ms->shard.resolve.t / div, dt),
+                metric_rate(ms->shard.inbox.n, dt),
+                metric_percent(ms->shard.inbox.t / div, dt),
+                metric_rate(ms->shard.apply.n, dt),
+                metric_percent(ms->shard.apply.t / div, dt));
+
+        mfile_writef(out, "      (spin %s %s) (park %s %s)\n",
+                metric_rate(ms->shard.spin.n, dt),
+                metric_percent(ms->shard.spin.t / div, dt),
+                metric_rate(ms->shard.park.n, dt),
+                metric_percent(ms->shard.park.t / div, dt));
+
+        mfile_writef(out, "      (awake %s %s) (asleep %s %s)\n",
+                metric_rate(ms->chunk.awake.n, dt),
+                metric_percent(ms->chunk.awake.t / div, dt),
+                metric_rate(ms->chunk.asleep.n, dt),
+                metric_percent(ms->chunk.asleep.t / div, dt));
 
         mfile_writef(out, "      (%10s %s %s)\n",
                 item_str_c(item_worker),
@@ -134,10 +365,35 @@ void metrics_dump(struct metrics *m)
     }
 
     out->it -= 2;
-    mfile_write(out, "))\n");
+    mfile_write(out, ")\n");
+
+    metrics_write_exec(out, buf, m, mods, dt, legion_max(shards, (size_t) 1));
+
+    out->it--;
+    mfile_write(out, ")\n");
 
     world_ts ts = m->ts.now;
     memset(m, 0, sizeof(*m));
     m->t.next = (m->t.start = now) + metrics_config_period;
     m->ts.start = ts;
 }
+
+void metrics_dump(struct metrics *m, struct mods *mods)
+{
+    if (!metrics.dump) return;
+
+    sys_ts now = sys_now();
+    if (!m->t.next)
+        m->t.next = (m->t.start = now) + metrics_config_period;
+    if (now < m->t.next) return;
+
+    metrics_write(m, mods, now);
+}
+
+// Dumps whatever was accumulated since the last dump regardless of the period
+// which is used to avoid losing the tail of a run.
+void metrics_flush(struct metrics *m, struct mods *mods)
+{
+    if (!metrics.dump || !m->t.next) return;
+    metrics_write(m, mods, sys_now());
+}
@@ -11,6 +11,7 @@
 
 constexpr bool metrics_config_time = true;
 constexpr sys_ts metrics_config_period = 5 * sys_sec;
+constexpr size_t metrics_config_exec_top = 10;
 
 // -----------------------------------------------------------------------------
 // metric
@@ -30,6 +31,28 @@ struct metric { uint64_t n, t; };
     })
 
 
+// -----------------------------------------------------------------------------
+// exec
+// -----------------------------------------------------------------------------
+// Accounts for the vm executions of a shard by mod and by owner. Mods are kept
+// in a fixed open-addressed table such that recording never allocates and any
+// mods that don't fit are accumulated in the overflow slot.
+
+enum : size_t { metrics_exec_mods_cap = 128 };
+
+struct metric_exec { uint64_t n, t, cycles, yields, io, faults, mods; };
+
+struct metrics_exec
+{
+    struct metric_exec user[user_max];
+    struct metric_exec overflow;
+    struct { mod_maj maj; struct metric_exec exec; } mod[metrics_exec_mods_cap];
+};
+
+void metrics_exec_record(
+        struct metrics_exec *, mod_maj, user_id, const struct metric_exec *);
+
+
 // -----------------------------------------------------------------------------
 // metrics
 // -----------------------------------------------------------------------------
@@ -39,11 +62,15 @@ struct metrics_shard
     legion_pad(64); // ensure that there's no false sharing between threads.
 
     bool active;
-    struct { struct metric idle, chunks; } shard;
     struct {
+        struct metric idle, resolve, inbox, chunks, steal, apply, spin, park;
+    } shard;
+    struct {
+        struct metric awake, asleep;
         struct metric workers;
         struct metric active[items_active_len];
     } chunk;
+    struct metrics_exec exec;
 };
 
 struct metrics
@@ -51,11 +78,21 @@ struct metrics
     struct { sys_ts start, next; } t;
     struct { world_ts start, now; } ts;
     struct { struct metric lanes; } world;
-    struct { struct metric idle, cmd, publish; } sim;
-    struct { struct metric begin, wait, end; } shards;
+    struct { struct metric idle, cmd, publish, fanout, stall, queue, compile; } sim;
+    struct {
+        struct metric resolve, begin, wait, end, apply;
+        struct metric spin, park;
+        struct metric balance, imbalance;
+    } shards;
     struct metrics_shard shard[shards_cap];
 };
 
+// The client stream is compressed on the server's network thread so it's
+// accumulated on the side and folded in with the sim's metrics when dumped.
+void metrics_stream(size_t frames, size_t raw, size_t wire, sys_ts t);
+
 void metrics_open(const char *path);
 void metrics_close(void);
-void metrics_dump(struct metrics *metrics);
+bool metrics_enabled(void);
+void metrics_dump(struct metrics *metrics, struct mods *mods);
+void metrics_flush(struct metrics *metrics, struct mods *mods);
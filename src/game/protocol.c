@@ -70,12 +70,12 @@ static void ack_save(const struct ack *ack, struct save *save)
     save_write_magic(save, save_magic_ack);
 
     save_write_value(save, ack->stream);
-    save_write_value(save, ack->time);
-    save_write_value(save, ack->atoms);
+    save_write_uvar(save, ack->time);
+    save_write_uvar(save, ack->atoms);
 
     const struct chunk_ack *cack = &ack->chunk;
     save_write_value(save, coord_to_u64(cack->coord));
-    save_write_value(save, cack->time);
+    save_write_uvar(save, cack->time);
 
     save_write_value(save, (uint8_t) cack->provided.len);
     for (const struct htable_bucket *it = htable_next(&cack->provided, NULL);
@@ -105,12 +105,12 @@ static struct ack *ack_load(struct save *save)
     struct ack *ack = ack_new();
 
     save_read_into(save, &ack->stream);
-    save_read_into(save, &ack->time);
-    save_read_into(save, &ack->atoms);
+    ack->time = save_read_uvar(save);
+    ack->atoms = save_read_uvar(save);
 
     struct chunk_ack *cack = &ack->chunk;
     cack->coord = coord_from_u64(save_read_type(save, uint64_t));
-    save_read_into(save, &cack->time);
+    cack->time = save_read_uvar(save);
 
     size_t len = save_read_type(save, uint8_t);
     htable_clear(&cack->provided);
@@ -187,7 +187,8 @@ void cmd_save(const struct cmd *cmd, struct save *save)
     }
 
     case CMD_STEPS: {
-        save_write_value(save, cmd->data.steps);
+        save_write_value(save, cmd->data.steps.type);
+        save_write_value(save, cmd->data.steps.mod);
         break;
     }
 
@@ -271,7 +272,8 @@ bool cmd_load(struct cmd *cmd, struct save *save)
     }
 
     case CMD_STEPS: {
-        cmd->data.steps = save_read_type(save, typeof(cmd->data.steps));
+        save_read_into(save, &cmd->data.steps.type);
+        save_read_into(save, &cmd->data.steps.mod);
         break;
     }
 
@@ -351,20 +353,18 @@ void state_free(struct state *state)
     mem_free(state);
 }
 
-static void state_save_io(struct world *world, user_id user, struct save *save)
+static void state_save_io(struct save *save, const struct state_ctx *ctx)
 {
     save_write_magic(save, save_magic_io);
 
-    struct user_io *io = world_user_io(world, user);
+    const struct user_io *io = &ctx->io;
     save_write_value(save, io->io);
 
     if (io->io) {
         save_write_value(save, io->src);
         save_write_value(save, io->len);
         for (size_t i = 0; i < io->len; ++i)
-            save_write_value(save, io->args[i]);
-
-        world_user_io_clear(world, user);
+            save_write_svar(save, io->args[i]);
     }
 
     save_write_magic(save, save_magic_io);
@@ -380,7 +380,7 @@ static bool state_load_io(struct state *state, struct save *save)
         save_read_into(save, &io->src);
         save_read_into(save, &io->len);
         for (size_t i = 0; i < io->len; ++i)
-            save_read_into(save, io->args + i);
+            io->args[i] = save_read_svar(save);
     }
 
     return save_read_magic(save, save_magic_io);
@@ -393,16 +393,46 @@ static void state_save_chunks(
 {
     save_write_magic(save, save_magic_chunks);
 
+    struct entry { uint64_t coord; vm_word name; };
+
+    size_t len = 0, cap = 0;
+    struct entry *list = nullptr;
+
     struct chunk *chunk = NULL;
     struct world_chunk_it it = world_chunk_it(world, ctx->access);
 
     while ((chunk = world_chunk_next(world, &it))) {
         if (chunk_updated(chunk) < ctx->ack->time) continue;
-        save_write_value(save, coord_to_u64(chunk_star(chunk)->coord));
-        save_write_value(save, chunk_name(chunk));
+
+        if (len == cap) {
+            size_t old = mem_array_len_grow(&cap, 16);
+            list = mem_array_realloc_t(list, old, cap);
+        }
+
+        list[len++] = (struct entry) {
+            .coord = coord_to_u64(chunk_star(chunk)->coord),
+            .name = chunk_name(chunk),
+        };
     }
-    save_write_value(save, (uint64_t) 0);
 
+    // Sorted such that the coordinates can be delta encoded.
+    int cmp(const void *lhs, const void *rhs)
+    {
+        uint64_t l = ((const struct entry *) lhs)->coord;
+        uint64_t r = ((const struct entry *) rhs)->coord;
+        return l < r ? -1 : l > r ? 1 : 0;
+    }
+    qsort(list, len, sizeof(*list), cmp);
+
+    save_write_uvar(save, len);
+
+    struct coord prev = coord_nil();
+    for (size_t i = 0; i < len; ++i) {
+        coord_save_delta(save, &prev, coord_from_u64(list[i].coord));
+        save_write_svar(save, list[i].name);
+    }
+
+    mem_free(list);
     save_write_magic(save, save_magic_chunks);
 }
 
@@ -410,10 +440,13 @@ static bool state_load_chunks(struct state *state, struct save *save)
 {
     if (!save_read_magic(save, save_magic_chunks)) return false;
 
-    while (true) {
-        uint64_t coord = save_read_type(save, typeof(coord));
-        if (!coord) break;
-        vm_word name = save_read_type(save, typeof(name));
+    size_t len = save_read_uvar(save);
+    struct coord prev = coord_nil();
+
+    for (size_t i = 0; i < len; ++i) {
+        uint64_t coord = coord_to_u64(coord_load_delta(save, &prev));
+        vm_word name = save_read_svar(save);
+        if (save_eof(save)) return false;
 
         struct htable_ret ret = htable_put(&state->names, coord, name);
         if (ret.ok) state->chunks = vec64_append(state->chunks, coord);
@@ -500,33 +533,64 @@ static bool state_load_steps(struct state *state, struct save *save)
     return save_read_magic(save, save_magic_steps);
 }
 
-void state_save(struct save *save, const struct state_ctx *ctx)
+// Holds all the modifications to the world that encoding the state implies such
+// that the world can be read concurrently by state_save_* afterwards. Contexts
+// must be prepared one at a time.
+void state_prepare(struct state_ctx *ctx)
+{
+    struct user_io *io = world_user_io(ctx->world, ctx->user);
+    ctx->io = *io;
+    if (io->io) world_user_io_clear(ctx->world, ctx->user);
+
+    struct chunk *chunk = world_chunk(ctx->world, ctx->chunk);
+    if (chunk) chunk_stamp(chunk);
+}
+
+// The state is encoded in three parts so that the world sections, which only
+// depend on the access set and the ack of the context, can be encoded once and
+// shared between all the contexts that match.
+void state_save_head(struct save *save, const struct state_ctx *ctx)
 {
     save_write_magic(save, save_magic_state_world);
     save_write_value(save, ctx->stream);
     save_write_value(save, world_gen_seed(ctx->world));
-    save_write_value(save, world_time(ctx->world));
+    save_write_uvar(save, world_time(ctx->world));
     save_write_value(save, ctx->speed);
     save_write_value(save, coord_to_u64(world_home(ctx->world, ctx->user)));
     save_write_magic(save, save_magic_state_world);
+}
 
+void state_save_shared(struct save *save, const struct state_ctx *ctx)
+{
     atoms_save_delta(world_atoms(ctx->world), save, ctx->ack);
     mods_list_save(world_mods(ctx->world), save, ctx->access);
     state_save_chunks(ctx->world, save, ctx);
     lanes_list_save(world_lanes(ctx->world), save, ctx->world, ctx->access);
+}
+
+void state_save_tail(struct save *save, const struct state_ctx *ctx)
+{
     tech_save(world_tech(ctx->world, ctx->user), save);
     log_save_delta(world_log(ctx->world, ctx->user), save, ctx->ack->time);
-    state_save_io(ctx->world, ctx->user, save);
+    state_save_io(save, ctx);
     state_save_chunk(save, ctx);
     state_save_steps(save, ctx);
 }
 
+void state_save(struct save *save, struct state_ctx *ctx)
+{
+    state_prepare(ctx);
+    state_save_head(save, ctx);
+    state_save_shared(save, ctx);
+    state_save_tail(save, ctx);
+}
+
 bool state_load(struct state *state, struct save *save, struct ack *ack)
 {
     if (!save_read_magic(save, save_magic_state_world)) return false;
     save_read_into(save, &state->stream);
     save_read_into(save, &state->seed);
-    save_read_into(save, &state->time);
+    state->time = save_read_uvar(save);
     save_read_into(save, &state->speed);
     state->home = coord_from_u64(save_read_type(save, uint64_t));
     if (!save_read_magic(save, save_magic_state_world)) return false;
@@ -154,6 +154,7 @@ enum cmd_steps : uint8_t
     cmd_steps_nil     = 0x00,
     cmd_steps_energy  = 0x01,
     cmd_steps_workers = 0x02,
+    cmd_steps_prof    = 0x03, // vm_prof of mod; not tied to the chunk
 };
 
 struct cmd
@@ -169,7 +170,7 @@ struct cmd
         enum speed speed;
 
         struct coord chunk;
-        enum cmd_steps steps;
+        struct { enum cmd_steps type; mod_id mod; } steps;
 
         mod_id mod;
         struct symbol mod_register;
@@ -241,7 +242,14 @@ struct state_ctx
     } steps;
 
     const struct ack *ack;
+
+    // Moved out of the world by state_prepare.
+    struct user_io io;
 };
 
-void state_save(struct save *, const struct state_ctx *);
+void state_prepare(struct state_ctx *);
+void state_save(struct save *, struct state_ctx *);
+void state_save_head(struct save *, const struct state_ctx *);
+void state_save_shared(struct save *, const struct state_ctx *);
+void state_save_tail(struct save *, const struct state_ctx *);
 bool state_load(struct state *, struct save *, struct ack *);
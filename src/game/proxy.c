@@ -505,7 +505,15 @@ void proxy_steps(enum cmd_steps type)
 {
     proxy_cmd(&(struct cmd) {
                 .type = CMD_STEPS,
-                .data = { .steps = type },
+                .data = { .steps = { .type = type } },
+            });
+}
+
+void proxy_steps_prof(mod_id mod)
+{
+    proxy_cmd(&(struct cmd) {
+                .type = CMD_STEPS,
+                .data = { .steps = { .type = cmd_steps_prof, .mod = mod } },
             });
 }
 
@@ -709,3 +717,14 @@ bool proxy_steps_next_energy(world_ts *ts, struct energy *out)
     save_read_into(save, ts);
     return energy_load(out, save);
 }
+
+bool proxy_steps_next_prof(world_ts *ts, mod_id mod, uint64_t *counts, size_t len)
+{
+    if (proxy.state->steps.type != cmd_steps_prof) return false;
+
+    struct save *save = proxy.state->steps.data;
+    if (!save || save_len(save) >= proxy.state->steps.len) return false;
+
+    save_read_into(save, ts);
+    return vm_prof_load(save, mod, counts, len);
+}
@@ -71,6 +71,7 @@ void proxy_load(void);
 void proxy_set_speed(enum speed);
 struct chunk *proxy_chunk(struct coord);
 void proxy_steps(enum cmd_steps);
+void proxy_steps_prof(mod_id);
 void proxy_io(enum io, im_id dst, const vm_word *args, uint8_t len);
 
 
@@ -118,4 +119,5 @@ const struct star *proxy_star_find(struct coord);
 
 bool proxy_steps_next_workers(world_ts *, struct workers *);
 bool proxy_steps_next_energy(world_ts *, struct energy *);
+bool proxy_steps_next_prof(world_ts *, mod_id, uint64_t *counts, size_t len);
 
@@ -3,17 +3,62 @@
    FreeBSD-style copyright and disclaimer apply
 */
 
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+// -----------------------------------------------------------------------------
+// futex
+// -----------------------------------------------------------------------------
+
+static void shard_futex_wait(atomic_uint *word, unsigned value)
+{
+    long ret = syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+    if (ret == -1 && errno != EAGAIN && errno != EINTR)
+        fail_errno("unable to wait on futex");
+}
+
+static void shard_futex_wake(atomic_uint *word, int waiters)
+{
+    long ret = syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, waiters, nullptr, nullptr, 0);
+    if (ret == -1) fail_errno("unable to wake futex");
+}
+
+
 // -----------------------------------------------------------------------------
 // sync
 // -----------------------------------------------------------------------------
+// value holds the epoch, the number of shards done with the current epoch and
+// the quit bit. Futexes only work on 32 bits words so start and end are bumped
+// alongside value and are only used to park and wake the threads. parked and
+// waiting allow us to skip the wake syscall when nobody is sleeping.
+
+struct shard_sync
+{
+    atomic_size_t value;
+    atomic_uint start, end;
+    atomic_uint parked;
+    atomic_bool waiting;
+};
 
-typedef atomic_size_t shard_sync;
 typedef size_t shard_sync_epoch;
 
 static_assert(sizeof(size_t) == 8);
 constexpr size_t shard_sync_quit_mask = 1ULL << 63;
 constexpr size_t shard_sync_epoch_bit = 1ULL << 8;
 
+// Spinning is the lowest latency option when steps are back to back but burns
+// a core while paused. The spin budget is therefore adjusted based on whether
+// the last wait was resolved while spinning or whether we had to park.
+constexpr sys_ts shard_sync_spin_min = 1 * sys_usec;
+constexpr sys_ts shard_sync_spin_max = 1 * sys_msec;
+
+struct shard_sync_wait
+{
+    sys_ts budget;
+    struct metric *spin, *park;
+};
+
 static shard_sync_epoch shard_sync_get_epoch(size_t value)
 {
     return value & ~(shard_sync_epoch_bit - 1);
@@ -24,65 +69,128 @@ static uint8_t shard_sync_get_count(size_t value)
     return value & (shard_sync_epoch_bit - 1);
 }
 
+static void shard_sync_spun(struct shard_sync_wait *wait, sys_ts t0, bool parked)
+{
+    sys_ts t1 = sys_now();
+
+    if (parked) {
+        wait->park->n++;
+        wait->park->t += t1 - t0;
+        wait->budget = legion_max(wait->budget / 2, shard_sync_spin_min);
+    }
+    else {
+        wait->spin->n++;
+        wait->spin->t += t1 - t0;
+        wait->budget = legion_min(wait->budget * 2, shard_sync_spin_max);
+    }
+}
+
 // main thread
 
-static void shard_sync_init(shard_sync *sync)
+static void shard_sync_init(struct shard_sync *sync)
+{
+    atomic_store_explicit(&sync->value, shard_sync_epoch_bit - 1, memory_order_relaxed);
+}
+
+static void shard_sync_wake_shards(struct shard_sync *sync)
 {
-    atomic_store_explicit(sync, shard_sync_epoch_bit - 1, memory_order_relaxed);
+    atomic_fetch_add(&sync->start, 1);
+    if (atomic_load(&sync->parked)) shard_futex_wake(&sync->start, INT_MAX);
 }
 
-static void shard_sync_quit(shard_sync *sync)
+static void shard_sync_quit(struct shard_sync *sync)
 {
-    atomic_fetch_or_explicit(sync, shard_sync_quit_mask, memory_order_relaxed);
+    atomic_fetch_or(&sync->value, shard_sync_quit_mask);
+    shard_sync_wake_shards(sync);
 }
 
-static void shard_sync_start(shard_sync *sync)
+static void shard_sync_start(struct shard_sync *sync)
 {
-    size_t value = atomic_load_explicit(sync, memory_order_relaxed);
+    size_t value = atomic_load_explicit(&sync->value, memory_order_relaxed);
     value = shard_sync_get_epoch(value) + shard_sync_epoch_bit;
-    atomic_store_explicit(sync, value, memory_order_release);
+    atomic_store(&sync->value, value);
+    shard_sync_wake_shards(sync);
 }
 
-static void shard_sync_wait_end(shard_sync *sync, uint8_t shards)
+static void shard_sync_wait_end(
+        struct shard_sync *sync, uint8_t shards, struct shard_sync_wait *wait)
 {
-    size_t value = 0;
-    do {
-        value = atomic_load_explicit(sync, memory_order_acquire);
-    } while (shard_sync_get_count(value) < shards);
+    bool done(void)
+    {
+        size_t value = atomic_load(&sync->value);
+        return shard_sync_get_count(value) >= shards;
+    }
+
+    sys_ts t0 = sys_now();
+    for (sys_ts end = t0 + wait->budget; sys_now() < end;) {
+        if (done()) { shard_sync_spun(wait, t0, false); return; }
+    }
+
+    // The counter must be read before checking the condition so that an end
+    // that lands in between will fail the futex wait instead of being lost.
+    while (true) {
+        unsigned word = atomic_load(&sync->end);
+        atomic_store(&sync->waiting, true);
+        if (done()) break;
+        shard_futex_wait(&sync->end, word);
+    }
+
+    atomic_store(&sync->waiting, false);
+    shard_sync_spun(wait, t0, true);
 }
 
-static void shard_sync_safe(shard_sync *sync, uint8_t shards)
+static void shard_sync_safe(struct shard_sync *sync, uint8_t shards)
 {
-    size_t value = atomic_load_explicit(sync, memory_order_relaxed);
+    size_t value = atomic_load_explicit(&sync->value, memory_order_relaxed);
     assert(value >= shards);
 }
 
 // shard thread
 
-static bool shard_sync_wait_start(shard_sync *sync, shard_sync_epoch epoch)
+static bool shard_sync_wait_start(
+        struct shard_sync *sync,
+        shard_sync_epoch epoch,
+        struct shard_sync_wait *wait)
 {
-    // When paused, we don't want to spin the thread needlessly. A futex would
-    // make this more responsive but a simple 1ms sleep is a good-enough simple
-    // approximation that will work in most cases.
-    constexpr sys_ts period = 1 * sys_msec;
-    sys_ts next = sys_now() + period;
-    bool fast = true;
+    enum { wait_none, wait_start, wait_quit } check(void)
+    {
+        size_t value = atomic_load(&sync->value);
+        if (value & shard_sync_quit_mask) return wait_quit;
+        if (shard_sync_get_epoch(value) > epoch) return wait_start;
+        return wait_none;
+    }
+
+    sys_ts t0 = sys_now();
+    for (sys_ts end = t0 + wait->budget; sys_now() < end;) {
+        auto ret = check();
+        if (ret == wait_none) continue;
+        shard_sync_spun(wait, t0, false);
+        return ret == wait_start;
+    }
 
+    auto ret = wait_none;
     while (true) {
-        size_t value = atomic_load_explicit(sync, memory_order_acquire);
-        if (value & shard_sync_quit_mask) return false;
-        if (shard_sync_get_epoch(value) > epoch) return true;
+        unsigned word = atomic_load(&sync->start);
+        atomic_fetch_add(&sync->parked, 1);
+
+        if ((ret = check()) != wait_none) break;
+        shard_futex_wait(&sync->start, word);
 
-        if (fast && sys_now() < next) continue;
-        next += period; fast = false;
-        sys_sleep_until(next);
+        atomic_fetch_sub(&sync->parked, 1);
     }
 
+    atomic_fetch_sub(&sync->parked, 1);
+    shard_sync_spun(wait, t0, true);
+    return ret == wait_start;
 }
 
-static shard_sync_epoch shard_sync_end(shard_sync *sync)
+static shard_sync_epoch shard_sync_end(struct shard_sync *sync)
 {
-    size_t value = atomic_fetch_add_explicit(sync, 1, memory_order_release);
+    size_t value = atomic_fetch_add(&sync->value, 1);
+
+    atomic_fetch_add(&sync->end, 1);
+    if (atomic_load(&sync->waiting)) shard_futex_wake(&sync->end, 1);
+
     return shard_sync_get_epoch(value);
 }
 
@@ -105,28 +213,169 @@ struct shard_scan
     struct coord value;
 };
 
+// Effects of a chunk step that reach outside of the chunk. Messages have a
+// fixed layout so they can be applied without parsing and the only variable
+// length payload, the lanes data, lives in the data array of the outbox.
+enum shard_msg_type : uint8_t
+{
+    shard_msg_nil = 0,
+    shard_msg_io,
+    shard_msg_log,
+    shard_msg_tech,
+    shard_msg_lanes,
+    shard_msg_probe,
+    shard_msg_scan,
+};
+
+struct shard_msg
+{
+    enum shard_msg_type type;
+    user_id user;
+
+    union
+    {
+        struct user_io io;
+        struct log_line log;
+        struct { enum item item; uint8_t bit; } tech;
+        struct { struct lanes_packet packet; size_t data; } lanes;
+        struct { struct coord src, dst; enum item item; } probe;
+        struct { struct coord src; struct scan_it it; } scan;
+    };
+};
+
+// Only written by the shard thread that owns it and only read once every
+// shard is done executing so no synchronization is required.
+struct shard_outbox
+{
+    size_t len, cap;
+    struct shard_msg *list;
+
+    size_t data_len, data_cap;
+    vm_word *data;
+};
+
+// cost is the time spent in chunk_step since the last balance while load is
+// the smoothed history used to make the balancing decisions.
+//
+// A chunk can be stepped by any shard thread so its output is written to the
+// outbox of whichever shard executed it. out records where that output lives
+// so that it can be merged in coordinate order regardless of who stepped it.
+struct shard_chunk
+{
+    struct chunk *chunk;
+    sys_ts cost, load;
+    struct { struct shard_outbox *box; size_t begin, end; } out;
+};
+
+// Lane arrivals destined to the chunks of a shard. The payload is copied into
+// data as the lane packets are freed as soon as they're delivered. out is the
+// output of the arrival in the outbox of the shard.
+struct shard_arrival
+{
+    struct chunk *chunk;
+    struct coord src;
+    enum item item;
+    size_t len, data;
+    struct { size_t begin, end; } out;
+};
+
+// Position of a chunk in the chunk list of its shard.
+struct shard_ref
+{
+    uint64_t key;
+    struct shard *shard;
+    size_t index;
+};
+
+// Output of a lane arrival or of a chunk step. Only the output of a step is
+// known to belong to the owner of its chunk.
+struct shard_span
+{
+    uint64_t key;
+    size_t seq;
+    struct shard *shard;
+    const struct chunk *chunk;
+    const struct shard_outbox *box;
+    size_t begin, end;
+};
+
+// Chunks migrate between shards based on their measured cost and are stepped
+// by whichever shard claims them first so the output is merged in coordinate
+// order which keeps the simulation deterministic no matter where a chunk lives
+// or who stepped it. refs is sorted by coordinate and is only rebuilt when
+// chunks are added or migrated. spans is the merged order of the last step
+// which is shared by the shards while applying the user effects.
+struct shard_order
+{
+    bool stale;
+    struct { size_t len, cap; struct shard_ref *list; } refs;
+    struct { size_t len, cap; struct shard_span *list; } spans;
+};
+
+// Phase executed by the shard threads on the next epoch.
+enum shard_phase : uint8_t
+{
+    shard_phase_exec,
+    shard_phase_apply,
+    shard_phase_resolve,
+};
+
 struct shard
 {
     struct world *world;
     struct metrics_shard *metrics;
 
-    struct vec64 *chunks;
-    struct save *out;
+    struct shard_outbox out;
+
+    // Instruction counts of the chunks stepped by this shard's thread which is
+    // only set while profiling is enabled in shards.
+    struct vm_prof *prof;
+
+    // User effects are applied in parallel by partitioning the users across
+    // the shard threads where this shard handles the users matching rank.
+    enum shard_phase phase;
+    size_t rank, ranks;
+    const struct shard_order *order;
 
     threads_id thread;
     struct threads *threads;
-    shard_sync *sync;
+    struct shard_sync *sync;
+    shard_sync_epoch epoch;
+    struct shard_sync_wait wait;
+
+    // Index of the next chunk to step which is shared with the other shard
+    // threads so that they can steal chunks once they're done with their own.
+    atomic_size_t next;
+    size_t index, peers_len;
+    struct shard *const *peers;
+
+    struct
+    {
+        size_t len, cap;
+        struct shard_chunk *list;
+    } chunks;
+
+    struct
+    {
+        size_t len, cap;
+        struct shard_arrival *list;
+
+        size_t data_len, data_cap;
+        vm_word *data;
+    } inbox;
 
     struct
     {
         size_t len, cap;
         struct shard_probe *table;
+        struct htable index;
     } probe;
 
     struct
     {
         size_t len, cap;
         struct shard_scan *table;
+        struct htable index;
     } scan;
 };
 
@@ -140,23 +389,39 @@ struct shard *shard_alloc(size_t index, struct world *world)
     *shard = (struct shard) {
         .world = world,
         .metrics = world_metrics(world)->shard + index,
-        .out = save_mem_new(),
+        .index = index,
     };
     return shard;
 }
 
 void shard_free(struct shard *shard)
 {
-    vec64_free(shard->chunks);
-    save_mem_free(shard->out);
+    mem_free(shard->chunks.list);
+    mem_free(shard->inbox.list);
+    mem_free(shard->inbox.data);
+    mem_free(shard->out.list);
+    mem_free(shard->out.data);
     mem_free(shard->probe.table);
+    htable_reset(&shard->probe.index);
     mem_free(shard->scan.table);
+    htable_reset(&shard->scan.index);
+    vm_prof_free(shard->prof);
     mem_free(shard);
 }
 
+static struct shard_chunk *shard_chunk_append(struct shard *shard)
+{
+    if (shard->chunks.len == shard->chunks.cap) {
+        size_t old = mem_array_len_grow(&shard->chunks.cap, 4);
+        shard->chunks.list = mem_array_realloc_t(shard->chunks.list, old, shard->chunks.cap);
+    }
+
+    return shard->chunks.list + shard->chunks.len++;
+}
+
 void shard_register(struct shard *shard, struct chunk *chunk)
 {
-    shard->chunks = vec64_append(shard->chunks, (uint64_t) chunk);
+    *shard_chunk_append(shard) = (struct shard_chunk) { .chunk = chunk };
     chunk_shard(chunk, shard);
 }
 
@@ -188,6 +453,11 @@ const struct tech *shard_tech(struct shard *shard, user_id owner)
     return world_tech(shard->world, owner);
 }
 
+size_t shard_tech_learned(const struct shard *shard)
+{
+    return world_tech_learned(shard->world);
+}
+
 
 // -----------------------------------------------------------------------------
 // read-write
@@ -198,102 +468,132 @@ struct metrics_shard *shard_metrics(struct shard *shard)
     return shard->metrics;
 }
 
-void shard_user_io_push(struct shard *shard, user_id user, struct user_io packet)
+// Set while a shard thread is stepping a chunk such that the output ends up in
+// the outbox of the executing shard and not the one owning the chunk.
+static thread_local struct shard_outbox *shard_exec_out = nullptr;
+
+static struct shard_msg *shard_out(
+        struct shard *shard, enum shard_msg_type type, user_id user)
 {
-    save_write_magic(shard->out, save_magic_io);
-    save_write_value(shard->out, user);
-    save_write_value(shard->out, packet.io);
-    save_write_value(shard->out, packet.src);
-    save_write_value(shard->out, packet.len);
-    save_write(shard->out, packet.args, packet.len * sizeof(packet.args[0]));
-    save_write_magic(shard->out, save_magic_io);
+    struct shard_outbox *out = shard_exec_out ? shard_exec_out : &shard->out;
+
+    if (out->len == out->cap) {
+        size_t old = mem_array_len_grow(&out->cap, 16);
+        out->list = mem_array_realloc_t(out->list, old, out->cap);
+    }
+
+    struct shard_msg *msg = out->list + out->len++;
+    msg->type = type;
+    msg->user = user;
+    return msg;
 }
 
-static void shard_user_io_pop(struct shard *shard)
+static size_t shard_out_data(struct shard *shard, const vm_word *data, size_t len)
 {
-    user_id user = save_read_type(shard->out, typeof(user));
+    struct shard_outbox *out = shard_exec_out ? shard_exec_out : &shard->out;
 
-    struct user_io *packet = world_user_io(shard->world, user);
-    save_read_into(shard->out, &packet->io);
-    save_read_into(shard->out, &packet->src);
-    save_read_into(shard->out, &packet->len);
-    save_read(shard->out, packet->args, packet->len * sizeof(packet->args[0]));
+    if (out->data_len + len > out->data_cap) {
+        size_t old = out->data_cap;
+        out->data_cap = legion_max(old * 2, out->data_len + len);
+        out->data = mem_array_realloc_t(out->data, old, out->data_cap);
+    }
+
+    size_t index = out->data_len;
+    memcpy(out->data + index, data, len * sizeof(*data));
+    out->data_len += len;
+    return index;
+}
+
+static void shard_out_reset(struct shard_outbox *out)
+{
+    out->len = 0;
+    out->data_len = 0;
 }
 
 
-void shard_log_push(struct shard *shard, user_id user, struct log_line log)
+void shard_user_io_push(struct shard *shard, user_id user, struct user_io packet)
 {
-    save_write_magic(shard->out, save_magic_log);
-    save_write_value(shard->out, user);
-    save_write_value(shard->out, log.star);
-    save_write_value(shard->out, log.time);
-    save_write_value(shard->out, log.id);
-    save_write_value(shard->out, log.key);
-    save_write_value(shard->out, log.value);
-    save_write_magic(shard->out, save_magic_log);
+    shard_out(shard, shard_msg_io, user)->io = packet;
 }
 
-static void shard_log_pop(struct shard *shard)
+static void shard_user_io_pop(struct shard *shard, const struct shard_msg *msg)
 {
-    user_id user = save_read_type(shard->out, typeof(user));
+    *world_user_io(shard->world, msg->user) = msg->io;
+}
+
 
-    struct log_line log = {0};
-    save_read_into(shard->out, &log.star);
-    save_read_into(shard->out, &log.time);
-    save_read_into(shard->out, &log.id);
-    save_read_into(shard->out, &log.key);
-    save_read_into(shard->out, &log.value);
+void shard_log_push(struct shard *shard, user_id user, struct log_line log)
+{
+    shard_out(shard, shard_msg_log, user)->log = log;
+}
 
-    log_push(world_log(shard->world, user), log);
+static void shard_log_pop(struct shard *shard, const struct shard_msg *msg)
+{
+    log_push(world_log(shard->world, msg->user), msg->log);
 }
 
 
 void shard_tech_push(struct shard *shard, user_id user, enum item item, uint8_t bit)
 {
-    save_write_magic(shard->out, save_magic_tech);
-    save_write_value(shard->out, user);
-    save_write_value(shard->out, item);
-    save_write_value(shard->out, bit);
-    save_write_magic(shard->out, save_magic_tech);
+    struct shard_msg *msg = shard_out(shard, shard_msg_tech, user);
+    msg->tech.item = item;
+    msg->tech.bit = bit;
 }
 
-static void shard_tech_pop(struct shard *shard)
+static void shard_tech_pop(struct shard *shard, const struct shard_msg *msg)
 {
-    user_id user = save_read_type(shard->out, typeof(user));
-    enum item item = save_read_type(shard->out, typeof(item));
-    uint8_t bit = save_read_type(shard->out, typeof(bit));
-
-    tech_learn_bit(world_tech(shard->world, user), item, bit);
+    world_tech_learn_bit(shard->world, msg->user, msg->tech.item, msg->tech.bit);
 }
 
 
 void shard_lanes_push(struct shard *shard, struct lanes_packet packet)
 {
-    save_write_magic(shard->out, save_magic_lanes);
-    save_write_value(shard->out, packet.owner);
-    save_write_value(shard->out, packet.item);
-    save_write_value(shard->out, packet.len);
-    save_write_value(shard->out, packet.speed);
-    save_write_value(shard->out, packet.src);
-    save_write_value(shard->out, packet.dst);
-    save_write(shard->out, packet.data, packet.len * sizeof(*packet.data));
-    save_write_magic(shard->out, save_magic_lanes);
+    size_t data = shard_out_data(shard, packet.data, packet.len);
+
+    struct shard_msg *msg = shard_out(shard, shard_msg_lanes, packet.owner);
+    msg->lanes.packet = packet;
+    msg->lanes.packet.data = nullptr;
+    msg->lanes.data = data;
 }
 
-static void shard_lanes_pop(struct shard *shard)
+static void shard_lanes_pop(
+        struct shard *shard,
+        const struct shard_outbox *in,
+        const struct shard_msg *msg)
 {
-    struct lanes_packet packet = {0};
-    save_read_into(shard->out, &packet.owner);
-    save_read_into(shard->out, &packet.item);
-    save_read_into(shard->out, &packet.len);
-    save_read_into(shard->out, &packet.speed);
-    save_read_into(shard->out, &packet.src);
-    save_read_into(shard->out, &packet.dst);
+    struct lanes_packet packet = msg->lanes.packet;
+    packet.data = in->data + msg->lanes.data;
+    lanes_launch(world_lanes(shard->world), packet);
+}
 
-    packet.data = save_bytes(shard->out) + save_len(shard->out);
-    save_read_skip(shard->out, packet.len * sizeof(*packet.data));
 
-    lanes_launch(world_lanes(shard->world), packet);
+// Called from the sim thread while the shards are idle.
+void shard_lanes_arrive(
+        struct shard *shard, struct chunk *chunk,
+        enum item item, struct coord src, const vm_word *data, size_t len)
+{
+    if (shard->inbox.len == shard->inbox.cap) {
+        size_t old = mem_array_len_grow(&shard->inbox.cap, 4);
+        shard->inbox.list = mem_array_realloc_t(shard->inbox.list, old, shard->inbox.cap);
+    }
+
+    if (shard->inbox.data_len + len > shard->inbox.data_cap) {
+        size_t old = shard->inbox.data_cap;
+        size_t cap = legion_max(old * 2, shard->inbox.data_len + len);
+        shard->inbox.data = mem_array_realloc_t(shard->inbox.data, old, cap);
+        shard->inbox.data_cap = cap;
+    }
+
+    shard->inbox.list[shard->inbox.len++] = (struct shard_arrival) {
+        .chunk = chunk,
+        .src = src,
+        .item = item,
+        .len = len,
+        .data = shard->inbox.data_len,
+    };
+
+    memcpy(shard->inbox.data + shard->inbox.data_len, data, len * sizeof(*data));
+    shard->inbox.data_len += len;
 }
 
 
@@ -303,11 +603,10 @@ void shard_probe_push(
         struct coord dst,
         enum item item)
 {
-    save_write_magic(shard->out, save_magic_probe);
-    save_write_value(shard->out, src);
-    save_write_value(shard->out, dst);
-    save_write_value(shard->out, item);
-    save_write_magic(shard->out, save_magic_probe);
+    struct shard_msg *msg = shard_out(shard, shard_msg_probe, user_admin);
+    msg->probe.src = src;
+    msg->probe.dst = dst;
+    msg->probe.item = item;
 }
 
 static struct shard_probe *shard_probe_append(struct shard *shard)
@@ -320,19 +619,69 @@ static struct shard_probe *shard_probe_append(struct shard *shard)
     return shard->probe.table + shard->probe.len++;
 }
 
-static void shard_probe_pop(struct shard *shard)
+// Sectors are lazily generated which isn't safe to do while resolving in
+// parallel so we make sure they exist while we're still on the main thread.
+static void shard_probe_pop(struct shard *shard, const struct shard_msg *msg)
 {
     struct shard_probe *probe = shard_probe_append(shard);
-    save_read_into(shard->out, &probe->src);
-    save_read_into(shard->out, &probe->dst);
-    save_read_into(shard->out, &probe->item);
+    probe->src = msg->probe.src;
+    probe->dst = msg->probe.dst;
+    probe->item = msg->probe.item;
+    (void) world_sector(shard->world, probe->dst);
+}
+
+static uint64_t shard_probe_key(struct coord coord, enum item item)
+{
+    uint64_t key = hash_u64(coord_to_u64(coord)) ^ item;
+    return key ? key : 1;
+}
+
+static bool shard_probe_match(
+        const struct shard_probe *probe, struct coord coord, enum item item)
+{
+    return item == probe->item && coord_eq(coord, probe->dst);
+}
+
+// The index maps to the first probe for a given target and duplicates are
+// resolved by copying its value. Collisions on the key are left out of the
+// index and are found through a linear search in shard_probe_get.
+static void shard_probe_resolve(struct shard *shard)
+{
+    htable_clear(&shard->probe.index);
+
+    for (size_t i = 0; i < shard->probe.len; ++i) {
+        struct shard_probe *probe = shard->probe.table + i;
+        uint64_t key = shard_probe_key(probe->dst, probe->item);
+
+        struct htable_ret ret = htable_get(&shard->probe.index, key);
+        if (ret.ok) {
+            const struct shard_probe *first = shard->probe.table + ret.value;
+            if (shard_probe_match(first, probe->dst, probe->item)) {
+                probe->value = first->value;
+                continue;
+            }
+        }
+        else {
+            ret = htable_put(&shard->probe.index, key, i);
+            assert(ret.ok);
+        }
+
+        probe->value = world_probe(shard->world, probe->dst, probe->item);
+    }
 }
 
 ssize_t shard_probe_get(const struct shard *shard, struct coord coord, enum item item)
 {
+    struct htable_ret ret =
+        htable_get(&shard->probe.index, shard_probe_key(coord, item));
+    if (ret.ok) {
+        const struct shard_probe *probe = shard->probe.table + ret.value;
+        if (shard_probe_match(probe, coord, item)) return probe->value;
+    }
+
     for (size_t i = 0; i < shard->probe.len; ++i) {
         const struct shard_probe *probe = shard->probe.table + i;
-        if (item != probe->item && !coord_eq(coord, probe->dst)) continue;
+        if (!shard_probe_match(probe, coord, item)) continue;
         return probe->value;
     }
 
@@ -342,10 +691,9 @@ ssize_t shard_probe_get(const struct shard *shard, struct coord coord, enum item
 
 void shard_scan_push(struct shard *shard, struct coord src, struct scan_it it)
 {
-    save_write_magic(shard->out, save_magic_scan);
-    save_write_value(shard->out, src);
-    save_write_value(shard->out, it);
-    save_write_magic(shard->out, save_magic_scan);
+    struct shard_msg *msg = shard_out(shard, shard_msg_scan, user_admin);
+    msg->scan.src = src;
+    msg->scan.it = it;
 }
 
 static struct shard_scan *shard_scan_append(struct shard *shard)
@@ -358,15 +706,54 @@ static struct shard_scan *shard_scan_append(struct shard *shard)
     return shard->scan.table + shard->scan.len++;
 }
 
-static void shard_scan_pop(struct shard *shard)
+static void shard_scan_pop(struct shard *shard, const struct shard_msg *msg)
 {
     struct shard_scan *scan = shard_scan_append(shard);
-    save_read_into(shard->out, &scan->src);
-    save_read_into(shard->out, &scan->it);
+    scan->src = msg->scan.src;
+    scan->it = msg->scan.it;
+    (void) world_sector(shard->world, scan->it.coord);
+}
+
+static uint64_t shard_scan_key(struct scan_it it)
+{
+    uint64_t key = hash_u64(coord_to_u64(it.coord)) ^ hash_u64(it.index);
+    return key ? key : 1;
+}
+
+// Same scheme as shard_probe_resolve.
+static void shard_scan_resolve(struct shard *shard)
+{
+    htable_clear(&shard->scan.index);
+
+    for (size_t i = 0; i < shard->scan.len; ++i) {
+        struct shard_scan *scan = shard->scan.table + i;
+        uint64_t key = shard_scan_key(scan->it);
+
+        struct htable_ret ret = htable_get(&shard->scan.index, key);
+        if (ret.ok) {
+            const struct shard_scan *first = shard->scan.table + ret.value;
+            if (scan_it_eq(first->it, scan->it)) {
+                scan->value = first->value;
+                continue;
+            }
+        }
+        else {
+            ret = htable_put(&shard->scan.index, key, i);
+            assert(ret.ok);
+        }
+
+        scan->value = world_scan(shard->world, scan->it);
+    }
 }
 
 struct coord shard_scan_get(struct shard *shard, struct scan_it it)
 {
+    struct htable_ret ret = htable_get(&shard->scan.index, shard_scan_key(it));
+    if (ret.ok) {
+        const struct shard_scan *scan = shard->scan.table + ret.value;
+        if (scan_it_eq(scan->it, it)) return scan->value;
+    }
+
     for (size_t i = 0; i < shard->scan.len; ++i) {
         const struct shard_scan *scan = shard->scan.table + i;
         if (!scan_it_eq(scan->it, it)) continue;
@@ -381,61 +768,323 @@ struct coord shard_scan_get(struct shard *shard, struct scan_it it)
 // step
 // -----------------------------------------------------------------------------
 
+// Only reads the world which is safe to do in parallel as long as no chunks
+// are being stepped.
+static size_t shard_resolve(struct shard *shard)
+{
+    shard_probe_resolve(shard);
+    shard_scan_resolve(shard);
+    return shard->probe.len + shard->scan.len;
+}
+
 static void shard_begin(struct shard *shard)
 {
-    for (size_t i = 0; i < shard->probe.len; ++i) {
-        struct shard_probe *probe = shard->probe.table + i;
-        probe->value = world_probe(shard->world, probe->dst, probe->item);
+    shard_out_reset(&shard->out);
+
+    // Chunks can't be claimed until the inbox has been drained in shard_exec.
+    atomic_store_explicit(&shard->next, shard->chunks.len, memory_order_relaxed);
+}
+
+// The inbox is kept around until its output is merged in shard_end.
+static size_t shard_exec_inbox(struct shard *shard)
+{
+    shard_exec_out = &shard->out;
+
+    for (size_t i = 0; i < shard->inbox.len; ++i) {
+        struct shard_arrival *it = shard->inbox.list + i;
+        it->out.begin = shard->out.len;
+
+        chunk_lanes_arrive(
+                it->chunk, it->item, it->src,
+                shard->inbox.data + it->data, it->len);
+
+        it->out.end = shard->out.len;
     }
 
-    for (size_t i = 0; i < shard->scan.len; ++i) {
-        struct shard_scan *scan = shard->scan.table + i;
-        scan->value = world_scan(shard->world, scan->it);
+    shard_exec_out = nullptr;
+
+    // Publishes the arrivals to the shards that will steal our chunks.
+    atomic_store_explicit(&shard->next, 0, memory_order_release);
+    return shard->inbox.len;
+}
+
+// Steps the chunks of owner until there are none left to claim. Returns the
+// number of chunks that were stepped by the executing shard.
+static size_t shard_exec_chunks(struct shard *shard, struct shard *owner)
+{
+    size_t steps = 0;
+    shard_exec_out = &shard->out;
+
+    while (true) {
+        size_t i = atomic_fetch_add_explicit(&owner->next, 1, memory_order_acquire);
+        if (i >= owner->chunks.len) break;
+
+        struct shard_chunk *it = owner->chunks.list + i;
+        it->out.box = &shard->out;
+        it->out.begin = shard->out.len;
+
+        sys_ts t0 = sys_now();
+        chunk_step(it->chunk, shard->metrics);
+        it->cost += sys_now() - t0;
+
+        it->out.end = shard->out.len;
+        steps++;
     }
 
-    save_mem_reset(shard->out);
+    shard_exec_out = nullptr;
+    return steps;
 }
 
-static void shard_exec(struct shard *shard)
+static size_t shard_exec(struct shard *shard)
 {
     shard->metrics->active = true;
+    vm_prof_bind(shard->prof);
+
+    sys_ts mt = metric_now();
+    size_t arrivals = shard_exec_inbox(shard);
+    mt = metric_inc(shard->metrics, shard.inbox, arrivals, mt);
+
+    size_t steps = shard_exec_chunks(shard, shard);
+    mt = metric_inc(shard->metrics, shard.chunks, steps, mt);
+
+    // Start with the shard following us to avoid having all the idle shards
+    // pile up on the same victim.
+    size_t stolen = 0;
+    for (size_t i = 1; i < shard->peers_len; ++i) {
+        struct shard *peer = shard->peers[(shard->index + i) % shard->peers_len];
+        if (peer) stolen += shard_exec_chunks(shard, peer);
+    }
+    metric_inc(shard->metrics, shard.steal, stolen, mt);
+
+    vm_prof_bind(nullptr);
+    return steps + stolen;
+}
+
+// World effects are applied serially by the main thread. User effects are
+// skipped and counted to be applied in shard_apply.
+static size_t shard_end_out(
+        struct shard *shard,
+        const struct shard_outbox *in,
+        size_t begin, size_t end)
+{
+    size_t users = 0;
+
+    for (size_t i = begin; i < end; ++i) {
+        const struct shard_msg *msg = in->list + i;
+
+        switch (msg->type)
+        {
+        case shard_msg_lanes: { shard_lanes_pop(shard, in, msg); break; }
+        case shard_msg_probe: { shard_probe_pop(shard, msg); break; }
+        case shard_msg_scan: { shard_scan_pop(shard, msg); break; }
+        case shard_msg_io:
+        case shard_msg_log:
+        case shard_msg_tech: { users++; break; }
+        default: { assert(false); }
+        }
+    }
+
+    return users;
+}
+
+static void shard_order_free(struct shard_order *order)
+{
+    mem_free(order->refs.list);
+    mem_free(order->spans.list);
+}
+
+static void shard_order_refs(
+        struct shard_order *order, struct shard *const *shards, size_t len)
+{
+    size_t chunks = 0;
+    for (size_t i = 0; i < len; ++i)
+        if (shards[i]) chunks += shards[i]->chunks.len;
+
+    // Chunks are never removed so a change in count means new chunks.
+    if (!order->stale && chunks == order->refs.len) return;
+    order->stale = false;
+
+    if (chunks > order->refs.cap) {
+        size_t old = order->refs.cap;
+        order->refs.cap = legion_max(old * 2, chunks);
+        order->refs.list = mem_array_realloc_t(order->refs.list, old, order->refs.cap);
+    }
+
+    order->refs.len = 0;
+    for (size_t i = 0; i < len; ++i) {
+        struct shard *shard = shards[i];
+        if (!shard) continue;
+
+        for (size_t j = 0; j < shard->chunks.len; ++j) {
+            struct chunk *chunk = shard->chunks.list[j].chunk;
+            order->refs.list[order->refs.len++] = (struct shard_ref) {
+                .key = coord_to_u64(chunk_star(chunk)->coord),
+                .shard = shard,
+                .index = j,
+            };
+        }
+    }
+
+    int cmp(const void *lhs_, const void *rhs_)
+    {
+        const struct shard_ref *lhs = lhs_, *rhs = rhs_;
+        return lhs->key < rhs->key ? -1 : lhs->key > rhs->key;
+    }
+
+    qsort(order->refs.list, order->refs.len, sizeof(*order->refs.list), cmp);
+}
+
+static struct shard_span *shard_order_append(struct shard_order *order)
+{
+    if (order->spans.len == order->spans.cap) {
+        size_t old = mem_array_len_grow(&order->spans.cap, 16);
+        order->spans.list = mem_array_realloc_t(order->spans.list, old, order->spans.cap);
+    }
+
+    return order->spans.list + order->spans.len++;
+}
+
+// Arrivals come first ordered by the coordinate of their chunk and then by
+// their position in the inbox. All the arrivals of a chunk go through the same
+// inbox so their relative order doesn't depend on where the chunk lives.
+static void shard_order_arrivals(
+        struct shard_order *order, struct shard *const *shards, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        struct shard *shard = shards[i];
+        if (!shard) continue;
+
+        for (size_t j = 0; j < shard->inbox.len; ++j) {
+            const struct shard_arrival *it = shard->inbox.list + j;
+            *shard_order_append(order) = (struct shard_span) {
+                .key = coord_to_u64(chunk_star(it->chunk)->coord),
+                .seq = j,
+                .shard = shard,
+                .box = &shard->out,
+                .begin = it->out.begin,
+                .end = it->out.end,
+            };
+        }
+
+        shard->inbox.len = 0;
+        shard->inbox.data_len = 0;
+    }
 
-    for (size_t i = 0; i < vec64_len(shard->chunks); ++i)
-        chunk_step((struct chunk *)shard->chunks->vals[i]);
+    int cmp(const void *lhs_, const void *rhs_)
+    {
+        const struct shard_span *lhs = lhs_, *rhs = rhs_;
+        if (lhs->key != rhs->key) return lhs->key < rhs->key ? -1 : 1;
+        return lhs->seq < rhs->seq ? -1 : lhs->seq > rhs->seq;
+    }
 
+    qsort(order->spans.list, order->spans.len, sizeof(*order->spans.list), cmp);
 }
 
-static void shard_end(struct shard *shard)
+static void shard_order_build(
+        struct shard_order *order, struct shard *const *shards, size_t len)
 {
-    shard->scan.len = 0;
-    shard->probe.len = 0;
+    order->spans.len = 0;
+    shard_order_arrivals(order, shards, len);
+    shard_order_refs(order, shards, len);
+
+    for (size_t i = 0; i < order->refs.len; ++i) {
+        const struct shard_ref *ref = order->refs.list + i;
+        const struct shard_chunk *it = ref->shard->chunks.list + ref->index;
+        if (!it->out.box) continue;
+
+        *shard_order_append(order) = (struct shard_span) {
+            .key = ref->key,
+            .shard = ref->shard,
+            .chunk = it->chunk,
+            .box = it->out.box,
+            .begin = it->out.begin,
+            .end = it->out.end,
+        };
+    }
+}
 
-    size_t len = save_len(shard->out);
-    save_mem_reset(shard->out);
+// World effects are applied serially by the main thread in the order of
+// shard_order. Returns the number of user effects left to apply.
+static size_t shard_end(
+        struct shard_order *order, struct shard *const *shards, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (!shards[i]) continue;
+        shards[i]->scan.len = 0;
+        shards[i]->probe.len = 0;
+    }
 
-    while (save_len(shard->out) < len) {
-        enum save_magic magic = save_read_type(shard->out, typeof(magic));
+    shard_order_build(order, shards, len);
 
-        switch (magic)
+    size_t users = 0;
+    for (size_t i = 0; i < order->spans.len; ++i) {
+        const struct shard_span *it = order->spans.list + i;
+        users += shard_end_out(it->shard, it->box, it->begin, it->end);
+    }
+
+    return users;
+}
+
+static size_t shard_apply_out(
+        struct shard *shard,
+        const struct shard_outbox *in,
+        size_t begin, size_t end)
+{
+    size_t applied = 0;
+
+    for (size_t i = begin; i < end; ++i) {
+        const struct shard_msg *msg = in->list + i;
+        if (msg->user % shard->ranks != shard->rank) continue;
+
+        switch (msg->type)
         {
-        case save_magic_io: { shard_user_io_pop(shard); break; }
-        case save_magic_lanes: { shard_lanes_pop(shard); break; }
-        case save_magic_log: { shard_log_pop(shard); break; }
-        case save_magic_tech: { shard_tech_pop(shard); break; }
-        case save_magic_probe: { shard_probe_pop(shard); break; }
-        case save_magic_scan: { shard_scan_pop(shard); break; }
-        default: { assert(false); }
+        case shard_msg_io: { shard_user_io_pop(shard, msg); break; }
+        case shard_msg_log: { shard_log_pop(shard, msg); break; }
+        case shard_msg_tech: { shard_tech_pop(shard, msg); break; }
+        default: { continue; }
         }
 
-        assert(save_read_magic(shard->out, magic));
+        applied++;
+    }
+
+    return applied;
+}
+
+// User effects only touch the state of their user so the users are split
+// across the shards and each shard walks the merged output, in the same order
+// as shard_end, to apply the effects of its own users. All the effects of a
+// chunk step belong to its owner which lets us skip most steps without looking
+// at their output.
+static size_t shard_apply(struct shard *shard)
+{
+    size_t applied = 0;
+
+    for (size_t i = 0; i < shard->order->spans.len; ++i) {
+        const struct shard_span *it = shard->order->spans.list + i;
+        if (it->chunk && chunk_owner(it->chunk) % shard->ranks != shard->rank)
+            continue;
+        applied += shard_apply_out(shard, it->box, it->begin, it->end);
     }
+
+    return applied;
 }
 
 void shard_step(struct shard *shard)
 {
+    struct shard_order order = {0};
+    shard->order = &order;
+
+    shard_resolve(shard);
     shard_begin(shard);
     shard_exec(shard);
-    shard_end(shard);
+    shard_end(&order, &shard, 1);
+
+    shard->rank = 0;
+    shard->ranks = 1;
+    shard_apply(shard);
+
+    shard->order = nullptr;
+    shard_order_free(&order);
 }
 
 
@@ -446,16 +1095,30 @@ void shard_step(struct shard *shard)
 static void shard_thread_run(void *ctx)
 {
     struct shard *shard = ctx;
-    shard_sync_epoch epoch = 0;
+    shard_sync_epoch epoch = shard->epoch;
 
     sys_ts mt = metric_now();
-    while (shard_sync_wait_start(shard->sync, epoch)) {
+    while (shard_sync_wait_start(shard->sync, epoch, &shard->wait)) {
         mt = metric_inc(shard->metrics, shard.idle, 1, mt);
 
-        shard_exec(ctx);
-        epoch = shard_sync_end(shard->sync);
+        switch (shard->phase)
+        {
+        case shard_phase_exec: { shard_exec(shard); break; }
+        case shard_phase_apply: {
+            sys_ts t0 = metric_now();
+            metric_inc(shard->metrics, shard.apply, shard_apply(shard), t0);
+            break;
+        }
+        case shard_phase_resolve: {
+            sys_ts t0 = metric_now();
+            metric_inc(shard->metrics, shard.resolve, shard_resolve(shard), t0);
+            break;
+        }
+        default: { assert(false); }
+        }
 
-        mt = metric_inc(shard->metrics, shard.chunks, shard->chunks->len, mt);
+        epoch = shard_sync_end(shard->sync);
+        mt = metric_now();
     }
 }
 
@@ -463,11 +1126,29 @@ static struct shard *shard_thread_alloc(
         size_t index,
         struct world *world,
         struct threads *threads,
-        shard_sync *sync)
+        struct shard_sync *sync,
+        const struct shard_order *order,
+        struct shard *const *peers,
+        size_t peers_len)
 {
     struct shard *shard = shard_alloc(index, world);
     shard->sync = sync;
+    shard->order = order;
     shard->threads = threads;
+    shard->peers = peers;
+    shard->peers_len = peers_len;
+
+    // Shards can be allocated after the first step so the thread must start
+    // from the current epoch or it would run its chunks outside of a step.
+    size_t value = atomic_load_explicit(&sync->value, memory_order_relaxed);
+    shard->epoch = shard_sync_get_epoch(value);
+
+    shard->wait = (struct shard_sync_wait) {
+        .budget = shard_sync_spin_max,
+        .spin = &shard->metrics->shard.spin,
+        .park = &shard->metrics->shard.park,
+    };
+
     shard->thread = threads_fork(threads, shard_thread_run, shard);
     return shard;
 }
@@ -485,15 +1166,34 @@ static void shard_thread_free(struct shard *shard)
 
 static_assert(shards_cap == threads_cpu_cap);
 
+// Chunks are initially assigned to a shard by hashing their coordinate which
+// gives no guarantees on how the load is spread across the shards. To fix this
+// the measured chunk_step costs are periodically used to migrate a few chunks
+// from the most loaded shard to the least loaded shard.
+constexpr world_ts shards_balance_period = 100;
+constexpr size_t shards_balance_moves = 8;
+constexpr sys_ts shards_balance_slack = 8;
+
+// Below this many user effects or pending probes and scans it's cheaper to
+// do the work on the main thread than to pay for another round trip through
+// the shard threads.
+constexpr size_t shards_apply_min = 256;
+constexpr size_t shards_resolve_min = 256;
+
 struct shards
 {
     struct threads *threads;
     struct world *world;
     struct metrics *metrics;
-    shard_sync sync;
+    struct shard_sync sync;
+    struct shard_sync_wait wait;
 
     size_t len, active;
     struct shard *shards[shards_cap];
+    struct shard_order order;
+
+    // Merged counts of the last step when profiling is enabled.
+    struct vm_prof *prof;
 };
 
 struct shards *shards_alloc(struct world *world)
@@ -502,6 +1202,11 @@ struct shards *shards_alloc(struct world *world)
     shards->world = world;
     shards->metrics = world_metrics(world);
     shard_sync_init(&shards->sync);
+    shards->wait = (struct shard_sync_wait) {
+        .budget = shard_sync_spin_max,
+        .spin = &shards->metrics->shards.spin,
+        .park = &shards->metrics->shards.park,
+    };
     shards->threads = threads_alloc(threads_pool_shards);
     shards->len = threads_cpus(shards->threads);
     return shards;
@@ -518,38 +1223,254 @@ void shards_free(struct shards *shards)
     }
     threads_free(shards->threads);
 
+    shard_order_free(&shards->order);
+    vm_prof_free(shards->prof);
     mem_free(shards);
 }
 
-struct shard *shards_get(struct shards *shards, struct coord coord)
+static struct shard *shards_index(struct shards *shards, size_t index)
 {
-    shard_sync_safe(&shards->sync, shards->active);
-
-    size_t index = hash_u64(coord_to_u64(coord)) % shards->len;
-
     struct shard **shard = shards->shards + index;
     if (!*shard) {
         *shard = shard_thread_alloc(
                 index,
                 shards->world,
                 shards->threads,
-                &shards->sync);
+                &shards->sync,
+                &shards->order,
+                shards->shards,
+                shards->len);
         shards->active++;
     }
 
     return *shard;
 }
 
+struct shard *shards_get(struct shards *shards, struct coord coord)
+{
+    shard_sync_safe(&shards->sync, shards->active);
+    return shards_index(shards, hash_u64(coord_to_u64(coord)) % shards->len);
+}
+
 void shards_register(struct shards *shards, struct chunk *chunk)
 {
     struct shard *shard = shards_get(shards, chunk_star(chunk)->coord);
     shard_register(shard, chunk);
 }
 
+// Pending probes and scans are resolved in the shard that will read them so
+// they need to follow the chunk.
+static void shards_migrate(struct shard *src, struct shard *dst, size_t index)
+{
+    struct shard_chunk it = src->chunks.list[index];
+    struct coord coord = chunk_star(it.chunk)->coord;
+
+    // Preserves the order of the remaining chunks to keep the steps stable.
+    src->chunks.len--;
+    memmove(src->chunks.list + index,
+            src->chunks.list + index + 1,
+            (src->chunks.len - index) * sizeof(*src->chunks.list));
+
+    *shard_chunk_append(dst) = it;
+    chunk_shard(it.chunk, dst);
+
+    for (size_t i = 0; i < src->probe.len;) {
+        struct shard_probe *probe = src->probe.table + i;
+        if (!coord_eq(probe->src, coord)) { i++; continue; }
+
+        *shard_probe_append(dst) = *probe;
+        *probe = src->probe.table[--src->probe.len];
+    }
+
+    for (size_t i = 0; i < src->scan.len;) {
+        struct shard_scan *scan = src->scan.table + i;
+        if (!coord_eq(scan->src, coord)) { i++; continue; }
+
+        *shard_scan_append(dst) = *scan;
+        *scan = src->scan.table[--src->scan.len];
+    }
+}
+
+// Greedy balancing where each move picks the chunk in the most loaded shard
+// whose cost is closest to half the gap with the least loaded shard. Only
+// moves that reduce the gap are considered which avoids pointless back and
+// forth of a single heavy chunk.
+static void shards_balance(struct shards *shards)
+{
+    sys_ts mt = metric_now();
+
+    sys_ts load[shards_cap] = {0};
+    sys_ts cost[shards_cap] = {0};
+    sys_ts cost_sum = 0, cost_max = 0;
+
+    for (size_t i = 0; i < shards->len; ++i) {
+        struct shard *shard = shards->shards[i];
+        if (!shard) continue;
+
+        for (size_t j = 0; j < shard->chunks.len; ++j) {
+            struct shard_chunk *it = shard->chunks.list + j;
+            it->load = (it->load + it->cost) / 2;
+            cost[i] += it->cost;
+            load[i] += it->load;
+            it->cost = 0;
+        }
+
+        cost_sum += cost[i];
+        cost_max = legion_max(cost_max, cost[i]);
+    }
+
+    size_t moves = 0;
+    for (; moves < shards_balance_moves; ++moves) {
+        size_t hi = 0, lo = 0;
+        for (size_t i = 1; i < shards->len; ++i) {
+            if (load[i] > load[hi]) hi = i;
+            if (load[i] < load[lo]) lo = i;
+        }
+
+        const sys_ts gap = load[hi] - load[lo];
+        if (!gap || gap <= load[hi] / shards_balance_slack) break;
+
+        struct shard *src = shards->shards[hi];
+        size_t pick = src->chunks.len;
+        sys_ts pick_delta = gap;
+
+        for (size_t i = 0; i < src->chunks.len; ++i) {
+            const sys_ts chunk = src->chunks.list[i].load;
+            if (!chunk || chunk >= gap) continue;
+
+            sys_ts delta = chunk > gap / 2 ? chunk - gap / 2 : gap / 2 - chunk;
+            if (delta >= pick_delta) continue;
+
+            pick = i;
+            pick_delta = delta;
+        }
+        if (pick == src->chunks.len) break;
+
+        const sys_ts chunk = src->chunks.list[pick].load;
+        shards_migrate(src, shards_index(shards, lo), pick);
+        shards->order.stale = true;
+        load[hi] -= chunk;
+        load[lo] += chunk;
+    }
+
+    // The wall time of a step is bound by the slowest shard so the time spent
+    // above the average is the time lost waiting at the barrier.
+    shards->metrics->shards.imbalance.n++;
+    shards->metrics->shards.imbalance.t += cost_max - (cost_sum / shards->len);
+
+    metric_inc(shards->metrics, shards.balance, moves, mt);
+}
+
+static void shards_phase(struct shards *shards, enum shard_phase phase)
+{
+    size_t rank = 0;
+    for (size_t i = 0; i < shards->len; ++i) {
+        struct shard *shard = shards->shards[i];
+        if (!shard) continue;
+
+        shard->phase = phase;
+        shard->rank = rank++;
+        shard->ranks = shards->active;
+    }
+
+    shard_sync_start(&shards->sync);
+    shard_sync_wait_end(&shards->sync, shards->active, &shards->wait);
+}
+
+static void shards_apply(struct shards *shards, size_t users)
+{
+    sys_ts mt = metric_now();
+
+    if (users >= shards_apply_min && shards->active > 1)
+        shards_phase(shards, shard_phase_apply);
+
+    else {
+        for (size_t i = 0; i < shards->len; ++i) {
+            struct shard *shard = shards->shards[i];
+            if (!shard) continue;
+
+            shard->rank = 0;
+            shard->ranks = 1;
+            shard_apply(shard);
+            break;
+        }
+    }
+
+    metric_inc(shards->metrics, shards.apply, users, mt);
+}
+
+static void shards_resolve(struct shards *shards)
+{
+    sys_ts mt = metric_now();
+
+    size_t pending = 0;
+    for (size_t i = 0; i < shards->len; ++i) {
+        struct shard *shard = shards->shards[i];
+        if (shard) pending += shard->probe.len + shard->scan.len;
+    }
+
+    if (pending >= shards_resolve_min && shards->active > 1)
+        shards_phase(shards, shard_phase_resolve);
+
+    else {
+        for (size_t i = 0; i < shards->len; ++i) {
+            struct shard *shard = shards->shards[i];
+            if (shard) shard_resolve(shard);
+        }
+    }
+
+    metric_inc(shards->metrics, shards.resolve, pending, mt);
+}
+
+void shards_prof_watch(struct shards *shards, const mod_id *mods, size_t len)
+{
+    if (!len) { vm_prof_free(shards->prof); shards->prof = nullptr; return; }
+
+    if (!shards->prof) shards->prof = vm_prof_new();
+    vm_prof_watch(shards->prof, mods, len);
+}
+
+const struct vm_prof *shards_prof(const struct shards *shards)
+{
+    return shards->prof;
+}
+
+// Shards can be allocated at any point so their counters and watched mods are
+// synced with the state of shards on every step.
+static void shards_prof_begin(struct shards *shards)
+{
+    for (size_t i = 0; i < shards->len; ++i) {
+        struct shard *shard = shards->shards[i];
+        if (!shard) continue;
+
+        if (!shards->prof) {
+            vm_prof_free(shard->prof);
+            shard->prof = nullptr;
+            continue;
+        }
+
+        if (!shard->prof) shard->prof = vm_prof_new();
+        vm_prof_watch_copy(shard->prof, shards->prof);
+    }
+}
+
+static void shards_prof_end(struct shards *shards)
+{
+    if (!shards->prof) return;
+    vm_prof_clear(shards->prof);
+
+    for (size_t i = 0; i < shards->len; ++i) {
+        struct shard *shard = shards->shards[i];
+        if (shard && shard->prof) vm_prof_merge(shards->prof, shard->prof);
+    }
+}
+
 void shards_step(struct shards *shards)
 {
     shard_sync_safe(&shards->sync, shards->active);
 
+    shards_resolve(shards);
+
     sys_ts mt = metric_now();
 
     for (size_t i = 0; i < shards->len; ++i) {
@@ -557,19 +1478,22 @@ void shards_step(struct shards *shards)
         if (shard) shard_begin(shard);
     }
 
+    shards_prof_begin(shards);
     mt = metric_inc(shards->metrics, shards.begin, shards->len, mt);
 
-    shard_sync_start(&shards->sync);
-    shard_sync_wait_end(&shards->sync, shards->active);
+    shards_phase(shards, shard_phase_exec);
 
     mt = metric_inc(shards->metrics, shards.wait, shards->len, mt);
+    shards_prof_end(shards);
 
-    for (size_t i = 0; i < shards->len; ++i) {
-        struct shard *shard = shards->shards[i];
-        if (shard) shard_end(shard);
-    }
+    size_t users = shard_end(&shards->order, shards->shards, shards->len);
 
     mt = metric_inc(shards->metrics, shards.end, shards->len, mt);
+
+    shards_apply(shards, users);
+
+    if (!(world_time(shards->world) % shards_balance_period))
+        shards_balance(shards);
 }
 
 void shards_save(struct shards *shards, struct save *save)
@@ -623,6 +1547,7 @@ struct shards *shards_load(struct world *world, struct save *save)
         probe->src = src;
         save_read_into(save, &probe->dst);
         save_read_into(save, &probe->item);
+        (void) world_sector(world, probe->dst);
     }
 
     while ((head = save_read_type(save, typeof(head)))) {
@@ -633,6 +1558,7 @@ struct shards *shards_load(struct world *world, struct save *save)
         struct shard_scan *scan = shard_scan_append(shard);
         scan->src = src;
         save_read_into(save, &scan->it);
+        (void) world_sector(world, scan->it.coord);
     }
 
     if (!save_read_magic(save, save_magic_shards)) goto fail;
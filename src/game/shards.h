@@ -21,12 +21,16 @@ struct chunk *shard_chunk_alloc(
 world_ts shard_time(const struct shard *);
 const struct mods *shard_mods(struct shard *);
 const struct tech *shard_tech(struct shard *, user_id);
+size_t shard_tech_learned(const struct shard *);
 
 struct metrics_shard *shard_metrics(struct shard *);
 void shard_user_io_push(struct shard *, user_id, struct user_io);
 void shard_log_push(struct shard *, user_id, struct log_line);
 void shard_tech_push(struct shard *, user_id, enum item, uint8_t bit);
 void shard_lanes_push(struct shard *, struct lanes_packet);
+void shard_lanes_arrive(
+        struct shard *, struct chunk *,
+        enum item, struct coord src, const vm_word *, size_t len);
 
 void shard_probe_push(struct shard *, struct coord src, struct coord dst, enum item);
 ssize_t shard_probe_get(const struct shard *, struct coord, enum item);
@@ -49,5 +53,10 @@ void shards_register(struct shards *, struct chunk *);
 
 void shards_step(struct shards *);
 
+// Instruction counts of the watched mods executed in the last step. Watching
+// no mods disables the collection.
+void shards_prof_watch(struct shards *, const mod_id *, size_t len);
+const struct vm_prof *shards_prof(const struct shards *);
+
 void shards_save(struct shards *, struct save *);
 struct shards *shards_load(struct world *, struct save *);
@@ -5,6 +5,10 @@
 
 static struct sim_pipe *sim_pipe_next(struct sim *sim, struct sim_pipe *start);
 static void sim_publish_mod(struct sim_pipe *pipe, const struct mod *mod);
+static void sim_mod_publish(struct sim *sim, struct sim_pipe *pipe, mod_maj maj);
+static void sim_compile_cancel(struct sim *sim, struct sim_pipe *pipe);
+static void sim_compile_flush(struct sim *sim, struct sim_pipe *pipe);
+static void sim_publish_wait(struct sim *sim);
 
 
 // -----------------------------------------------------------------------------
@@ -22,6 +26,20 @@ constexpr uint8_t sim_save_version = 1;
 constexpr bool sim_prof_enabled = false;
 constexpr size_t sim_prof_freq = 100;
 
+// Pipes with the same access set and ack share the encoding of the world
+// sections of the state which is done once per tick for each combination by
+// the first publish worker to claim it. Workers that find it claimed but not
+// yet done encode their own copy instead of waiting.
+struct sim_shared
+{
+    user_set access;
+    world_ts time;
+    uint32_t atoms;
+
+    atomic_bool claimed, done;
+    struct save *save;
+};
+
 struct sim
 {
     threads_id thread;
@@ -41,6 +59,9 @@ struct sim
     atomic_uintptr_t pipes;
 
     struct metrics metrics;
+    struct sim_compile *compile;
+    struct sim_publish *publish;
+    struct { size_t len, cap; struct sim_shared **list; } shared;
 
     char save[PATH_MAX + 1];
     char config[PATH_MAX + 1];
@@ -71,6 +92,14 @@ void sim_free(struct sim *sim)
          pipe; pipe = sim_pipe_next(sim, pipe))
     {}
 
+    for (size_t i = 0; i < sim->shared.cap; ++i) {
+        struct sim_shared *it = sim->shared.list[i];
+        if (!it) continue;
+        save_mem_free(it->save);
+        mem_free(it);
+    }
+    mem_free(sim->shared.list);
+
     world_free(sim->world);
     users_free(&sim->users);
     mem_free(sim);
@@ -136,12 +165,19 @@ struct sim_pipe
 
     struct { sys_ts period, prev, next; } publish;
     struct ack *ack;
+
+    // Prepared by the sim thread for the publish stage which encodes the state
+    // straight into the out ring. A nil shared means nothing is staged.
+    struct { struct state_ctx ctx; struct sim_shared *shared; bool prof; } stage;
+
     struct coord chunk;
     const struct mod *compile;
 
     struct
     {
         enum cmd_steps type;
+        mod_id mod;
+        world_ts time;
         struct save *data;
     } steps;
 
@@ -215,6 +251,7 @@ struct save_ring *sim_pipe_out(struct sim_pipe *pipe)
 // - After calling sim_pipe_close, the poll thread never touches the object
 // - sim_pipe_next is only called from a single thread; the sim thread
 // - There are no nested calls to sim_pipe_next
+// - The publish stage is idle which is guaranteed by sim_publish_wait
 //
 // If these assumptions are met then we can be sure that while traversing the
 // pipe list, sim_pipe_next holds the only reference to the pipe and it's
@@ -236,6 +273,7 @@ static struct sim_pipe *sim_pipe_next(struct sim *sim, struct sim_pipe *start)
                         memory_order_acq_rel,
                         memory_order_relaxed);
         if (ok) {
+            sim_compile_cancel(sim, pipe);
             sim_pipe_free(pipe);
             next = new;
         }
@@ -280,7 +318,7 @@ static void sim_log_pop(struct sim_pipe *pipe)
 
 static void sim_logv_overflow(enum status_type type, const char *fmt, va_list args)
 {
-    static char msg[256] = {0};
+    static thread_local char msg[256] = {0};
     ssize_t len = vsnprintf(msg, sizeof(msg), fmt, args);
     assert(len >= 0);
 
@@ -366,12 +404,324 @@ static struct symbol sim_log_atom(struct sim *sim, vm_word atom)
 }
 
 
+// -----------------------------------------------------------------------------
+// compile
+// -----------------------------------------------------------------------------
+// Mods are compiled by a pool of workers to avoid stalling the tick on large
+// mods. Workers compile against forks of the world's mods and atoms and the
+// result is only committed at the next tick boundary if the world didn't change
+// in the meantime. Otherwise the mod is compiled again on the sim thread which
+// keeps the result identical to compiling it inline. The jobs of a pipe are
+// committed in the order they were submitted. Without a pool, which is the case
+// when the sim isn't forked, mods are compiled inline in sim_cmd.
+
+enum : size_t { sim_compile_cap = 16 };
+
+enum sim_compile_state : unsigned
+{
+    sim_compile_free = 0,
+    sim_compile_queued,
+    sim_compile_running,
+    sim_compile_done,
+};
+
+struct sim_compile_job
+{
+    atomic_uint state;
+
+    // Only accessed from the sim thread. A nil pipe means that the result is
+    // discarded.
+    struct sim_pipe *pipe;
+    uint64_t seq;
+    bool publish;
+
+    mod_maj maj;
+    const char *code;
+    uint32_t len;
+
+    struct mods *mods;
+    struct atoms *atoms;
+
+    struct { sys_ts queued, started, done; } t;
+    struct mod *mod;
+};
+
+struct sim_compile
+{
+    struct threads *threads;
+    size_t workers;
+    threads_id worker[threads_cpu_cap];
+
+    sem_t queued;
+    uint64_t seq;
+    struct sim_compile_job jobs[sim_compile_cap];
+};
+
+static struct mod *sim_compile_mod(
+        mod_maj maj, const char *code, size_t len,
+        struct mods *mods, struct atoms *atoms)
+{
+    struct mod *mod = mod_compile(maj, code, len, mods, atoms);
+    mod->id = make_mod(maj, 0);
+    return mod;
+}
+
+static bool sim_compile_claim(struct sim_compile_job *job)
+{
+    unsigned state = sim_compile_queued;
+    return atomic_compare_exchange_strong_explicit(
+            &job->state, &state, sim_compile_running,
+            memory_order_acquire, memory_order_relaxed);
+}
+
+static void sim_compile_exec(struct sim_compile_job *job)
+{
+    job->t.started = sys_now();
+    job->mod = sim_compile_mod(job->maj, job->code, job->len, job->mods, job->atoms);
+    job->t.done = sys_now();
+    atomic_store_explicit(&job->state, sim_compile_done, memory_order_release);
+}
+
+static void sim_compile_run(struct sim_compile *compile)
+{
+    while (true) {
+        while (sem_wait(&compile->queued) == -1) {
+            if (errno != EINTR) fail_errno("unable to wait on compile queue");
+        }
+
+        if (threads_done(compile->threads, thread_id())) return;
+
+        for (size_t i = 0; i < sim_compile_cap; ++i) {
+            struct sim_compile_job *job = compile->jobs + i;
+            if (!sim_compile_claim(job)) continue;
+            sim_compile_exec(job);
+            break;
+        }
+    }
+}
+
+static void sim_compile_fork(struct sim *sim)
+{
+    struct sim_compile *compile = mem_alloc_t(compile);
+    compile->threads = threads_alloc(threads_pool_compile);
+
+    compile->workers = threads_cpus(compile->threads);
+    if (!compile->workers) {
+        threads_free(compile->threads);
+        mem_free(compile);
+        return;
+    }
+
+    if (sem_init(&compile->queued, 0, 0) == -1)
+        fail_errno("unable to create compile queue");
+
+    void run(void *ctx) { sim_compile_run(ctx); }
+    for (size_t i = 0; i < compile->workers; ++i)
+        compile->worker[i] = threads_fork(compile->threads, run, compile);
+
+    sim->compile = compile;
+}
+
+static void sim_compile_join(struct sim *sim)
+{
+    struct sim_compile *compile = sim->compile;
+    if (!compile) return;
+
+    sim_compile_flush(sim, nullptr);
+
+    for (size_t i = 0; i < compile->workers; ++i) {
+        threads_exit(compile->threads, compile->worker[i]);
+        sem_post(&compile->queued);
+    }
+    threads_free(compile->threads);
+
+    sem_destroy(&compile->queued);
+    mem_free(compile);
+    sim->compile = nullptr;
+}
+
+static void sim_compile_finish(
+        struct sim *sim, struct sim_pipe *pipe, struct mod *mod, bool publish)
+{
+    if (pipe->compile) mod_free(pipe->compile);
+    pipe->compile = mod;
+    sim_publish_mod(pipe, mod);
+
+    if (mod->errs_len)
+        sim_log(pipe, st_warn, "%u compilation errors", mod->errs_len);
+    else sim_log(pipe, st_info, "Compilation finished");
+
+    if (publish) sim_mod_publish(sim, pipe, mod_major(mod->id));
+}
+
+// Returns the oldest job of the pipe or of all pipes if nil.
+static struct sim_compile_job *sim_compile_oldest(
+        struct sim_compile *compile, struct sim_pipe *pipe)
+{
+    struct sim_compile_job *oldest = nullptr;
+
+    for (size_t i = 0; i < sim_compile_cap; ++i) {
+        struct sim_compile_job *job = compile->jobs + i;
+
+        unsigned state = atomic_load_explicit(&job->state, memory_order_acquire);
+        if (state == sim_compile_free) continue;
+        if (pipe && job->pipe != pipe) continue;
+
+        if (!oldest || job->seq < oldest->seq) oldest = job;
+    }
+
+    return oldest;
+}
+
+static bool sim_compile_submit(
+        struct sim *sim, struct sim_pipe *pipe,
+        mod_maj maj, const char *code, uint32_t len)
+{
+    struct sim_compile *compile = sim->compile;
+    if (!compile) return false;
+
+    struct sim_compile_job *job = nullptr;
+    for (size_t i = 0; !job && i < sim_compile_cap; ++i) {
+        unsigned state = atomic_load_explicit(
+                &compile->jobs[i].state, memory_order_acquire);
+        if (state == sim_compile_free) job = compile->jobs + i;
+    }
+
+    // The queue is full so we fall back to compiling inline which requires the
+    // jobs of the pipe to be committed first to preserve the order.
+    if (!job) {
+        sim_compile_flush(sim, pipe);
+        return false;
+    }
+
+    job->pipe = pipe;
+    job->seq = compile->seq++;
+    job->publish = false;
+    job->maj = maj;
+    job->code = code;
+    job->len = len;
+    job->mods = mods_fork(world_mods(sim->world));
+    job->atoms = atoms_fork(world_atoms(sim->world));
+    job->t.queued = sys_now();
+    job->mod = nullptr;
+
+    atomic_store_explicit(&job->state, sim_compile_queued, memory_order_release);
+    if (sem_post(&compile->queued) == -1) fail_errno("unable to post compile job");
+
+    return true;
+}
+
+static void sim_compile_commit(struct sim *sim, struct sim_compile_job *job)
+{
+    struct mods *mods = world_mods(sim->world);
+    struct atoms *atoms = world_atoms(sim->world);
+
+    struct mod *mod = job->mod;
+    if (job->pipe && !(mods_fork_current(mods, job->mods) && atoms_join(atoms, job->atoms))) {
+        mod_free(mod);
+        mod = sim_compile_mod(job->maj, job->code, job->len, mods, atoms);
+    }
+
+    sim->metrics.sim.queue.n++;
+    sim->metrics.sim.queue.t += job->t.started - job->t.queued;
+    sim->metrics.sim.compile.n++;
+    sim->metrics.sim.compile.t += job->t.done - job->t.started;
+
+    if (job->pipe) sim_compile_finish(sim, job->pipe, mod, job->publish);
+    else mod_free(mod);
+
+    mem_free((char *) job->code);
+    mods_free(job->mods);
+    atoms_free(job->atoms);
+    *job = (struct sim_compile_job) {0};
+    atomic_store_explicit(&job->state, sim_compile_free, memory_order_release);
+}
+
+// Called at the tick boundary to commit any compilation that completed and
+// that isn't waiting on an older job of its pipe. Never blocks.
+static void sim_compile_step(struct sim *sim)
+{
+    struct sim_compile *compile = sim->compile;
+    if (!compile) return;
+
+    bool again = true;
+    while (again) {
+        again = false;
+
+        for (size_t i = 0; i < sim_compile_cap; ++i) {
+            struct sim_compile_job *job = compile->jobs + i;
+
+            unsigned state = atomic_load_explicit(&job->state, memory_order_acquire);
+            if (state != sim_compile_done) continue;
+            if (job->pipe && sim_compile_oldest(compile, job->pipe) != job) continue;
+
+            sim_compile_commit(sim, job);
+            again = true;
+        }
+    }
+}
+
+// Waits on and commits the compilations of a pipe or of all pipes if nil. Jobs
+// that haven't been picked up yet are executed on the current thread.
+static void sim_compile_flush(struct sim *sim, struct sim_pipe *pipe)
+{
+    struct sim_compile *compile = sim->compile;
+    if (!compile) return;
+
+    struct sim_compile_job *job = nullptr;
+    while ((job = sim_compile_oldest(compile, pipe))) {
+        if (sim_compile_claim(job)) sim_compile_exec(job);
+
+        while (atomic_load_explicit(&job->state, memory_order_acquire) != sim_compile_done)
+            sys_sleep_until(sys_now() + 10 * sys_usec);
+
+        sim_compile_commit(sim, job);
+    }
+}
+
+static void sim_compile_cancel(struct sim *sim, struct sim_pipe *pipe)
+{
+    struct sim_compile *compile = sim->compile;
+    if (!compile) return;
+
+    for (size_t i = 0; i < sim_compile_cap; ++i)
+        if (compile->jobs[i].pipe == pipe) compile->jobs[i].pipe = nullptr;
+}
+
+// Publishing while compilations of the pipe are in flight is deferred until the
+// last one is committed as it's the one the publish refers to.
+static bool sim_compile_defer_publish(struct sim *sim, struct sim_pipe *pipe, mod_maj maj)
+{
+    struct sim_compile *compile = sim->compile;
+    if (!compile) return false;
+
+    struct sim_compile_job *last = nullptr;
+    for (size_t i = 0; i < sim_compile_cap; ++i) {
+        struct sim_compile_job *job = compile->jobs + i;
+        if (job->pipe != pipe) continue;
+        if (!last || job->seq > last->seq) last = job;
+    }
+    if (!last) return false;
+
+    if (last->maj != maj) {
+        sim_log(pipe, st_error, "unable to publish compiled mod: %x != %x",
+                last->maj, maj);
+        return true;
+    }
+
+    last->publish = true;
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // cmd
 // -----------------------------------------------------------------------------
 
 void sim_save(struct sim *sim)
 {
+    sim_publish_wait(sim);
+
     struct save *save = save_file_create(sim->save, sim_save_version);
 
     save_write_magic(save, save_magic_sim);
@@ -387,12 +737,14 @@ void sim_save(struct sim *sim)
     infof("saved %zu bytes", bytes);
 }
 
-void sim_load(struct sim *sim)
+bool sim_load(struct sim *sim)
 {
+    sim_publish_wait(sim);
+
     struct save *save = save_file_load(sim->save);
     if (!save) {
         sim_log_all(sim, st_error, "unable to open '%s'", sim->save);
-        return;
+        return false;
     }
 
     bool fail = false;
@@ -406,6 +758,7 @@ void sim_load(struct sim *sim)
     size_t bytes = save_len(save);
     if (!world) { fail = true; goto fail; }
 
+    sim_compile_flush(sim, nullptr);
     world = legion_xchg(&sim->world, world);
     world_free(world);
 
@@ -417,6 +770,7 @@ void sim_load(struct sim *sim)
     else sim_log_all(sim, st_info, "loaded %zu bytes", bytes);
 
     save_file_close(save);
+    return !fail;
 }
 
 static void sim_cmd_user_response(struct sim_pipe *pipe)
@@ -583,34 +937,27 @@ static void sim_cmd_mod_register(
 static void sim_cmd_mod_compile(
         struct sim *sim, struct sim_pipe *pipe, const struct cmd *cmd)
 {
-    if (pipe->compile) mod_free(pipe->compile);
+    mod_maj maj = cmd->data.mod_compile.maj;
+    const char *code = cmd->data.mod_compile.code;
+    uint32_t len = cmd->data.mod_compile.len;
 
-    struct mod *compile = mod_compile(
-            cmd->data.mod_compile.maj,
-            cmd->data.mod_compile.code,
-            cmd->data.mod_compile.len,
-            world_mods(sim->world),
-            world_atoms(sim->world));
-    compile->id = make_mod(cmd->data.mod_compile.maj, 0);
-    mem_free((char *) cmd->data.mod_compile.code);
+    if (sim_compile_submit(sim, pipe, maj, code, len)) return;
 
-    pipe->compile = compile;
-    sim_publish_mod(pipe, pipe->compile);
+    struct mod *mod = sim_compile_mod(
+            maj, code, len, world_mods(sim->world), world_atoms(sim->world));
+    mem_free((char *) code);
 
-    if (pipe->compile->errs_len)
-        return sim_log(pipe, st_warn, "%u compilation errors", compile->errs_len);
-    sim_log(pipe, st_info, "Compilation finished");
+    sim_compile_finish(sim, pipe, mod, false);
 }
 
-static void sim_cmd_publish(
-        struct sim *sim, struct sim_pipe *pipe, const struct cmd *cmd)
+static void sim_mod_publish(struct sim *sim, struct sim_pipe *pipe, mod_maj maj)
 {
     struct mods *mods = world_mods(sim->world);
     const struct mod *mod = pipe->compile;
 
-    if (!mod || mod_major(mod->id) != cmd->data.mod_publish.maj) {
+    if (!mod || mod_major(mod->id) != maj) {
         return sim_log(pipe, st_error, "unable to publish compiled mod: %x != %x",
-                mod ? mod_major(mod->id) : 0, cmd->data.mod_publish.maj);
+                mod ? mod_major(mod->id) : 0, maj);
     }
 
     if (mod->errs_len) {
@@ -633,6 +980,14 @@ static void sim_cmd_publish(
             mod_version(mod_id));
 }
 
+static void sim_cmd_publish(
+        struct sim *sim, struct sim_pipe *pipe, const struct cmd *cmd)
+{
+    mod_maj maj = cmd->data.mod_publish.maj;
+    if (sim_compile_defer_publish(sim, pipe, maj)) return;
+    sim_mod_publish(sim, pipe, maj);
+}
+
 static void sim_cmd(struct sim *sim, struct sim_pipe *pipe)
 {
     while (true) {
@@ -701,9 +1056,11 @@ static void sim_cmd(struct sim *sim, struct sim_pipe *pipe)
         }
 
         case CMD_STEPS: {
-            if (pipe->steps.type != cmd.data.steps)
+            if (pipe->steps.type != cmd.data.steps.type ||
+                    pipe->steps.mod != cmd.data.steps.mod)
                 save_mem_reset(pipe->steps.data);
-            pipe->steps.type = cmd.data.steps;
+            pipe->steps.type = cmd.data.steps.type;
+            pipe->steps.mod = cmd.data.steps.mod;
             break;
         }
 
@@ -727,9 +1084,23 @@ static void sim_cmd(struct sim *sim, struct sim_pipe *pipe)
 // publish
 // -----------------------------------------------------------------------------
 
+// The counts are only updated when the world is stepped so we skip the ticks
+// where the world is paused.
+static void sim_publish_step_prof(struct sim *sim, struct sim_pipe *pipe)
+{
+    const struct vm_prof *prof = world_prof(sim->world);
+    if (!prof || pipe->steps.time == world_time(sim->world)) return;
+    pipe->steps.time = world_time(sim->world);
+
+    struct save *save = pipe->steps.data;
+    save_write_value(save, world_time(sim->world));
+    vm_prof_save(prof, pipe->steps.mod, save);
+}
+
 static void sim_publish_step(struct sim *sim, struct sim_pipe *pipe)
 {
     if (likely(!pipe->steps.type)) return;
+    if (pipe->steps.type == cmd_steps_prof) return sim_publish_step_prof(sim, pipe);
     if (coord_is_nil(pipe->chunk)) return;
 
     struct chunk *chunk = world_chunk(sim->world, pipe->chunk);
@@ -745,7 +1116,59 @@ static void sim_publish_step(struct sim *sim, struct sim_pipe *pipe)
     }
 }
 
-static void sim_publish_state(struct sim *sim, struct sim_pipe *pipe)
+static struct sim_shared *sim_publish_shared(
+        struct sim *sim, const struct state_ctx *ctx)
+{
+    for (size_t i = 0; i < sim->shared.len; ++i) {
+        struct sim_shared *it = sim->shared.list[i];
+        if (it->access == ctx->access &&
+                it->time == ctx->ack->time &&
+                it->atoms == ctx->ack->atoms)
+            return it;
+    }
+
+    if (sim->shared.len == sim->shared.cap) {
+        size_t old = sim->shared.cap;
+        sim->shared.cap = old ? old * 2 : 4;
+        sim->shared.list = mem_array_realloc_t(
+                sim->shared.list, old, sim->shared.cap);
+    }
+
+    struct sim_shared **slot = sim->shared.list + sim->shared.len++;
+    if (!*slot) {
+        *slot = mem_alloc_t(*slot);
+        (*slot)->save = save_mem_new();
+    }
+
+    struct sim_shared *it = *slot;
+    it->access = ctx->access;
+    it->time = ctx->ack->time;
+    it->atoms = ctx->ack->atoms;
+    atomic_store_explicit(&it->claimed, false, memory_order_relaxed);
+    atomic_store_explicit(&it->done, false, memory_order_relaxed);
+
+    return it;
+}
+
+// Called from the publish stage.
+static void sim_publish_shared_save(
+        struct sim_shared *shared, struct save *save, const struct state_ctx *ctx)
+{
+    if (!atomic_load_explicit(&shared->done, memory_order_acquire)) {
+        if (atomic_exchange_explicit(&shared->claimed, true, memory_order_relaxed))
+            return state_save_shared(save, ctx);
+
+        save_mem_reset(shared->save);
+        state_save_shared(shared->save, ctx);
+        atomic_store_explicit(&shared->done, true, memory_order_release);
+    }
+
+    save_write(save, save_bytes(shared->save), save_len(shared->save));
+}
+
+// Applies every modification to the world that publishing the state implies
+// such that the publish stage only needs to read the world.
+static void sim_publish_stage(struct sim *sim, struct sim_pipe *pipe)
 {
     {
         sys_ts now = sys_now();
@@ -755,6 +1178,35 @@ static void sim_publish_state(struct sim *sim, struct sim_pipe *pipe)
         pipe->publish.next = now + pipe->publish.period;
     }
 
+    pipe->stage.prof = false;
+    if (unlikely(sim_prof_enabled && engine_initialized()))
+        pipe->stage.prof = !(world_time(sim->world) % sim_prof_freq);
+
+    if (sim->stream != pipe->ack->stream) ack_reset(pipe->ack);
+
+    struct user *user = &pipe->auth.user;
+    pipe->stage.ctx = (struct state_ctx) {
+        .stream = sim->stream,
+        .access = user->access,
+        .user = user->id,
+        .world = sim->world,
+        .speed = sim->speed,
+        .chunk = pipe->chunk,
+        .steps = { .type = pipe->steps.type, .data = pipe->steps.data },
+        .ack = pipe->ack,
+    };
+
+    state_prepare(&pipe->stage.ctx);
+    pipe->stage.shared = sim_publish_shared(sim, &pipe->stage.ctx);
+}
+
+// Called from the publish stage and must therefore only read the world.
+static void sim_publish_state(struct sim_pipe *pipe)
+{
+    struct sim_shared *shared = pipe->stage.shared;
+    if (!shared) return;
+    pipe->stage.shared = nullptr;
+
     struct save *save = save_ring_write(pipe->out);
 
     struct header *head = save_bytes(save);
@@ -763,24 +1215,12 @@ static void sim_publish_state(struct sim *sim, struct sim_pipe *pipe)
         return;
     }
 
-    if (unlikely(sim_prof_enabled && engine_initialized())) {
-        if (!(world_time(sim->world) % sim_prof_freq))
-            save_prof(save);
-    }
+    if (unlikely(pipe->stage.prof)) save_prof(save);
 
-    if (sim->stream != pipe->ack->stream) ack_reset(pipe->ack);
-
-    struct user *user = &pipe->auth.user;
-    state_save(save, &(struct state_ctx) {
-                .stream = sim->stream,
-                .access = user->access,
-                .user = user->id,
-                .world = sim->world,
-                .speed = sim->speed,
-                .chunk = pipe->chunk,
-                .steps = { .type = pipe->steps.type, .data = pipe->steps.data },
-                .ack = pipe->ack,
-            });
+    const struct state_ctx *ctx = &pipe->stage.ctx;
+    state_save_head(save, ctx);
+    sim_publish_shared_save(shared, save, ctx);
+    state_save_tail(save, ctx);
 
     // If this triggers, increase the ring size or detect eof in chunk and
     // do some magical form of gradual state transmit. Short version, life
@@ -845,35 +1285,242 @@ static void sim_publish_mod(struct sim_pipe *pipe, const struct mod *mod)
 }
 
 
+// -----------------------------------------------------------------------------
+// publish stage
+// -----------------------------------------------------------------------------
+// Encoding the staged states into the rings is handed off to a pool which reads
+// the world concurrently so the world is frozen until the stage is done. The
+// sim thread must call sim_publish_wait before modifying the world, writing to
+// a ring or walking the pipe list which can free pipes. Without a pool, which
+// is the case when the sim isn't forked, the states are encoded inline in
+// sim_step.
+//
+// No snapshot of the world is taken as copying the world every tick would cost
+// more than the encoding it would let us overlap with world_step. The stage
+// instead overlaps with the wait until the next tick and the sim thread joins
+// in on the encoding in sim_publish_wait when there's no time left to wait.
+
+struct sim_publish
+{
+    struct threads *threads;
+    size_t workers;
+    threads_id worker[threads_cpu_cap];
+
+    sem_t start, done;
+    atomic_size_t it, pending;
+    struct { atomic_uint_fast64_t n, t; } fanout;
+
+    // Only accessed from the sim thread while the stage is idle.
+    bool busy;
+    size_t len, cap;
+    struct sim_pipe **pipes;
+};
+
+static void sim_publish_pipe(struct sim_pipe *pipe)
+{
+    sim_publish_state(pipe);
+    sim_publish_log(pipe);
+    save_ring_wake_signal(pipe->out);
+}
+
+// Publishes the pipes of the stage that are left to claim.
+static void sim_publish_drain(struct sim_publish *publish)
+{
+    sys_ts t0 = metric_now();
+    size_t n = 0;
+
+    while (true) {
+        size_t i = atomic_fetch_add_explicit(&publish->it, 1, memory_order_relaxed);
+        if (i >= publish->len) break;
+        sim_publish_pipe(publish->pipes[i]);
+        n++;
+    }
+
+    if (!n) return;
+    atomic_fetch_add_explicit(&publish->fanout.n, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&publish->fanout.t, metric_now() - t0, memory_order_relaxed);
+}
+
+static void sim_publish_run(struct sim_publish *publish)
+{
+    while (true) {
+        while (sem_wait(&publish->start) == -1) {
+            if (errno != EINTR) fail_errno("unable to wait on publish start");
+        }
+
+        if (threads_done(publish->threads, thread_id())) return;
+
+        sim_publish_drain(publish);
+
+        if (atomic_fetch_sub_explicit(&publish->pending, 1, memory_order_acq_rel) == 1)
+            sem_post(&publish->done);
+    }
+}
+
+static void sim_publish_fork(struct sim *sim)
+{
+    struct sim_publish *publish = mem_alloc_t(publish);
+    publish->threads = threads_alloc(threads_pool_publish);
+
+    publish->workers = threads_cpus(publish->threads);
+    if (!publish->workers) {
+        threads_free(publish->threads);
+        mem_free(publish);
+        return;
+    }
+
+    if (sem_init(&publish->start, 0, 0) == -1)
+        fail_errno("unable to create publish start");
+    if (sem_init(&publish->done, 0, 0) == -1)
+        fail_errno("unable to create publish done");
+
+    void run(void *ctx) { sim_publish_run(ctx); }
+    for (size_t i = 0; i < publish->workers; ++i)
+        publish->worker[i] = threads_fork(publish->threads, run, publish);
+
+    sim->publish = publish;
+}
+
+static void sim_publish_join(struct sim *sim)
+{
+    struct sim_publish *publish = sim->publish;
+    if (!publish) return;
+
+    sim_publish_wait(sim);
+
+    for (size_t i = 0; i < publish->workers; ++i) {
+        threads_exit(publish->threads, publish->worker[i]);
+        sem_post(&publish->start);
+    }
+    threads_free(publish->threads);
+
+    sem_destroy(&publish->start);
+    sem_destroy(&publish->done);
+    mem_free(publish->pipes);
+    mem_free(publish);
+    sim->publish = nullptr;
+}
+
+static void sim_publish_queue(struct sim *sim, struct sim_pipe *pipe)
+{
+    struct sim_publish *publish = sim->publish;
+    if (!publish) {
+        sys_ts mt = metric_now();
+        sim_publish_pipe(pipe);
+        metric_inc(&sim->metrics, sim.fanout, 1, mt);
+        return;
+    }
+
+    if (publish->len == publish->cap) {
+        size_t old = publish->cap;
+        publish->cap = old ? old * 2 : 16;
+        publish->pipes = mem_array_realloc_t(publish->pipes, old, publish->cap);
+    }
+    publish->pipes[publish->len++] = pipe;
+}
+
+static void sim_publish_start(struct sim *sim)
+{
+    struct sim_publish *publish = sim->publish;
+    if (!publish || !publish->len) return;
+
+    atomic_store_explicit(&publish->it, 0, memory_order_relaxed);
+    atomic_store_explicit(&publish->pending, publish->workers, memory_order_relaxed);
+    publish->busy = true;
+
+    for (size_t i = 0; i < publish->workers; ++i)
+        sem_post(&publish->start);
+}
+
+static void sim_publish_wait(struct sim *sim)
+{
+    struct sim_publish *publish = sim->publish;
+    if (!publish || !publish->busy) return;
+
+    sys_ts mt = metric_now();
+    sim_publish_drain(publish);
+    while (sem_wait(&publish->done) == -1) {
+        if (errno != EINTR) fail_errno("unable to wait on publish done");
+    }
+    metric_inc(&sim->metrics, sim.stall, 1, mt);
+
+    sim->metrics.sim.fanout.n += atomic_exchange_explicit(
+            &publish->fanout.n, 0, memory_order_relaxed);
+    sim->metrics.sim.fanout.t += atomic_exchange_explicit(
+            &publish->fanout.t, 0, memory_order_relaxed);
+
+    publish->busy = false;
+    publish->len = 0;
+}
+
+
 // -----------------------------------------------------------------------------
 // step
 // -----------------------------------------------------------------------------
 
+// Profiling slows down the vms so it's only enabled for the mods that a client
+// is watching the counts of.
+static void sim_step_prof(struct sim *sim)
+{
+    size_t len = 0;
+    for (struct sim_pipe *pipe = sim_pipe_next(sim, NULL);
+         pipe; pipe = sim_pipe_next(sim, pipe))
+        len += pipe->auth.ok && pipe->steps.type == cmd_steps_prof;
+
+    mod_id mods[legion_max(len, 1UL)];
+
+    len = 0;
+    for (struct sim_pipe *pipe = sim_pipe_next(sim, NULL);
+         pipe; pipe = sim_pipe_next(sim, pipe))
+    {
+        if (!pipe->auth.ok || pipe->steps.type != cmd_steps_prof) continue;
+        mods[len++] = pipe->steps.mod;
+    }
+
+    world_prof_watch(sim->world, mods, len);
+}
+
 void sim_step(struct sim *sim)
 {
+    // The publish stage of the previous tick overlaps with the wait until the
+    // next tick and reads the world so it must be done before we step.
+    sim_publish_wait(sim);
+
     if (sim->speed != speed_pause)
         world_step(sim->world);
 
+    sim_compile_step(sim);
+
+    // Commands are all applied before publishing so that every pipe observes
+    // the same world which is required to share the encoding of the state.
     for (struct sim_pipe *pipe = sim_pipe_next(sim, NULL);
          pipe; pipe = sim_pipe_next(sim, pipe))
     {
         sys_ts mt = metric_now();
-
         sim_cmd(sim, pipe);
-        mt = metric_inc(&sim->metrics, sim.cmd, 1, mt);
+        metric_inc(&sim->metrics, sim.cmd, 1, mt);
+    }
+
+    sim->shared.len = 0;
+    for (struct sim_pipe *pipe = sim_pipe_next(sim, NULL);
+         pipe; pipe = sim_pipe_next(sim, pipe))
+    {
+        sys_ts mt = metric_now();
 
         if (pipe->auth.ok) {
             sim_publish_step(sim, pipe);
-            sim_publish_state(sim, pipe);
+            sim_publish_stage(sim, pipe);
         }
-        sim_publish_log(pipe);
         metric_inc(&sim->metrics, sim.publish, 1, mt);
 
-        save_ring_wake_signal(pipe->out);
+        sim_publish_queue(sim, pipe);
     }
 
+    sim_step_prof(sim);
+    sim_publish_start(sim);
+
     sim->metrics.ts.now = world_time(sim->world);
-    metrics_dump(&sim->metrics);
+    metrics_dump(&sim->metrics, world_mods(sim->world));
 }
 
 void sim_loop(struct sim *sim)
@@ -918,9 +1565,89 @@ void sim_loop(struct sim *sim)
     }
 }
 
+// Replaces the world with a synthetic one and saves it to be used as a fixture
+// by sim_bench.
+void sim_synth(struct sim *sim, const struct synth_config *config)
+{
+    struct world *world = world_new(config->seed, &sim->metrics);
+    synth_populate(world, config);
+
+    sim_publish_wait(sim);
+    sim_compile_flush(sim, nullptr);
+    world = legion_xchg(&sim->world, world);
+    world_free(world);
+
+    sim_save(sim);
+}
+
+// Encodes and decodes the state of the admin after every step as a client
+// that acks every frame would see it. Tracks the size of the frames on the
+// wire and isn't accounted in the elapsed time.
+static void sim_bench_frame(
+        struct sim *sim, struct sim_bench *ret,
+        struct save *save, struct state *state, struct ack *ack)
+{
+    sim_publish_wait(sim);
+
+    struct state_ctx ctx = {
+        .stream = sim->stream,
+        .access = user_set_all(),
+        .user = user_admin,
+        .world = sim->world,
+        .speed = sim->speed,
+        .chunk = world_home(sim->world, user_admin),
+        .ack = ack,
+    };
+
+    save_mem_reset(save);
+    state_save(save, &ctx);
+    size_t len = save_len(save);
+
+    save_mem_reset(save);
+    bool ok = state_load(state, save, ack);
+    assert(ok);
+
+    if (!ret->frame.first) ret->frame.first = len;
+    else ret->frame.bytes += len;
+}
+
+// Steps the world as fast as possible without any pipes attached which gives a
+// measure of the raw throughput of the simulation.
+struct sim_bench sim_bench(struct sim *sim, world_ts ticks)
+{
+    sim->speed = speed_fastest;
+
+    struct sim_bench ret = {
+        .ticks = ticks,
+        .chunks = world_chunk_count(sim->world),
+    };
+
+    struct save *save = save_mem_new();
+    struct state *state = state_alloc();
+    struct ack *ack = ack_new();
+
+    for (world_ts i = 0; i < ticks; ++i) {
+        sys_ts t0 = sys_now();
+        sim_step(sim);
+        ret.elapsed += sys_now() - t0;
+
+        sim_bench_frame(sim, &ret, save, state, ack);
+    }
+
+    ack_free(ack);
+    state_free(state);
+    save_mem_free(save);
+
+    sim_publish_wait(sim);
+    metrics_flush(&sim->metrics, world_mods(sim->world));
+    return ret;
+}
+
 void sim_fork(struct sim *sim)
 {
     void sim_run(void *ctx)  { sim_loop(ctx); }
+    sim_compile_fork(sim);
+    sim_publish_fork(sim);
     sim->threads = threads_alloc(threads_pool_sim);
     sim->thread = threads_fork(sim->threads, sim_run, sim);
 }
@@ -929,4 +1656,6 @@ void sim_join(struct sim *sim)
 {
     threads_join(sim->threads, sim->thread);
     threads_free(sim->threads);
+    sim_publish_join(sim);
+    sim_compile_join(sim);
 }
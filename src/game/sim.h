@@ -33,10 +33,24 @@ struct save_ring *sim_pipe_in(struct sim_pipe *);
 struct save_ring *sim_pipe_out(struct sim_pipe *);
 
 void sim_save(struct sim *);
-void sim_load(struct sim *);
+bool sim_load(struct sim *);
 
 void sim_step(struct sim *);
 void sim_loop(struct sim *);
 
+void sim_synth(struct sim *, const struct synth_config *);
+
+struct sim_bench
+{
+    world_ts ticks;
+    sys_ts elapsed;
+    size_t chunks;
+
+    // State frames of the admin for a client that acks every frame.
+    struct { size_t first, bytes; } frame;
+};
+
+struct sim_bench sim_bench(struct sim *, world_ts ticks);
+
 void sim_fork(struct sim *);
 void sim_join(struct sim *);
@@ -0,0 +1,254 @@
+/* synth.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+
+// -----------------------------------------------------------------------------
+// config
+// -----------------------------------------------------------------------------
+
+constexpr size_t synth_items_max = 32;
+
+bool synth_config_read(struct synth_config *config, const char *path)
+{
+    struct config file = {0};
+    struct reader *in = config_read(&file, path);
+
+    reader_open(in);
+    reader_symbol_str(in, "synth");
+    config->seed = reader_field(in, "seed", u64);
+    config->users = reader_field(in, "users", u64);
+    config->chunks = reader_field(in, "chunks", u64);
+    config->brains = reader_field(in, "brains", u64);
+    config->mod = reader_field(in, "mod", symbol);
+    config->printers = reader_field(in, "printers", u64);
+    config->ports = reader_field(in, "ports", u64);
+    config->transmits = reader_field(in, "transmits", u64);
+    config->lanes = reader_field(in, "lanes", u64);
+    reader_close(in);
+
+    config_close(&file);
+
+    if (!config->users || config->users > user_max) {
+        errf("invalid synth users '%zu' in '%s'", config->users, path);
+        return false;
+    }
+
+    if (!config->chunks) {
+        errf("invalid synth chunks '%zu' in '%s'", config->chunks, path);
+        return false;
+    }
+
+    const size_t items[] = {
+        config->brains, config->printers, config->ports, config->transmits };
+    for (size_t i = 0; i < array_len(items); ++i) {
+        if (items[i] <= synth_items_max) continue;
+        errf("synth item count '%zu' is above '%zu' in '%s'",
+                items[i], synth_items_max, path);
+        return false;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// populate
+// -----------------------------------------------------------------------------
+
+struct synth
+{
+    struct world *world;
+    const struct synth_config *config;
+    struct rng rng;
+
+    mod_id mod;
+
+    // coords of the chunks of each user in creation order where the first
+    // chunk of every user is its home.
+    size_t len;
+    struct coord *coords;
+};
+
+static struct coord synth_coord(struct synth *synth, user_id user, size_t index)
+{
+    assert(index < synth->config->chunks);
+    return synth->coords[user * synth->config->chunks + index];
+}
+
+// Picks random sectors until we find one with a suitable home star and then
+// fills up the remaining chunks with the stars of that sector followed by the
+// stars of other random sectors.
+static void synth_user(struct synth *synth, user_id user)
+{
+    struct world *world = synth->world;
+    const struct sector *sector = nullptr;
+
+    while (true) {
+        sector = world_sector(world, coord_from_u64(rng_step(&synth->rng)));
+        if (sector->stars_len < 100) continue;
+
+        struct coord home = world_populate_home(sector);
+        if (coord_is_nil(home) || world_chunk(world, home)) continue;
+
+        world_populate_user_at(world, user, home);
+        synth->coords[synth->len++] = home;
+        break;
+    }
+
+    size_t chunks = 1;
+    while (chunks < synth->config->chunks) {
+        for (size_t i = 0; i < sector->stars_len; ++i) {
+            struct coord coord = sector->stars[i].coord;
+            if (world_chunk(world, coord)) continue;
+
+            struct chunk *chunk = world_chunk_alloc(world, coord, user);
+            assert(chunk);
+
+            for (size_t j = 0; j < 2; ++j) chunk_create(chunk, item_worker);
+            for (size_t j = 0; j < 100; ++j) chunk_create(chunk, item_solar);
+
+            for (size_t j = 0; j < synth->config->brains; ++j)
+                chunk_create(chunk, item_brain);
+
+            // Required by the bundled launch mod which is our default.
+            if (synth->config->brains) {
+                chunk_create(chunk, item_scanner);
+                for (size_t j = 0; j < 3; ++j) chunk_create(chunk, item_prober);
+            }
+
+            for (size_t j = 0; j < synth->config->printers; ++j) {
+                chunk_create(chunk, item_printer);
+                chunk_create(chunk, item_extract);
+                chunk_create(chunk, item_extract);
+            }
+
+            for (size_t j = 0; j < synth->config->ports; ++j)
+                chunk_create(chunk, item_port);
+
+            for (size_t j = 0; j < synth->config->transmits; ++j) {
+                chunk_create(chunk, item_transmit);
+                chunk_create(chunk, item_receive);
+            }
+
+            synth->coords[synth->len++] = coord;
+            if (++chunks == synth->config->chunks) break;
+        }
+
+        sector = world_sector(world, coord_from_u64(rng_step(&synth->rng)));
+    }
+}
+
+static void synth_io(
+        struct chunk *chunk, enum io io, enum item item, size_t count,
+        const vm_word *args, size_t len)
+{
+    for (size_t i = 1; i <= count; ++i)
+        chunk_io(chunk, io, 0, make_im_id(item, i), args, len);
+}
+
+// Items are only instantiated on the first step so they have to be configured
+// in a second pass.
+static void synth_configure(struct synth *synth, user_id user)
+{
+    const struct synth_config *config = synth->config;
+    struct coord home = synth_coord(synth, user, 0);
+
+    // Transmitters form a ring over the non-home chunks.
+    const size_t ring = config->chunks - 1;
+
+    for (size_t i = 1; i < config->chunks; ++i) {
+        struct coord coord = synth_coord(synth, user, i);
+        struct coord next = synth_coord(synth, user, 1 + (i % ring));
+        struct coord prev = synth_coord(synth, user, 1 + ((i + ring - 2) % ring));
+
+        struct chunk *chunk = world_chunk(synth->world, coord);
+        assert(chunk);
+
+        vm_word mod = synth->mod;
+        synth_io(chunk, io_mod, item_brain, config->brains, &mod, 1);
+
+        for (size_t j = 1; j <= config->printers; ++j) {
+            vm_word printer = item_monobarex;
+            chunk_io(chunk, io_tape, 0, make_im_id(item_printer, j), &printer, 1);
+
+            vm_word elem_a = item_elem_a;
+            chunk_io(chunk, io_tape, 0, make_im_id(item_extract, j * 2 - 1), &elem_a, 1);
+
+            vm_word elem_b = item_elem_b;
+            chunk_io(chunk, io_tape, 0, make_im_id(item_extract, j * 2), &elem_b, 1);
+        }
+
+        vm_word port_item[] = { item_elem_a, 1 };
+        vm_word port_target = coord_to_u64(home);
+        synth_io(chunk, io_item, item_port, config->ports, port_item, array_len(port_item));
+        synth_io(chunk, io_target, item_port, config->ports, &port_target, 1);
+        synth_io(chunk, io_activate, item_port, config->ports, NULL, 0);
+
+        vm_word tx_target = coord_to_u64(next);
+        vm_word rx_target = coord_to_u64(prev);
+        synth_io(chunk, io_target, item_transmit, config->transmits, &tx_target, 1);
+        synth_io(chunk, io_target, item_receive, config->transmits, &rx_target, 1);
+    }
+}
+
+// Packets are sent to random chunks across all users to spread the arrivals
+// over a long period of time.
+static void synth_lanes(struct synth *synth, user_id user)
+{
+    const struct synth_config *config = synth->config;
+    struct lanes *lanes = world_lanes(synth->world);
+
+    for (size_t i = 1; i < config->chunks; ++i) {
+        struct coord src = synth_coord(synth, user, i);
+
+        for (size_t j = 0; j < config->lanes; ++j) {
+            struct coord dst = synth->coords[rng_uni(&synth->rng, 0, synth->len)];
+            if (!lanes_travel(im_transmit_launch_speed, src, dst)) continue;
+
+            const vm_word data[] = { im_packet_pack(0, 1), (vm_word) j };
+            lanes_launch(lanes, (struct lanes_packet) {
+                        .owner = user,
+                        .item = item_data,
+                        .speed = im_transmit_launch_speed,
+                        .src = src,
+                        .dst = dst,
+                        .len = array_len(data),
+                        .data = data,
+                    });
+        }
+    }
+}
+
+void synth_populate(struct world *world, const struct synth_config *config)
+{
+    world_populate_mods(world);
+
+    struct synth synth = {
+        .world = world,
+        .config = config,
+        .rng = rng_make(config->seed),
+        .coords = mem_array_alloc_t(struct coord, config->users * config->chunks),
+    };
+
+    if (config->brains) {
+        mod_maj maj = mods_find(world_mods(world), &config->mod);
+        if (!maj) failf("unknown synth mod '%s'", config->mod.c);
+        synth.mod = mods_latest(world_mods(world), maj)->id;
+    }
+
+    for (user_id user = 0; user < config->users; ++user)
+        synth_user(&synth, user);
+
+    world_step(world);
+
+    for (user_id user = 0; user < config->users; ++user)
+        synth_configure(&synth, user);
+
+    for (user_id user = 0; user < config->users; ++user)
+        synth_lanes(&synth, user);
+
+    world_step(world);
+
+    mem_free(synth.coords);
+}
@@ -0,0 +1,35 @@
+/* synth.h
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#pragma once
+
+struct world;
+
+
+// -----------------------------------------------------------------------------
+// synth
+// -----------------------------------------------------------------------------
+// Generates large synthetic worlds to be used as fixtures for benchmarks. The
+// output only depends on the config such that runs can be compared.
+
+struct synth_config
+{
+    world_seed seed;
+
+    size_t users;
+    size_t chunks; // per user including the home chunk.
+
+    // Item counts for every non-home chunk.
+    size_t brains;
+    struct symbol mod;
+    size_t printers;
+    size_t ports;
+    size_t transmits;
+
+    // Data packets launched from every non-home chunk.
+    size_t lanes;
+};
+
+bool synth_config_read(struct synth_config *, const char *path);
+void synth_populate(struct world *, const struct synth_config *);
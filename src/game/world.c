@@ -31,6 +31,11 @@ struct world
     struct lanes lanes;
     struct world_user users[user_max];
 
+    // Number of items learned across all users since the world was created or
+    // loaded. Only used to detect tech changes so it's not saved. Atomic as
+    // tech is learned in parallel across users.
+    atomic_size_t learned;
+
     struct shards *shards;
     struct metrics *metrics;
 };
@@ -255,6 +260,22 @@ struct tech *world_tech(struct world *world, user_id user)
     return &world_user(world, user)->tech;
 }
 
+void world_tech_learn_bit(
+        struct world *world, user_id user, enum item item, uint8_t bit)
+{
+    struct tech *tech = world_tech(world, user);
+    if (tech_learned(tech, item)) return;
+
+    tech_learn_bit(tech, item, bit);
+    if (tech_learned(tech, item))
+        atomic_fetch_add_explicit(&world->learned, 1, memory_order_relaxed);
+}
+
+size_t world_tech_learned(const struct world *world)
+{
+    return atomic_load_explicit(&world->learned, memory_order_relaxed);
+}
+
 struct atoms *world_atoms(struct world *world)
 {
     return world->atoms;
@@ -298,6 +319,11 @@ struct chunk *world_chunk(struct world *world, struct coord coord)
     return ret.ok ? (void *) ret.value : NULL;
 }
 
+size_t world_chunk_count(struct world *world)
+{
+    return world->chunks.len;
+}
+
 const struct sector *world_sector(struct world *world, struct coord sector)
 {
     if (unlikely(coord_is_nil(sector))) return NULL;
@@ -351,6 +377,16 @@ struct metrics *world_metrics(struct world *world)
     return world->metrics;
 }
 
+void world_prof_watch(struct world *world, const mod_id *mods, size_t len)
+{
+    shards_prof_watch(world->shards, mods, len);
+}
+
+const struct vm_prof *world_prof(struct world *world)
+{
+    return shards_prof(world->shards);
+}
+
 
 // -----------------------------------------------------------------------------
 // scan
@@ -427,7 +463,7 @@ void world_lanes_arrive(
     struct chunk *chunk = world_chunk_alloc(world, dst, owner);
     assert(chunk);
 
-    chunk_lanes_arrive(chunk, type, src, data, len);
+    chunk_lanes_deliver(chunk, type, src, data, len);
 }
 
 
@@ -435,7 +471,7 @@ void world_lanes_arrive(
 // populate
 // -----------------------------------------------------------------------------
 
-static struct coord world_populate_home(struct sector *sector)
+struct coord world_populate_home(const struct sector *sector)
 {
     for (size_t i = 0; i < sector->stars_len; ++i) {
         const struct star *star = &sector->stars[i];
@@ -452,7 +488,7 @@ static struct coord world_populate_home(struct sector *sector)
     return coord_nil();
 }
 
-void world_populate_user(struct world *world, user_id id)
+void world_populate_user_at(struct world *world, user_id id, struct coord home)
 {
     assert(id < array_len(world->users));
 
@@ -461,41 +497,52 @@ void world_populate_user(struct world *world, user_id id)
 
     user->active = true;
     user->id = id;
+    user->home = home;
     user->log = log_new(world_log_cap);
     tech_populate(&user->tech);
 
-    struct rng rng = rng_make(make_user_token());
-    struct sector *sector = NULL;
+    struct chunk *chunk = world_chunk_alloc(world, user->home, user->id);
+    assert(chunk);
 
-    while (true) {
-        if (sector) sector_free(sector);
+    for (const enum item *it = im_legion_cargo(item_legion); *it; it++) {
+        bool ok = chunk_create(chunk, *it);
+        assert(ok);
+    }
+}
 
-        sector = sector_gen(coord_from_u64(rng_step(&rng)), world->seed);
-        if (sector->stars_len < 100) continue;
+void world_populate_user(struct world *world, user_id id)
+{
+    assert(id < array_len(world->users));
+    if (world->users[id].active) return;
 
-        user->home = world_populate_home(sector);
-        if (coord_is_nil(user->home)) continue;
+    struct rng rng = rng_make(make_user_token());
 
-        sector_free(sector);
+    while (true) {
+        struct sector *sector =
+            sector_gen(coord_from_u64(rng_step(&rng)), world->seed);
 
-        struct chunk *chunk = world_chunk_alloc(world, user->home, user->id);
-        assert(chunk);
+        struct coord home = coord_nil();
+        if (sector->stars_len >= 100) home = world_populate_home(sector);
+        sector_free(sector);
 
-        for (const enum item *it = im_legion_cargo(item_legion); *it; it++) {
-            bool ok = chunk_create(chunk, *it);
-            assert(ok);
-        }
+        if (coord_is_nil(home)) continue;
 
+        world_populate_user_at(world, id, home);
         break;
     }
 }
 
 
-void world_populate(struct world *world)
+void world_populate_mods(struct world *world)
 {
     im_populate_atoms(world->atoms);
     io_populate_atoms(world->atoms);
     specs_populate_atoms(world->atoms);
     mods_populate(world->mods, world->atoms);
+}
+
+void world_populate(struct world *world)
+{
+    world_populate_mods(world);
     world_populate_user(world, user_admin);
 }
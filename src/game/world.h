@@ -30,7 +30,10 @@ struct world *world_load(struct save *);
 
 void world_step(struct world *);
 void world_populate(struct world *);
+void world_populate_mods(struct world *);
 void world_populate_user(struct world *, user_id);
+void world_populate_user_at(struct world *, user_id, struct coord home);
+struct coord world_populate_home(const struct sector *);
 
 world_seed world_gen_seed(const struct world *);
 world_ts world_time(const struct world *);
@@ -38,13 +41,19 @@ struct mods *world_mods(struct world *);
 struct atoms *world_atoms(struct world *);
 struct coord world_home(struct world *, user_id);
 struct tech *world_tech(struct world *, user_id);
+void world_tech_learn_bit(struct world *, user_id, enum item, uint8_t bit);
+size_t world_tech_learned(const struct world *);
 struct chunk *world_chunk(struct world *, struct coord);
 struct chunk *world_chunk_alloc(struct world *, struct coord, user_id);
+size_t world_chunk_count(struct world *);
 const struct sector *world_sector(struct world *, struct coord);
 vm_word world_star_name(struct world *, struct coord);
 bool world_user_access(struct world *, user_set, struct coord);
 struct metrics *world_metrics(struct world *);
 
+void world_prof_watch(struct world *, const mod_id *, size_t len);
+const struct vm_prof *world_prof(struct world *);
+
 
 // -----------------------------------------------------------------------------
 // log
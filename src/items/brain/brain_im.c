@@ -183,11 +183,9 @@ static void im_brain_step_io(
     vm_push(&brain->vm, ok ? io_ok : io_fail);
 }
 
-static void im_brain_vm_step(struct im_brain *brain, struct chunk *chunk)
+static void im_brain_vm_ret(
+        struct im_brain *brain, struct chunk *chunk, mod_id mod)
 {
-    if (!brain->mod || brain->fault || vm_fault(&brain->vm)) return;
-
-    mod_id mod = vm_exec(&brain->vm, brain->mod);
     if (brain->vm.ip == brain->breakpoint) brain->debug = true;
 
     if (mod == VM_FAULT)
@@ -203,12 +201,50 @@ static void im_brain_vm_step(struct im_brain *brain, struct chunk *chunk)
     }
 }
 
+static bool im_brain_vm_ready(struct im_brain *brain)
+{
+    return brain->mod && !brain->fault && !vm_fault(&brain->vm);
+}
+
+static void im_brain_vm_step(struct im_brain *brain, struct chunk *chunk)
+{
+    if (!im_brain_vm_ready(brain)) return;
+    im_brain_vm_ret(brain, chunk, vm_exec(&brain->vm, brain->mod));
+}
+
 static void im_brain_step(void *state, struct chunk *chunk)
 {
     struct im_brain *brain = state;
-    if (brain->debug) return;
+    if (brain->debug || !im_brain_vm_ready(brain)) return;
 
-    im_brain_vm_step(brain, chunk);
+    // The exec metrics cost two clock reads and a table probe per step which
+    // is only worth paying when they're actually dumped.
+    if (!metrics_enabled()) {
+        im_brain_vm_ret(brain, chunk, vm_exec(&brain->vm, brain->mod));
+        return;
+    }
+
+    sys_ts mt = metric_now();
+    const uint32_t tsc = brain->vm.tsc;
+    const mod_maj maj = mod_major(brain->mod_id);
+
+    mod_id ret = vm_exec(&brain->vm, brain->mod);
+
+    // Loads and resets restart the tsc so the delta is only an approximation
+    // for those.
+    struct metric_exec exec = {
+        .n = 1,
+        .cycles = brain->vm.tsc >= tsc ? brain->vm.tsc - tsc : brain->vm.tsc,
+        .io = !ret && vm_io(&brain->vm),
+        .faults = ret == VM_FAULT,
+        .mods = ret && ret != VM_FAULT && ret != VM_RESET,
+    };
+    exec.yields = !ret && !exec.io && exec.cycles < brain->vm.specs.speed;
+
+    im_brain_vm_ret(brain, chunk, ret);
+
+    exec.t = metric_now() - mt;
+    metrics_exec_record(&chunk_metrics(chunk)->exec, maj, chunk_owner(chunk), &exec);
 }
 
 
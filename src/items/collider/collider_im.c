@@ -58,7 +58,7 @@ static void im_collider_step_grow(
         return;
     }
 
-    if (!chunk_ports_consume(chunk, collider->id)) return;
+    if (!chunk_ports_consume(chunk, collider->id)) { chunk_ports_park(chunk, collider->id); return; }
     collider->waiting = false;
 
     collider->size++;
@@ -83,7 +83,7 @@ static void im_collider_step_in(
     }
 
     enum item consumed = chunk_ports_consume(chunk, collider->id);
-    if (!consumed) return;
+    if (!consumed) { chunk_ports_park(chunk, collider->id); return; }
     assert(consumed == ret.item);
 
     collider->waiting = false;
@@ -119,7 +119,7 @@ static void im_collider_step_out(
         return;
     }
 
-    if (!chunk_ports_consumed(chunk, collider->id)) return;
+    if (!chunk_ports_consumed(chunk, collider->id)) { chunk_ports_park(chunk, collider->id); return; }
     collider->waiting = false;
 
     collider->out.it++;
@@ -42,7 +42,7 @@ static void im_deploy_step(void *state, struct chunk *chunk)
     }
 
     enum item ret = chunk_ports_consume(chunk, deploy->id);
-    if (!ret) return;
+    if (!ret) { chunk_ports_park(chunk, deploy->id); return; }
     assert(ret == deploy->item);
 
     if (!chunk_create(chunk, deploy->item))
@@ -60,7 +60,7 @@ static void im_extract_step_input(
     }
 
     enum item consumed = chunk_ports_consume(chunk, extract->id);
-    if (!consumed) return;
+    if (!consumed) { chunk_ports_park(chunk, extract->id); return; }
     assert(consumed == item);
 
     extract->waiting = false;
@@ -89,7 +89,7 @@ static void im_extract_step_output(
         return;
     }
 
-    if (!chunk_ports_consumed(chunk, extract->id)) return;
+    if (!chunk_ports_consumed(chunk, extract->id)) { chunk_ports_park(chunk, extract->id); return; }
 
     extract->tape = tape_packed_it_inc(extract->tape);
     extract->waiting = false;
@@ -202,7 +202,7 @@ static void im_nomad_step_load(struct im_nomad *nomad, struct chunk *chunk)
         return;
     }
 
-    if (!chunk_ports_consume(chunk, nomad->id)) return;
+    if (!chunk_ports_consume(chunk, nomad->id)) { chunk_ports_park(chunk, nomad->id); return; }
 
     struct im_nomad_cargo *cargo = im_nomad_cargo_load(nomad, nomad->item);
     im_nomad_cargo_inc(cargo, nomad->item);
@@ -220,7 +220,7 @@ static void im_nomad_step_unload(struct im_nomad *nomad, struct chunk *chunk)
         return;
     }
 
-    if (!chunk_ports_consumed(chunk, nomad->id)) return;
+    if (!chunk_ports_consumed(chunk, nomad->id)) { chunk_ports_park(chunk, nomad->id); return; }
 
     struct im_nomad_cargo *cargo = im_nomad_cargo_load(nomad, nomad->item);
     im_nomad_cargo_dec(cargo, nomad->item);
@@ -45,7 +45,7 @@ static void im_packer_step(void *state, struct chunk *chunk)
         return;
     }
 
-    if (!chunk_ports_consumed(chunk, packer->id)) return;
+    if (!chunk_ports_consumed(chunk, packer->id)) { chunk_ports_park(chunk, packer->id); return; }
     packer->waiting = false;
     if (packer->loops != im_loops_inf) --packer->loops;
     if (!packer->loops) im_packer_reset(packer, chunk);
@@ -47,7 +47,7 @@ static void im_port_step_unload(struct im_port *port, struct chunk *chunk)
         return;
     }
 
-    if (!chunk_ports_consumed(chunk, port->id)) return;
+    if (!chunk_ports_consumed(chunk, port->id)) { chunk_ports_park(chunk, port->id); return; }
     port->state = im_port_docked;
     port->has.count--;
 
@@ -63,7 +63,7 @@ static void im_port_step_load(struct im_port *port, struct chunk *chunk)
         return;
     }
 
-    if (!chunk_ports_consume(chunk, port->id)) return;
+    if (!chunk_ports_consume(chunk, port->id)) { chunk_ports_park(chunk, port->id); return; }
     port->state = im_port_docked;
     port->has.count++;
 }
@@ -60,7 +60,7 @@ static void im_printer_step_input(
     }
 
     enum item consumed = chunk_ports_consume(chunk, printer->id);
-    if (!consumed) return;
+    if (!consumed) { chunk_ports_park(chunk, printer->id); return; }
     assert(consumed == item);
 
     printer->tape = tape_packed_it_inc(printer->tape);
@@ -83,7 +83,7 @@ static void im_printer_step_output(
         return;
     }
 
-    if (!chunk_ports_consumed(chunk, printer->id)) return;
+    if (!chunk_ports_consumed(chunk, printer->id)) { chunk_ports_park(chunk, printer->id); return; }
 
     printer->tape = tape_packed_it_inc(printer->tape);
     printer->waiting = false;
@@ -10,6 +10,7 @@
 #include "utils/time.h"
 #include "utils/symbol.h"
 #include "utils/config.h"
+#include "utils/lz.h"
 
 #include <sys/epoll.h>
 #include <sys/socket.h>
@@ -21,7 +22,9 @@ void usage(int code, const char *msg);
 
 #include "legion/args.h"
 #include "legion/local.c"
+#include "legion/stream.c"
 #include "legion/client.c"
 #include "legion/server.c"
 #include "legion/config.c"
+#include "legion/bench.c"
 
@@ -19,7 +19,11 @@ struct args
     const char *service;
     const char *type;
     const char *metrics;
+    const char *synth;
     world_seed seed;
+    world_ts ticks;
+    size_t ngrams;
     user_token auth;
     struct symbol name;
+    struct symbol mod;
 };
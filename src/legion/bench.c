@@ -0,0 +1,159 @@
+/* bench.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+
+// -----------------------------------------------------------------------------
+// bench
+// -----------------------------------------------------------------------------
+
+// Output is a single s-expression on stdout such that runs can be collected
+// and compared by scripts. The detailed breakdown goes through the regular
+// metrics file when one is provided.
+bool bench_run(const struct args *args)
+{
+    threads_init(threads_profile_server);
+    if (args->metrics) metrics_open(args->metrics);
+
+    struct sim *sim = sim_new(args->seed, args->save);
+    if (file_exists(args->save) && !sim_load(sim)) {
+        errf("unable to load '%s'", args->save);
+        sim_free(sim);
+        if (args->metrics) metrics_close();
+        return false;
+    }
+
+    struct sim_bench ret = sim_bench(sim, args->ticks);
+    double secs = ((double) ret.elapsed) / sys_sec;
+
+    // The first frame is a full state while the others are deltas on the ack.
+    fprintf(stdout,
+            "(bench (ticks %u) (chunks %zu) (elapsed %lu) (rate %.3lf)"
+            " (frame (first %zu) (delta %.1lf)))\n",
+            ret.ticks, ret.chunks, ret.elapsed, ret.ticks / secs,
+            ret.frame.first,
+            ((double) ret.frame.bytes) / legion_max(ret.ticks - 1, 1U));
+
+    sim_free(sim);
+
+    if (args->metrics) metrics_close();
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// synth
+// -----------------------------------------------------------------------------
+
+bool synth_run(const struct args *args)
+{
+    struct synth_config config = {0};
+    if (!synth_config_read(&config, args->synth)) return false;
+
+    threads_init(threads_profile_server);
+
+    struct sim *sim = sim_new(config.seed, args->save);
+    sim_synth(sim, &config);
+    sim_free(sim);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// ngrams
+// -----------------------------------------------------------------------------
+
+// Profile of the op sequences found in the bundled mods.
+bool ngrams_run(const struct args *args)
+{
+    struct atoms *atoms = atoms_new();
+    im_populate_atoms(atoms);
+    io_populate_atoms(atoms);
+    specs_populate_atoms(atoms);
+
+    struct mods *mods = mods_new();
+    mods_populate(mods, atoms);
+
+    size_t total = 0;
+    struct htable counts = {0};
+
+    const struct mod *mod = nullptr;
+    for (mod_maj maj = 1; (mod = mods_latest(mods, maj)); ++maj)
+        total += vm_ngrams(mod->code, mod->len, args->ngrams, &counts);
+
+    struct ngram { uint64_t key, count; };
+    struct ngram *list = mem_array_alloc_t(*list, counts.len);
+
+    size_t len = 0;
+    for (const struct htable_bucket *it = htable_next(&counts, NULL);
+         it; it = htable_next(&counts, it))
+        list[len++] = (struct ngram) { .key = it->key, .count = it->value };
+
+    int ngram_cmp(const void *lhs_, const void *rhs_)
+    {
+        const struct ngram *lhs = lhs_;
+        const struct ngram *rhs = rhs_;
+        if (lhs->count != rhs->count) return lhs->count < rhs->count ? 1 : -1;
+        return lhs->key < rhs->key ? -1 : lhs->key > rhs->key ? 1 : 0;
+    }
+    qsort(list, len, sizeof(*list), ngram_cmp);
+
+    for (size_t i = 0; i < len; ++i) {
+        fprintf(stdout, "(ngram (count %lu) (ratio %.4lf) (ops",
+                list[i].count, ((double) list[i].count) / total);
+
+        for (size_t j = args->ngrams; j > 0; --j) {
+            enum vm_op op = (list[i].key >> ((j - 1) * 8)) & 0xFF;
+            fprintf(stdout, " %s", vm_op_str(op));
+        }
+
+        fprintf(stdout, "))\n");
+    }
+
+    mem_free(list);
+    htable_reset(&counts);
+    mods_free(mods);
+    atoms_free(atoms);
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// dump
+// -----------------------------------------------------------------------------
+
+// Used to diff the output of the lisp optimizer via --no-opt.
+bool dump_run(const struct args *args)
+{
+    struct atoms *atoms = atoms_new();
+    im_populate_atoms(atoms);
+    io_populate_atoms(atoms);
+    specs_populate_atoms(atoms);
+
+    struct mods *mods = mods_new();
+    mods_populate(mods, atoms);
+
+    bool ok = false;
+    const struct mod *mod = nullptr;
+
+    mod_maj maj = mods_find(mods, &args->mod);
+    if (!maj) errf("unknown mod '%s'", args->mod.c);
+    else if (!(mod = mods_latest(mods, maj)))
+        errf("no compiled version of mod '%s'", args->mod.c);
+    else {
+        // Even single byte ops take less then 32 characters to dump.
+        size_t len = mod->len * 32 + 1;
+        char *buffer = mem_alloc(len);
+
+        mod_dump(mod, buffer, len);
+        fprintf(stdout, "%s", buffer);
+
+        mem_free(buffer);
+        ok = true;
+    }
+
+    mods_free(mods);
+    atoms_free(atoms);
+    return ok;
+}
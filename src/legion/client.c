@@ -16,6 +16,10 @@ struct server
 
     struct proxy_pipe *pipe;
     struct save_ring *in, *out;
+
+    struct { bool done; size_t len; struct stream_hello msg; } hello;
+    enum stream_codec codec;
+    struct stream_buf tx, rx;
 };
 
 
@@ -35,6 +39,8 @@ static void client_free(int poll, struct server *server)
 
     proxy_pipe_close(server->pipe);
     close(server->socket);
+    stream_buf_free(&server->tx);
+    stream_buf_free(&server->rx);
     mem_free(server);
 }
 
@@ -52,6 +58,11 @@ static struct server *client_connect(
     server->in = proxy_pipe_in(server->pipe);
     server->out = proxy_pipe_out(server->pipe);
 
+    // The hello must go out before anything the proxy queued in the ring.
+    struct stream_hello hello = stream_hello_client();
+    memcpy(stream_buf_reserve(&server->tx, sizeof(hello)), &hello, sizeof(hello));
+    stream_buf_commit(&server->tx, sizeof(hello));
+
     int ret = epoll_ctl(poll, EPOLL_CTL_ADD, socket, &(struct epoll_event) {
                 .events = EPOLLET | EPOLLIN | EPOLLOUT | EPOLLRDHUP,
                 .data = (union epoll_data) { .ptr = server },
@@ -75,32 +86,108 @@ static struct server *client_connect(
     return server;
 }
 
-static bool client_events(int poll, struct server *server, int events)
+static ssize_t client_read(struct server *server, void *dst, size_t len, int *events)
 {
-    save_ring_wake_drain(server->out);
+    ssize_t ret = read(server->socket, dst, len);
+    if (ret == -1) {
+        switch (errno) {
+        case ECONNREFUSED: { *events |= EPOLLHUP; } // fallthrough
+        case EAGAIN: case EINTR: case ECONNRESET:  { ret = 0; break; }
+        default: {
+            failf_errno("unable to read from server socket '%d'",
+                    server->socket);
+            break;
+        }
+        }
+    }
+    return ret;
+}
+
+static void client_hello(struct server *server, int *events)
+{
+    uint8_t *dst = ((uint8_t *) &server->hello.msg) + server->hello.len;
+    size_t len = sizeof(server->hello.msg) - server->hello.len;
+    server->hello.len += client_read(server, dst, len, events);
+    if (server->hello.len < sizeof(server->hello.msg)) return;
+
+    const struct stream_hello *msg = &server->hello.msg;
+    server->hello.done = true;
 
-    if (events & EPOLLIN || server->read) {
+    // Servers that predate the hello skip ours and start straight away with
+    // their raw frames which we pass along untouched.
+    if (msg->magic != stream_magic) {
         struct save *save = save_ring_write(server->in);
+        save_write(save, msg, sizeof(*msg));
+        save_ring_commit(server->in, save);
 
-        ssize_t ret = read(server->socket, save_bytes(save), save_cap(save));
-        if (ret == -1) {
-            switch (errno) {
-            case ECONNREFUSED: { events |= EPOLLHUP; } // fallthrough
-            case EAGAIN: case EINTR: case ECONNRESET:  { ret = 0; break; }
-            default: {
-                failf_errno("unable to read from server socket '%d'",
-                        server->socket);
-                break;
-            }
-            }
-        }
+        server->codec = stream_raw;
+        infof("stream from server socket '%d' predates the hello", server->socket);
+        return;
+    }
 
-        server->read = (size_t) ret == save_cap(save);
+    if (msg->codecs != stream_raw && msg->codecs != stream_lz) {
+        errf("invalid stream codec from server: %u", msg->codecs);
+        *events |= EPOLLHUP;
+        return;
+    }
 
-        save_ring_consume(save, ret);
-        save_ring_commit(server->in, save);
+    server->codec = msg->codecs;
+}
+
+static bool client_unpack(struct server *server, int *events)
+{
+    if (stream_unpack(&server->rx, server->in)) return true;
+
+    errf("corrupted stream from server socket '%d'", server->socket);
+    *events |= EPOLLHUP;
+    return false;
+}
+
+// Frames that don't fit in the ring are held in rx and nothing more is read
+// from the socket until they're unpacked which pushes back on the server the
+// same way a full ring does with the raw codec.
+static void client_events_read_lz(struct server *server, int *events)
+{
+    if (!client_unpack(server, events)) return;
+    if ((server->read = stream_unpack_blocked(&server->rx))) return;
+
+    uint8_t *dst = stream_buf_reserve(&server->rx, stream_read_len);
+    ssize_t ret = client_read(server, dst, stream_read_len, events);
+    stream_buf_commit(&server->rx, ret);
+
+    if (!client_unpack(server, events)) return;
+    server->read = (size_t) ret == stream_read_len ||
+        stream_unpack_blocked(&server->rx);
+}
+
+static void client_events_read(struct server *server, int *events)
+{
+    if (!server->hello.done) {
+        client_hello(server, events);
+        if (!server->hello.done) return;
+    }
+
+    if (server->codec == stream_lz) {
+        client_events_read_lz(server, events);
+        return;
     }
 
+    struct save *save = save_ring_write(server->in);
+    ssize_t ret = client_read(server, save_bytes(save), save_cap(save), events);
+
+    server->read = (size_t) ret == save_cap(save);
+
+    save_ring_consume(save, ret);
+    save_ring_commit(server->in, save);
+}
+
+static bool client_events(int poll, struct server *server, int events)
+{
+    save_ring_wake_drain(server->out);
+
+    if (events & EPOLLIN || server->read)
+        client_events_read(server, &events);
+
     if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP) ||
             save_ring_closed(server->out))
     {
@@ -111,12 +198,17 @@ static bool client_events(int poll, struct server *server, int events)
     // Can either be triggered by the wake fd or the EPOLLOUT. In either case we
     // can check very easily and quickly whether we have anything to write so
     // might as well always do it.
+    if (!stream_buf_flush(&server->tx, server->socket)) return true;
+
     struct save *save = save_ring_read(server->out);
     if (save_cap(save)) {
         ssize_t ret = write(server->socket, save_bytes(save), save_cap(save));
-        if (ret == -1 && !(errno == EAGAIN || errno == EINTR)) {
-            failf_errno("unable to read from client socket '%d'",
-                    server->socket);
+        if (ret == -1) {
+            if (!(errno == EAGAIN || errno == EINTR)) {
+                failf_errno("unable to read from client socket '%d'",
+                        server->socket);
+            }
+            ret = 0;
         }
 
         save_ring_consume(save, ret);
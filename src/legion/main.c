@@ -20,6 +20,10 @@ bool local_run(const struct args *);
 bool client_run(const struct args *);
 bool server_run(const struct args *);
 bool config_run(const struct args *);
+bool bench_run(const struct args *);
+bool synth_run(const struct args *);
+bool ngrams_run(const struct args *);
+bool dump_run(const struct args *);
 
 
 // -----------------------------------------------------------------------------
@@ -38,6 +42,10 @@ void usage(int code, const char *msg)
         "       --client <host> [--port <port>] [--config <path>]\n"
         "       --server <host> [--port <port>] [--file <path>] [--config <path>]\n"
         "                       [--seed <seed>] [--metrics <path>]\n"
+        "       --bench <ticks> [--file <path>] [--seed <seed>] [--metrics <path>]\n"
+        "       --synth <config> [--file <path>]\n"
+        "       --ngrams <len>\n"
+        "       --dump <mod> [--no-opt]\n"
         "\n"
         "Commands:\n"
         "  -h --help    Prints this message\n"
@@ -47,6 +55,13 @@ void usage(int code, const char *msg)
         "  -L --local   Starts the game locally; default command\n"
         "  -S --server  Starts a game server listening on the given host\n"
         "  -C --client  Connects to the game server at the given host\n"
+        "  -B --bench   Runs the given number of ticks as fast as possible\n"
+        "               without a client and prints the throughput\n"
+        "  -G --synth   Generates a large synthetic world as described by the\n"
+        "               given config file and writes it to the save file\n"
+        "  -O --ngrams  Prints the most frequent sequences of ops of the given\n"
+        "               length found in the bundled mods\n"
+        "  -D --dump    Prints the bytecode of the given bundled mod\n"
         "\n"
         "Arguments:\n"
         "  -f --file    Path to save file; default is './legion.save'\n"
@@ -59,6 +74,9 @@ void usage(int code, const char *msg)
         "  -a --auth    Authentication token for a server\n"
         "  -m --metrics Path to save simulation metrics into. Default is\n"
         "               not generate any metrics\n"
+        "  -o --no-opt  Disables the optimization pass of the mod compiler\n"
+        "  -J --jit     Mode of the mod jit: \"off\", \"on\" or \"diff\" which\n"
+        "               checks the jit against the interpreter; default is off\n"
         "";
     fprintf(stderr, usage);
     exit(code);
@@ -71,7 +89,7 @@ void usage(int code, const char *msg)
 
 int main(int argc, char *const argv[])
 {
-    const char *optstring = "+hTN:LS:C:D:E:f:c:p:s:n:a:m:";
+    const char *optstring = "+hTN:LS:C:B:G:O:D:E:f:c:p:s:n:a:m:oJ:";
     struct option longopts[] = {
         { .val = 'h', .name = "help",    .has_arg = no_argument },
 
@@ -80,6 +98,10 @@ int main(int argc, char *const argv[])
         { .val = 'L', .name = "local",   .has_arg = no_argument },
         { .val = 'S', .name = "server",  .has_arg = required_argument },
         { .val = 'C', .name = "client",  .has_arg = required_argument },
+        { .val = 'B', .name = "bench",   .has_arg = required_argument },
+        { .val = 'G', .name = "synth",   .has_arg = required_argument },
+        { .val = 'O', .name = "ngrams",  .has_arg = required_argument },
+        { .val = 'D', .name = "dump",    .has_arg = required_argument },
 
         { .val = 'f', .name = "file",    .has_arg = required_argument },
         { .val = 'c', .name = "config",  .has_arg = required_argument },
@@ -88,6 +110,8 @@ int main(int argc, char *const argv[])
         { .val = 'n', .name = "name",    .has_arg = required_argument },
         { .val = 'a', .name = "auth",    .has_arg = required_argument },
         { .val = 'm', .name = "metrics", .has_arg = required_argument },
+        { .val = 'o', .name = "no-opt",  .has_arg = no_argument },
+        { .val = 'J', .name = "jit",     .has_arg = required_argument },
 
         {0},
     };
@@ -96,6 +120,7 @@ int main(int argc, char *const argv[])
         cmd_nil = 0,
         cmd_token, cmd_config,
         cmd_local, cmd_server, cmd_client,
+        cmd_bench, cmd_synth, cmd_ngrams, cmd_dump,
     } cmd = cmd_nil;
 
     struct args args = {
@@ -119,10 +144,51 @@ int main(int argc, char *const argv[])
         case 'S': { cmd = cmd_server; commands++; args.node = optarg; break; }
         case 'C': { cmd = cmd_client; commands++; args.node = optarg; break; }
 
+        case 'B': {
+            cmd = cmd_bench; commands++;
+            size_t len = strlen(optarg);
+            uint64_t ticks = 0;
+            if (str_atou(optarg, len, &ticks) != len || !ticks || ticks > UINT32_MAX)
+                usage(1, "invalid bench argument");
+            args.ticks = ticks;
+            break;
+        }
+
+        case 'G': { cmd = cmd_synth; commands++; args.synth = optarg; break; }
+
+        case 'O': {
+            cmd = cmd_ngrams; commands++;
+            size_t len = strlen(optarg);
+            uint64_t ngrams = 0;
+            if (str_atou(optarg, len, &ngrams) != len || ngrams < 2 || ngrams > vm_ngrams_cap)
+                usage(1, "invalid ngrams argument");
+            args.ngrams = ngrams;
+            break;
+        }
+
+        case 'D': {
+            cmd = cmd_dump; commands++;
+            size_t len = strlen(optarg);
+            ssize_t ret = symbol_parse(optarg, len, &args.mod);
+            if (ret < 0 || (size_t) ret != len)
+                usage(1, "invalid dump argument");
+            break;
+        }
+
         case 'f': { args.save = optarg; break; }
         case 'c': { args.config = optarg; break; }
         case 'p': { args.service = optarg; break; }
         case 'm': { args.metrics = optarg; break; }
+        case 'o': { mod_compiler_opt(false); break; }
+
+        case 'J': {
+            if (!vm_jit_supported()) usage(1, "jit is not supported on this platform");
+            if (!strcmp(optarg, "off")) vm_jit_set(vm_jit_off);
+            else if (!strcmp(optarg, "on")) vm_jit_set(vm_jit_on);
+            else if (!strcmp(optarg, "diff")) vm_jit_set(vm_jit_diff);
+            else usage(1, "invalid jit argument");
+            break;
+        }
 
         case 's': {
             size_t len = strlen(optarg);
@@ -167,6 +233,10 @@ int main(int argc, char *const argv[])
     case cmd_local:  { ok = local_run(&args); break; }
     case cmd_client: { ok = client_run(&args); break; }
     case cmd_server: { ok = server_run(&args); break; }
+    case cmd_bench:  { ok = bench_run(&args); break; }
+    case cmd_synth:  { ok = synth_run(&args); break; }
+    case cmd_ngrams: { ok = ngrams_run(&args); break; }
+    case cmd_dump:   { ok = dump_run(&args); break; }
 
     default: { assert(false); }
     }
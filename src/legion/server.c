@@ -20,6 +20,10 @@ struct client
 
     struct sim_pipe *pipe;
     struct save_ring *in, *out;
+
+    struct { bool done; size_t len; struct stream_hello msg; } hello;
+    enum stream_codec codec;
+    struct stream_buf tx;
 };
 
 static struct
@@ -45,6 +49,7 @@ static void server_free(int poll, struct client *client)
 
     sim_pipe_close(client->pipe);
     close(client->socket);
+    stream_buf_free(&client->tx);
 
     // My head hurts writting this.
     struct client **prev = &server.clients;
@@ -104,11 +109,83 @@ static void server_accept(int poll, int listen)
     }
 }
 
+// Clients that predate the hello start straight away with their frames which we
+// pass along untouched and fall back to an uncompressed stream.
+static void server_hello(struct client *client)
+{
+    uint8_t *dst = ((uint8_t *) &client->hello.msg) + client->hello.len;
+    ssize_t ret = read(client->socket, dst, sizeof(client->hello.msg) - client->hello.len);
+    if (ret == -1) {
+        switch (errno) {
+        case EAGAIN: case EINTR: case ECONNRESET:  { ret = 0; break; }
+        default: {
+            failf_errno("unable to read hello from client '%s'",
+                    sockaddrs_str(&client->addr).c);
+            break;
+        }
+        }
+    }
+
+    client->hello.len += ret;
+    if (client->hello.len < sizeof(client->hello.msg)) return;
+    client->hello.done = true;
+
+    if (!stream_hello_is_client(&client->hello.msg)) {
+        struct save *save = save_ring_write(client->in);
+        save_write(save, &client->hello.msg, sizeof(client->hello.msg));
+        save_ring_commit(client->in, save);
+        return;
+    }
+
+    uint8_t codecs = client->hello.msg.codecs & stream_codecs;
+    client->codec = codecs & (1 << stream_lz) ? stream_lz : stream_raw;
+
+    struct stream_hello reply = { .magic = stream_magic, .codecs = client->codec };
+    memcpy(stream_buf_reserve(&client->tx, sizeof(reply)), &reply, sizeof(reply));
+    stream_buf_commit(&client->tx, sizeof(reply));
+
+    infof("stream to '%s' uses codec '%u'",
+            sockaddrs_str(&client->addr).c, client->codec);
+}
+
+static void server_write(struct client *client)
+{
+    // Nothing can be written until we know how to write it.
+    if (!client->hello.done) return;
+    if (!stream_buf_flush(&client->tx, client->socket)) return;
+
+    // Frames are only packed once the previous batch is fully written so that
+    // a slow client still applies back-pressure on the ring.
+    if (client->codec == stream_lz) {
+        stream_pack(&client->tx, client->out);
+        (void) stream_buf_flush(&client->tx, client->socket);
+        return;
+    }
+
+    struct save *save = save_ring_read(client->out);
+    if (!save_cap(save)) return;
+
+    ssize_t ret = write(client->socket, save_bytes(save), save_cap(save));
+    if (ret == -1) {
+        if (!(errno == EAGAIN || errno == EINTR)) {
+            failf_errno("unable to write to client '%s'",
+                    sockaddrs_str(&client->addr).c);
+        }
+        ret = 0;
+    }
+
+    save_ring_consume(save, ret);
+    save_ring_commit(client->out, save);
+}
+
 static void server_events(int poll, struct client *client, uint32_t events)
 {
     save_ring_wake_drain(client->out);
 
-    if (events & EPOLLIN || client->read) {
+    if ((events & EPOLLIN || client->read) && !client->hello.done)
+        server_hello(client);
+
+    if ((events & EPOLLIN || client->read) && client->hello.done) {
         struct save *save = save_ring_write(client->in);
 
         ssize_t ret = read(client->socket, save_bytes(save), save_cap(save));
@@ -140,17 +217,7 @@ static void server_events(int poll, struct client *client, uint32_t events)
     // Can either be triggered by the wake fd or the EPOLLOUT. In either case we
     // can check very easily and quickly whether we have anything to write so
     // might as well always do it.
-    struct save *save = save_ring_read(client->out);
-    if (save_cap(save)) {
-        ssize_t ret = write(client->socket, save_bytes(save), save_cap(save));
-        if (ret == -1 && !(errno == EAGAIN || errno == EINTR)) {
-            failf_errno("unable to write to client '%s'",
-                    sockaddrs_str(&client->addr).c);
-        }
-
-        save_ring_consume(save, ret);
-        save_ring_commit(client->out, save);
-    }
+    server_write(client);
 
     // If the server actively closed the connection then there's probably an
     // error message queued so we want to make sure that our ring is written out
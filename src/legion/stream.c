@@ -0,0 +1,196 @@
+/* stream.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+
+// -----------------------------------------------------------------------------
+// stream
+// -----------------------------------------------------------------------------
+// The server to client stream can optionally be compressed. On connect, the
+// client sends a hello with the codecs it supports and the server replies with
+// the codec it picked before writing anything else to the socket. With lz,
+// every frame of the stream is wrapped in a stream_frame followed by either the
+// lz block of the frame or the raw frame if it didn't compress.
+//
+// Either end may predate the hello. The client hello is laid out as an empty
+// frame header such that older servers skip over it as an unexpected header
+// type and start streaming raw frames right away. The server reply uses a magic
+// of its own so a client that doesn't find it knows it's already reading the
+// uncompressed stream.
+
+enum : uint32_t { stream_magic = 0x5A4CF00FU };
+
+enum stream_codec : uint8_t
+{
+    stream_raw = 0,
+    stream_lz = 1,
+};
+
+constexpr uint8_t stream_codecs = 1 << stream_lz;
+
+// The client sends header_magic and the server replies with stream_magic.
+struct legion_packed stream_hello
+{
+    uint32_t magic;
+    uint8_t codecs; // bitmask from the client and a codec from the server
+    legion_pad(3);  // length of the frame header which must stay zero
+};
+
+static_assert(sizeof(struct stream_hello) == sizeof(struct header));
+static_assert(stream_codecs != header_cmd);
+
+static struct stream_hello stream_hello_client(void)
+{
+    return (struct stream_hello) { .magic = header_magic, .codecs = stream_codecs };
+}
+
+// Frames always carry their header so only the hello can have a zero length.
+static bool stream_hello_is_client(const struct stream_hello *hello)
+{
+    struct header head = {0};
+    memcpy(&head, hello, sizeof(head));
+    return head.magic == header_magic && head.type != header_cmd && !head.len;
+}
+
+// wire == raw indicates that the frame is stored as is.
+struct legion_packed stream_frame { uint32_t raw, wire; };
+
+static_assert(sizeof(struct stream_frame) == sizeof(uint64_t));
+
+constexpr size_t stream_read_len = 16 * sys_page_len;
+
+
+// -----------------------------------------------------------------------------
+// buf
+// -----------------------------------------------------------------------------
+// Bytes that are waiting to be written to the socket or decoded into a ring.
+
+struct stream_buf { uint8_t *data; size_t it, len, cap; };
+
+static void stream_buf_free(struct stream_buf *buf)
+{
+    mem_free(buf->data);
+}
+
+// Returns a pointer to at least len free bytes at the end of the buffer which
+// must then be committed.
+static uint8_t *stream_buf_reserve(struct stream_buf *buf, size_t len)
+{
+    if (buf->it) {
+        memmove(buf->data, buf->data + buf->it, buf->len - buf->it);
+        buf->len -= buf->it;
+        buf->it = 0;
+    }
+
+    if (buf->len + len > buf->cap) {
+        size_t cap = legion_max(buf->cap * 2, buf->len + len);
+        buf->data = mem_realloc(buf->data, buf->cap, cap);
+        buf->cap = cap;
+    }
+
+    return buf->data + buf->len;
+}
+
+static void stream_buf_commit(struct stream_buf *buf, size_t len)
+{
+    assert(buf->len + len <= buf->cap);
+    buf->len += len;
+}
+
+// Returns false if the buffer couldn't be fully written without blocking.
+static bool stream_buf_flush(struct stream_buf *buf, int socket)
+{
+    while (buf->it < buf->len) {
+        ssize_t ret = write(socket, buf->data + buf->it, buf->len - buf->it);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return false;
+            failf_errno("unable to write to socket '%d'", socket);
+        }
+        buf->it += ret;
+    }
+
+    buf->it = buf->len = 0;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// frames
+// -----------------------------------------------------------------------------
+
+// Moves all the complete frames of the ring into the buffer.
+static void stream_pack(struct stream_buf *buf, struct save_ring *ring)
+{
+    sys_ts t0 = sys_now();
+    size_t frames = 0, raw = 0, wire = 0;
+
+    struct save *save = save_ring_read(ring);
+    while (save_cap(save) - save_len(save) >= sizeof(struct header)) {
+        const uint8_t *src = save_bytes(save) + save_len(save);
+
+        struct header head = {0};
+        memcpy(&head, src, sizeof(head));
+        assert(head.magic == header_magic);
+        if (save_cap(save) - save_len(save) < head.len) break;
+
+        uint8_t *dst = stream_buf_reserve(buf, sizeof(struct stream_frame) + head.len);
+        struct stream_frame frame = { .raw = head.len };
+
+        // Capping the output to the raw length means that anything that doesn't
+        // shrink is stored as is.
+        uint8_t *block = dst + sizeof(frame);
+        frame.wire = lz_compress(src, head.len, block, head.len - 1);
+        if (!frame.wire) memcpy(block, src, (frame.wire = head.len));
+
+        memcpy(dst, &frame, sizeof(frame));
+        stream_buf_commit(buf, sizeof(frame) + frame.wire);
+        save_ring_consume(save, head.len);
+
+        frames++;
+        raw += frame.raw;
+        wire += sizeof(frame) + frame.wire;
+    }
+
+    save_ring_commit(ring, save);
+    if (frames) metrics_stream(frames, raw, wire, sys_now() - t0);
+}
+
+// Moves all the complete frames of the buffer into the ring and returns false
+// if the stream is corrupted.
+static bool stream_unpack(struct stream_buf *buf, struct save_ring *ring)
+{
+    while (buf->len - buf->it >= sizeof(struct stream_frame)) {
+        struct stream_frame frame = {0};
+        memcpy(&frame, buf->data + buf->it, sizeof(frame));
+
+        if (frame.wire > frame.raw || frame.raw >= sim_out_len) return false;
+        if (buf->len - buf->it < sizeof(frame) + frame.wire) break;
+
+        // Picked back up on the next read once the ring is drained.
+        struct save *save = save_ring_write(ring);
+        if (save_cap(save) < frame.raw) break;
+
+        const uint8_t *src = buf->data + buf->it + sizeof(frame);
+        if (frame.wire == frame.raw) memcpy(save_bytes(save), src, frame.raw);
+        else if (!lz_decompress(src, frame.wire, save_bytes(save), frame.raw))
+            return false;
+
+        save_ring_consume(save, frame.raw);
+        save_ring_commit(ring, save);
+        buf->it += sizeof(frame) + frame.wire;
+    }
+
+    return true;
+}
+
+// Returns true if stream_unpack left a complete frame in the buffer because the
+// ring was full.
+static bool stream_unpack_blocked(const struct stream_buf *buf)
+{
+    if (buf->len - buf->it < sizeof(struct stream_frame)) return false;
+
+    struct stream_frame frame = {0};
+    memcpy(&frame, buf->data + buf->it, sizeof(frame));
+    return buf->len - buf->it >= sizeof(frame) + frame.wire;
+}
@@ -35,6 +35,7 @@ void ui_asm_style_default(struct ui_style *s)
         .current = s->rgba.code.current,
         .select = s->rgba.code.select,
         .highlight = s->rgba.code.highlight,
+        .heat = make_rgba(0xFF, 0x45, 0x00, 0xFF), // OrangeRed
     };
 }
 
@@ -83,6 +84,7 @@ void ui_asm_reset(struct ui_asm *ui)
 {
     asm_reset(ui->as);
     ui->mod = nullptr;
+    ui_asm_prof(ui, nullptr, 0);
 
     memset(&ui->carret, 0, sizeof(ui->carret));
     ui_scroll_update_rows(&ui->scroll, 0);
@@ -115,6 +117,7 @@ static void ui_asm_select_clear(struct ui_asm *ui)
 void ui_asm_set_mod(struct ui_asm *ui, const struct mod *mod)
 {
     ui->mod = mod;
+    ui_asm_prof(ui, nullptr, 0);
     asm_parse(ui->as, mod);
     ui_scroll_update_rows(&ui->scroll, asm_rows(ui->as));
 
@@ -157,6 +160,22 @@ void ui_asm_breakpoint(struct ui_asm *ui, vm_ip ip)
     ui->bp.row = ip != vm_ip_nil ? asm_row(ui->as, ip) : 0;
 }
 
+// counts is borrowed until the next call and is ignored if it doesn't match
+// the length of the mod.
+void ui_asm_prof(struct ui_asm *ui, const uint64_t *counts, size_t len)
+{
+    if (!ui->mod || len != ui->mod->len) counts = nullptr;
+
+    ui->prof.counts = counts;
+    ui->prof.len = counts ? len : 0;
+    ui->prof.max = ui->prof.total = 0;
+
+    for (size_t ip = 0; ip < ui->prof.len; ++ip) {
+        ui->prof.max = legion_max(ui->prof.max, counts[ip]);
+        ui->prof.total += counts[ip];
+    }
+}
+
 static void ui_asm_breakpoint_at(struct ui_asm *ui, uint32_t row)
 {
     vm_ip ip = vm_ip_nil;
@@ -186,6 +205,8 @@ constexpr uint32_t ui_asm_line_col =
 
 void ui_asm_render(struct ui_asm *ui, struct ui_layout *layout)
 {
+    ui_tooltip_unset();
+
     struct dim cell = engine_cell();
     ui->w = make_rect_parts(layout->row.pos, ui_layout_remaining(layout));
 
@@ -276,6 +297,23 @@ void ui_asm_render(struct ui_asm *ui, struct ui_layout *layout)
                     str, sizeof(str));
         }
 
+        if (ui->prof.max && it->ip < ui->prof.len && ui->prof.counts[it->ip]) {
+            uint64_t count = ui->prof.counts[it->ip];
+
+            struct rgba bg = ui->s.heat;
+            bg.a = 0x20 + ((0xFF - 0x20) * count) / ui->prof.max;
+
+            struct rect rect = make_rect(jmp_x, base.y, x1 - jmp_x, cell.h);
+            render_rect_fill(l + layer_select, bg, rect);
+
+            if (ev_mouse_in(rect)) {
+                struct ui_str str = ui_str_v(32);
+                ui_str_setf(&str, "%lu cycles (%.1lf%%)",
+                        count, (count * 100.0) / ui->prof.total);
+                ui_tooltip_set(rect, str);
+            }
+        }
+
         if (row >= select.first.row && row <= select.last.row) {
             size_t from = 0, to = index.len;
             if (row == select.first.row) from = select.first.col;
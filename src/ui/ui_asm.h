@@ -22,6 +22,7 @@ struct ui_asm_style
     struct { struct rgba bg; sys_ts opaque, fade; } hl;
     struct rgba fg, keyword, symbol;
     struct rgba current, select, highlight;
+    struct rgba heat;
 };
 
 void ui_asm_style_default(struct ui_style *);
@@ -50,6 +51,9 @@ struct ui_asm
     struct { uint32_t row; sys_ts ts; } hl;
     struct { bool active; struct rowcol first, last; } select;
 
+    // Execution count per ip; see vm_prof.
+    struct { const uint64_t *counts; size_t len; uint64_t max, total; } prof;
+
     struct {
         enum ui_asm_find_type type;
         struct ui_label op;
@@ -70,6 +74,7 @@ void ui_asm_focus(struct ui_asm *);
 vm_ip ui_asm_ip(struct ui_asm *);
 void ui_asm_goto(struct ui_asm *, vm_ip);
 void ui_asm_breakpoint(struct ui_asm *, vm_ip);
+void ui_asm_prof(struct ui_asm *, const uint64_t *counts, size_t len);
 
 void ui_asm_event(struct ui_asm *);
 void ui_asm_render(struct ui_asm *, struct ui_layout *);
@@ -44,6 +44,7 @@ void ui_code_style_default(struct ui_style *s)
         .current = s->rgba.code.current,
         .select = s->rgba.code.select,
         .box = s->rgba.box.border,
+        .heat = make_rgba(0xFF, 0x45, 0x00, 0xFF), // OrangeRed
     };
 }
 
@@ -103,12 +104,14 @@ void ui_code_free(struct ui_code *ui)
     ui_button_free(&ui->find.close);
 
     code_free(ui->code);
+    mem_free(ui->prof.rows);
 }
 
 void ui_code_reset(struct ui_code *ui)
 {
     code_reset(ui->code);
     ui->mod = nullptr;
+    ui->prof.len = 0;
 
     memset(&ui->carret, 0, sizeof(ui->carret));
 
@@ -208,6 +211,7 @@ static void ui_code_update(struct ui_code *ui, enum ui_code_update_flag flag)
 void ui_code_set_mod(struct ui_code *ui, const struct mod *mod)
 {
     ui->mod = mod;
+    ui->prof.len = 0;
     ui_code_set_text(ui, mod->src, mod->src_len);
 
     ui_list_reset(&ui->errors);
@@ -284,6 +288,58 @@ void ui_code_breakpoint(struct ui_code *ui, vm_ip ip)
     ui->bp.col = rc.col;
 }
 
+// Counts are attributed to the form of mod_index that generated each ip and
+// then summed per row of the source where the form starts. Sorting the forms
+// by position lets us find all the rows in a single pass over the source.
+void ui_code_prof(struct ui_code *ui, const uint64_t *counts, size_t len)
+{
+    ui->prof.len = 0;
+    ui->prof.max = ui->prof.total = 0;
+    if (!counts || !ui->mod || len != ui->mod->len || !ui->mod->index_len) return;
+
+    const struct mod *mod = ui->mod;
+    struct form { uint32_t pos; uint64_t count; } forms[mod->index_len];
+
+    for (size_t i = 0; i < mod->index_len; ++i) {
+        vm_ip end = i + 1 < mod->index_len ? mod->index[i + 1].ip : mod->len;
+
+        forms[i] = (struct form) { .pos = mod->index[i].pos };
+        for (vm_ip ip = mod->index[i].ip; ip < legion_min(end, len); ++ip)
+            forms[i].count += counts[ip];
+    }
+
+    int form_cmp(const void *lhs, const void *rhs)
+    {
+        uint32_t l = ((const struct form *) lhs)->pos;
+        uint32_t r = ((const struct form *) rhs)->pos;
+        return l < r ? -1 : l > r ? 1 : 0;
+    }
+    qsort(forms, mod->index_len, sizeof(forms[0]), form_cmp);
+
+    uint32_t rows = 1;
+    for (size_t i = 0; i < mod->src_len; ++i) rows += mod->src[i] == '\n';
+
+    if (rows > ui->prof.cap) {
+        size_t old = ui->prof.cap;
+        ui->prof.cap = rows;
+        ui->prof.rows = mem_array_realloc_t(ui->prof.rows, old, ui->prof.cap);
+    }
+    memset(ui->prof.rows, 0, rows * sizeof(ui->prof.rows[0]));
+    ui->prof.len = rows;
+
+    uint32_t row = 0, pos = 0;
+    for (size_t i = 0; i < mod->index_len; ++i) {
+        for (; pos < forms[i].pos && pos < mod->src_len; ++pos)
+            row += mod->src[pos] == '\n';
+
+        ui->prof.rows[row] += forms[i].count;
+        ui->prof.total += forms[i].count;
+    }
+
+    for (size_t i = 0; i < rows; ++i)
+        ui->prof.max = legion_max(ui->prof.max, ui->prof.rows[i]);
+}
+
 static void ui_code_breakpoint_at(struct ui_code *ui, uint32_t pos)
 {
     vm_ip ip = vm_ip_nil;
@@ -423,6 +479,30 @@ void ui_code_render(struct ui_code *ui, struct ui_layout *layout)
                 str, sizeof(str));
     }
 
+    // Rows no longer line up with the mod once the code is modified.
+    for (uint32_t row = 0; !modified && row < row_last - row_first; ++row) {
+        uint32_t index = row_first + row;
+        if (!ui->prof.max || index >= ui->prof.len || !ui->prof.rows[index])
+            continue;
+
+        uint64_t count = ui->prof.rows[index];
+        struct rgba bg = ui->s.heat;
+        bg.a = 0x20 + ((0xFF - 0x20) * count) / ui->prof.max;
+
+        struct rect rect = make_rect(
+                inner.base.pos.x, inner.base.pos.y + (row * cell.h),
+                inner.base.dim.w, cell.h);
+        render_rect_fill(l + layer_select, bg, rect);
+
+        if (cursor.margin && cursor.row == index) {
+            struct ui_str str = ui_str_v(32);
+            ui_str_setf(&str, "%lu cycles (%.1lf%%)",
+                    count, (count * 100.0) / ui->prof.total);
+            ui_tooltip_set(make_rect(
+                            ui->margin.x, rect.y, ui->margin.w, cell.h), str);
+        }
+    }
+
     struct { struct rowcol first, last; bool active; } select = {0};
     {
         select.active = ui_code_select_active(ui);
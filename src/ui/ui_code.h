@@ -24,6 +24,7 @@ struct ui_code_style
     struct { struct rgba fg, bg; unit margin; } errors;
     struct rgba fg, comment, keyword, atom;
     struct rgba current, select, box;
+    struct rgba heat;
 };
 
 void ui_code_style_default(struct ui_style *);
@@ -56,6 +57,9 @@ struct ui_code
     struct { uint32_t len, row, col; sys_ts ts; } hl;
     struct { hash_val sym; uint32_t paren; } match;
 
+    // Execution count of the forms starting on each row; see vm_prof.
+    struct { uint64_t *rows; uint32_t len, cap; uint64_t max, total; } prof;
+
     struct
     {
         bool active;
@@ -85,6 +89,7 @@ bool ui_code_modified(struct ui_code *);
 vm_ip ui_code_ip(struct ui_code *);
 void ui_code_goto(struct ui_code *, vm_ip);
 void ui_code_breakpoint(struct ui_code *, vm_ip);
+void ui_code_prof(struct ui_code *, const uint64_t *counts, size_t len);
 
 void ui_code_event(struct ui_code *);
 void ui_code_render(struct ui_code *, struct ui_layout *);
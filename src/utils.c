@@ -17,3 +17,4 @@
 #include "utils/save.c"
 #include "utils/symbol.c"
 #include "utils/token.c"
+#include "utils/lz.c"
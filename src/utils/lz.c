@@ -0,0 +1,181 @@
+/* lz.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "utils/lz.h"
+
+
+// -----------------------------------------------------------------------------
+// format
+// -----------------------------------------------------------------------------
+// A block is a series of sequences each made of a token whose high nibble is
+// the number of literals and whose low nibble is the length of the match minus
+// lz_min. A nibble of 15 is followed by extension bytes that are summed until
+// one isn't 255. The literals come next followed by the 16 bits little-endian
+// offset of the match and its extension bytes. The last sequence of a block
+// only has literals.
+
+constexpr size_t lz_min = 4;
+constexpr size_t lz_nibble = 15;
+constexpr size_t lz_window = UINT16_MAX;
+
+// Small enough for the table to live on the stack and stay in L1.
+constexpr size_t lz_hash_bits = 12;
+constexpr size_t lz_hash_len = 1 << lz_hash_bits;
+
+static uint32_t lz_read32(const uint8_t *ptr)
+{
+    uint32_t value = 0;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value)
+{
+    return (value * 2654435761U) >> (32 - lz_hash_bits);
+}
+
+
+// -----------------------------------------------------------------------------
+// compress
+// -----------------------------------------------------------------------------
+
+static uint8_t *lz_write_len(uint8_t *op, size_t len)
+{
+    for (; len >= 0xFF; len -= 0xFF) *op++ = 0xFF;
+    *op++ = len;
+    return op;
+}
+
+static uint8_t *lz_sequence(
+        uint8_t *op, const uint8_t *end,
+        const uint8_t *lit, size_t lit_len,
+        size_t offset, size_t match)
+{
+    // Worst case for the token, the literals, the offset and both lengths.
+    size_t need = 1 + lit_len + (lit_len / 0xFF) + 1 + 2 + (match / 0xFF) + 1;
+    if (need > (size_t) (end - op)) return nullptr;
+
+    uint8_t *token = op++;
+    *token = legion_min(lit_len, lz_nibble) << 4;
+    if (lit_len >= lz_nibble) op = lz_write_len(op, lit_len - lz_nibble);
+
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (!match) return op;
+    assert(offset && offset <= lz_window);
+    assert(match >= lz_min);
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+
+    match -= lz_min;
+    *token |= legion_min(match, lz_nibble);
+    if (match >= lz_nibble) op = lz_write_len(op, match - lz_nibble);
+
+    return op;
+}
+
+size_t lz_compress(const void *src_, size_t len, void *dst_, size_t cap)
+{
+    const uint8_t *src = src_;
+    uint8_t *dst = dst_;
+
+    const uint8_t *it = src, *anchor = src, *end = src + len;
+    uint8_t *op = dst, *op_end = dst + cap;
+
+    // Positions are relative to src and zero is a valid position so stale
+    // entries are weeded out by comparing the bytes.
+    uint32_t table[lz_hash_len] = {0};
+
+    while (len >= lz_min && it <= end - lz_min) {
+        uint32_t value = lz_read32(it);
+        uint32_t hash = lz_hash(value);
+        const uint8_t *ref = src + table[hash];
+        table[hash] = it - src;
+
+        if (ref >= it || (size_t) (it - ref) > lz_window || lz_read32(ref) != value) {
+            // The further we are from the last match the less likely we are
+            // to find one so we speed up to get through noise faster.
+            it += 1 + ((it - anchor) >> 6);
+            continue;
+        }
+
+        while (it > anchor && ref > src && it[-1] == ref[-1]) { it--; ref--; }
+
+        size_t match = lz_min;
+        while (it + match < end && it[match] == ref[match]) match++;
+
+        op = lz_sequence(op, op_end, anchor, it - anchor, it - ref, match);
+        if (!op) return 0;
+
+        it += match;
+        anchor = it;
+    }
+
+    // Empty blocks still get a token so that 0 can signal an overflow.
+    if (anchor < end || op == dst) {
+        op = lz_sequence(op, op_end, anchor, end - anchor, 0, 0);
+        if (!op) return 0;
+    }
+
+    return op - dst;
+}
+
+
+// -----------------------------------------------------------------------------
+// decompress
+// -----------------------------------------------------------------------------
+
+static bool lz_read_len(const uint8_t **it, const uint8_t *end, size_t *len)
+{
+    uint8_t byte = 0;
+    do {
+        if (*it == end) return false;
+        *len += (byte = *(*it)++);
+    } while (byte == 0xFF);
+    return true;
+}
+
+bool lz_decompress(const void *src_, size_t src_len, void *dst_, size_t len)
+{
+    const uint8_t *src = src_;
+    uint8_t *dst = dst_;
+
+    const uint8_t *it = src, *end = src + src_len;
+    uint8_t *op = dst, *op_end = dst + len;
+
+    while (it < end) {
+        uint8_t token = *it++;
+
+        size_t lit = token >> 4;
+        if (lit == lz_nibble && !lz_read_len(&it, end, &lit)) return false;
+        if (lit > (size_t) (end - it) || lit > (size_t) (op_end - op)) return false;
+
+        memcpy(op, it, lit);
+        op += lit;
+        it += lit;
+
+        if (it == end) break;
+        if (end - it < 2) return false;
+
+        size_t offset = it[0] | (it[1] << 8);
+        it += 2;
+        if (!offset || offset > (size_t) (op - dst)) return false;
+
+        size_t match = token & lz_nibble;
+        if (match == lz_nibble && !lz_read_len(&it, end, &match)) return false;
+        match += lz_min;
+        if (match > (size_t) (op_end - op)) return false;
+
+        // Overlapping matches are how runs are encoded so they must be copied
+        // one byte at a time.
+        const uint8_t *ref = op - offset;
+        if (offset >= match) memcpy(op, ref, match);
+        else for (size_t i = 0; i < match; ++i) op[i] = ref[i];
+        op += match;
+    }
+
+    return op == op_end;
+}
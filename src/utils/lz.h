@@ -0,0 +1,26 @@
+/* lz.h
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#pragma once
+
+#include "common.h"
+
+
+// -----------------------------------------------------------------------------
+// lz
+// -----------------------------------------------------------------------------
+// Block codec from the LZ77 family in the vein of LZ4: favours speed over ratio
+// and doesn't carry the raw length of the block which is left to the caller.
+
+// Upper bound on the compressed length of a block of the given length.
+inline size_t lz_bound(size_t len)
+{
+    return len + (len / 255) + 16;
+}
+
+// Returns the compressed length or 0 if the output doesn't fit within cap.
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap);
+
+// Returns false if src is corrupted or doesn't decode to exactly len bytes.
+bool lz_decompress(const void *src, size_t src_len, void *dst, size_t len);
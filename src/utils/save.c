@@ -256,6 +256,43 @@ bool save_read_vec64(struct save *save, struct vec64 **ret)
 }
 
 
+// -----------------------------------------------------------------------------
+// varint
+// -----------------------------------------------------------------------------
+
+constexpr size_t save_uvar_max = 10;
+
+void save_write_uvar(struct save *save, uint64_t value)
+{
+    uint8_t buffer[save_uvar_max];
+
+    size_t len = 0;
+    for (; value >= 0x80; value >>= 7) buffer[len++] = value | 0x80;
+    buffer[len++] = value;
+
+    save_write(save, buffer, len);
+}
+
+// A truncated or overlong value stops at the end of the buffer or after the
+// maximum number of bytes and leaves it to the magic checks to catch.
+uint64_t save_read_uvar(struct save *save)
+{
+    uint64_t value = 0;
+    const uint8_t *it = save->it;
+    size_t len = legion_min((size_t) (save->end - save->it), save_uvar_max);
+    const uint8_t *end = it + len;
+
+    for (size_t shift = 0; it < end; shift += 7) {
+        uint8_t byte = *it++;
+        value |= ((uint64_t) (byte & 0x7F)) << shift;
+        if (!(byte & 0x80)) break;
+    }
+
+    save->it = (void *) it;
+    return value;
+}
+
+
 // -----------------------------------------------------------------------------
 // prof
 // -----------------------------------------------------------------------------
@@ -52,6 +52,7 @@ enum save_magic : uint8_t
     save_magic_pills   = 0x2C,
     save_magic_steps   = 0x2D,
     save_magic_workers = 0x2E,
+    save_magic_prof    = 0x2F,
 
     save_magic_state_world   = 0x30,
     save_magic_state_chunk   = 0x33,
@@ -89,6 +90,7 @@ struct save *save_mem_new(void);
 void save_mem_free(struct save *);
 
 void save_mem_reset(struct save *);
+void save_mem_seek(struct save *, size_t pos);
 
 
 // -----------------------------------------------------------------------------
@@ -163,6 +165,52 @@ size_t save_read_skip(struct save *, size_t len);
 
 size_t save_copy(struct save *dst, struct save *src, size_t len);
 
+
+// -----------------------------------------------------------------------------
+// varint
+// -----------------------------------------------------------------------------
+// Integers that are usually small are written 7 bits at a time with the high
+// bit of each byte flagging that more bytes follow such that values below 128
+// take a single byte. Signed values are zigzag encoded first to keep small
+// negative values small.
+
+inline uint64_t save_zigzag(int64_t value)
+{
+    return (((uint64_t) value) << 1) ^ ((uint64_t) (value >> 63));
+}
+
+inline int64_t save_unzigzag(uint64_t value)
+{
+    return ((int64_t) (value >> 1)) ^ -((int64_t) (value & 1));
+}
+
+void save_write_uvar(struct save *, uint64_t);
+uint64_t save_read_uvar(struct save *);
+
+inline void save_write_svar(struct save *save, int64_t value)
+{
+    save_write_uvar(save, save_zigzag(value));
+}
+
+inline int64_t save_read_svar(struct save *save)
+{
+    return save_unzigzag(save_read_uvar(save));
+}
+
+// Values of sorted lists are written as the difference with the previous value
+// which keeps clustered values to one or two bytes. prev must start at the same
+// value on both ends, usually 0.
+inline void save_write_delta(struct save *save, uint64_t *prev, uint64_t value)
+{
+    save_write_svar(save, (int64_t) (value - *prev));
+    *prev = value;
+}
+
+inline uint64_t save_read_delta(struct save *save, uint64_t *prev)
+{
+    return *prev += (uint64_t) save_read_svar(save);
+}
+
 void save_write_magic(struct save *, enum save_magic);
 bool save_read_magic(struct save *, enum save_magic exp);
 
@@ -56,6 +56,12 @@ void save_mem_reset(struct save *save)
     save->it = save->base;
 }
 
+void save_mem_seek(struct save *save, size_t pos)
+{
+    assert(pos <= save_cap(save));
+    save->it = save->base + pos;
+}
+
 void save_mem_free(struct save *save)
 {
     if (!save) return;
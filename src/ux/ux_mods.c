@@ -5,6 +5,7 @@
 
 
 static void ux_mods_free(void *);
+static void ux_mods_hide(void *);
 static void ux_mods_update(void *);
 static void ux_mods_event(void *);
 static void ux_mods_render(void *, struct ui_layout *);
@@ -45,7 +46,17 @@ struct ux_mods
     struct ui_button build, publish;
     struct ui_button import, export;
     struct ui_button load, attach, step;
-    struct ui_button reset;
+    struct ui_button reset, prof;
+
+    // Instruction counts of the selected tab accumulated since profiling was
+    // enabled or the tab was selected.
+    struct
+    {
+        bool active;
+        mod_id id;
+        size_t len, cap;
+        uint64_t *counts;
+    } profile;
 
     struct
     {
@@ -90,6 +101,7 @@ void ux_mods_alloc(struct ux_view_state *state)
         .attach = ui_button_new(ui_str_c("attach")),
         .step = ui_button_new(ui_str_c("step")),
         .reset = ui_button_new(ui_str_c("reset")),
+        .prof = ui_button_new(ui_str_c("prof")),
 
         .tabs = { .ui = ui_tabs_new(symbol_cap + 4, true) },
         .request = { .ip = vm_ip_nil },
@@ -97,6 +109,7 @@ void ux_mods_alloc(struct ux_view_state *state)
 
     ux->mode.s.align = ui_align_center;
     ux->attach.s.align = ui_align_center;
+    ux->prof.s.align = ui_align_center;
 
     *state = (struct ux_view_state) {
         .state = ux,
@@ -105,6 +118,7 @@ void ux_mods_alloc(struct ux_view_state *state)
         .panel = ux->panel,
         .fn = {
             .free = ux_mods_free,
+            .hide = ux_mods_hide,
             .update = ux_mods_update,
             .event = ux_mods_event,
             .render = ux_mods_render,
@@ -131,6 +145,8 @@ static void ux_mods_free(void *state)
     ui_button_free(&ux->attach);
     ui_button_free(&ux->step);
     ui_button_free(&ux->reset);
+    ui_button_free(&ux->prof);
+    mem_free(ux->profile.counts);
 
     for (size_t i = 0; i < ux->tabs.cap; ++i) {
         struct ux_mods_tab *tab = ux->tabs.list + i;
@@ -501,6 +517,70 @@ static void ux_mods_update_mod(struct ux_mods *ux)
     ux_mods_request_reset(ux);
 }
 
+static void ux_mods_prof_clear(struct ux_mods *ux)
+{
+    for (size_t i = 0; i < ux->tabs.len; ++i) {
+        struct ux_mods_tab *tab = ux->tabs.list + i;
+        if (!tab->init) continue;
+        ui_asm_prof(&tab->as, nullptr, 0);
+        ui_code_prof(&tab->code, nullptr, 0);
+    }
+}
+
+static void ux_mods_prof_start(struct ux_mods *ux, struct ux_mods_tab *tab)
+{
+    ux_mods_prof_clear(ux);
+
+    if (tab->mod->len > ux->profile.cap) {
+        size_t old = ux->profile.cap;
+        ux->profile.cap = tab->mod->len;
+        ux->profile.counts = mem_array_realloc_t(
+                ux->profile.counts, old, ux->profile.cap);
+    }
+
+    ux->profile.active = true;
+    ux->profile.id = tab->id;
+    ux->profile.len = tab->mod->len;
+    memset(ux->profile.counts, 0, ux->profile.len * sizeof(ux->profile.counts[0]));
+
+    ui_str_setc(&ux->prof.str, "stop");
+    proxy_steps_prof(tab->id);
+}
+
+static void ux_mods_prof_stop(struct ux_mods *ux)
+{
+    if (!ux->profile.active) return;
+
+    ux_mods_prof_clear(ux);
+    ux->profile.active = false;
+    ux->profile.id = 0;
+
+    ui_str_setc(&ux->prof.str, "prof");
+    proxy_steps(cmd_steps_nil);
+}
+
+static void ux_mods_hide(void *state)
+{
+    ux_mods_prof_stop(state);
+}
+
+static void ux_mods_update_prof(struct ux_mods *ux)
+{
+    struct ux_mods_tab *tab = ux_mods_tabs_selected(ux);
+    ux->prof.disabled = !tab || !tab->mod;
+
+    if (!ux->profile.active) return;
+    if (ux->prof.disabled) { ux_mods_prof_stop(ux); return; }
+    if (tab->id != ux->profile.id) ux_mods_prof_start(ux, tab);
+
+    world_ts t = 0;
+    uint64_t *counts = ux->profile.counts;
+    while (proxy_steps_next_prof(&t, ux->profile.id, counts, ux->profile.len));
+
+    ui_asm_prof(&tab->as, counts, ux->profile.len);
+    ui_code_prof(&tab->code, counts, ux->profile.len);
+}
+
 static void ux_mods_update(void *state)
 {
     struct ux_mods *ux = state;
@@ -508,6 +588,7 @@ static void ux_mods_update(void *state)
     ux_mods_update_tree(ux);
     ux_mods_update_mod(ux);
     ux_mods_tabs_update(ux);
+    ux_mods_update_prof(ux);
 
     struct ux_mods_tab *tab = ux_mods_tabs_selected(ux);
     bool disabled =
@@ -701,6 +782,11 @@ static void ux_mods_event(void *state)
     if (ui_button_event(&ux->import)) ux_mods_import(ux, tab);
     if (ui_button_event(&ux->export)) ux_mods_export(ux, tab);
     if (ui_button_event(&ux->reset)) ux_mods_reset(ux, tab);
+
+    if (ui_button_event(&ux->prof)) {
+        if (ux->profile.active) ux_mods_prof_stop(ux);
+        else if (tab->mod) ux_mods_prof_start(ux, tab);
+    }
     
     if (ui_button_event(&ux->load)) {
         vm_word args = tab->id;
@@ -759,6 +845,7 @@ static void ux_mods_render(void *state, struct ui_layout *layout)
 
         ui_layout_sep_col(layout);
         ui_button_render(&ux->reset, layout);
+        ui_button_render(&ux->prof, layout);
 
         ui_layout_sep_col(layout);
         ui_button_render(&ux->load, layout);
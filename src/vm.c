@@ -20,8 +20,11 @@
 #include "utils/config.h"
 
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 
 #include "vm/vm.c"
+#include "vm/jit.c"
 #include "vm/op.c"
 #include "vm/mod.c"
 #include "vm/lisp.c"
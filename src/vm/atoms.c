@@ -28,6 +28,8 @@ struct atoms
     struct htable istr;
     struct htable iword;
     uint64_t inil;
+
+    struct { vm_word id; size_t len; } origin;
 };
 
 constexpr size_t atoms_default_cap = 1 << 10;
@@ -61,6 +63,48 @@ void atoms_free(struct atoms *atoms)
 }
 
 
+// -----------------------------------------------------------------------------
+// fork
+// -----------------------------------------------------------------------------
+// A fork is a private copy that can be used from another thread. The atoms it
+// creates can only be joined back if the origin didn't create any of its own in
+// the meantime which guarantees that both handed out the same ids.
+
+struct atoms *atoms_fork(struct atoms *atoms)
+{
+    const size_t len = atoms->it - atoms->base;
+    const size_t cap = atoms->end - atoms->base;
+
+    struct atoms *fork = mem_alloc_t(fork);
+    *fork = (struct atoms) {
+        .id = atoms->id,
+        .istr = htable_clone(&atoms->istr),
+        .iword = htable_clone(&atoms->iword),
+        .inil = atoms->inil,
+        .origin = { .id = atoms->id, .len = len },
+    };
+
+    fork->base = mem_array_alloc_t(*fork->base, cap);
+    memcpy(fork->base, atoms->base, len * sizeof(*fork->base));
+    fork->it = fork->base + len;
+    fork->end = fork->base + cap;
+
+    return fork;
+}
+
+bool atoms_join(struct atoms *atoms, const struct atoms *fork)
+{
+    const size_t len = atoms->it - atoms->base;
+    if (atoms->id != fork->origin.id || len != fork->origin.len) return false;
+
+    for (const struct atom_data *it = fork->base + len; it < fork->it; ++it)
+        assert(atoms_set(atoms, &it->symbol, it->word));
+    atoms->id = fork->id;
+
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // save/load
 // -----------------------------------------------------------------------------
@@ -136,8 +180,8 @@ void atoms_save_delta(
     uint32_t delta = total - start;
 
     save_write_value(save, atoms->id);
-    save_write_value(save, start);
-    save_write_value(save, delta);
+    save_write_uvar(save, start);
+    save_write_uvar(save, delta);
     save_write(save, atoms->base + start, delta * sizeof(*atoms->it));
 
     save_write_magic(save, save_magic_atoms);
@@ -148,8 +192,8 @@ bool atoms_load_delta(struct atoms *atoms, struct save *save, struct ack *ack)
     if (!save_read_magic(save, save_magic_atoms)) return false;
 
     save_read_into(save, &atoms->id);
-    uint32_t start = save_read_type(save, typeof(start));
-    uint32_t delta = save_read_type(save, typeof(delta));
+    uint32_t start = save_read_uvar(save);
+    uint32_t delta = save_read_uvar(save);
 
     // It's possible for the client to add temporary entries in it's local atoms
     // instance. It's not great but the alternative is to force a round-trip to
@@ -19,6 +19,9 @@ struct atoms;
 struct atoms *atoms_new(void);
 void atoms_free(struct atoms *);
 
+struct atoms *atoms_fork(struct atoms *);
+bool atoms_join(struct atoms *, const struct atoms *fork);
+
 void atoms_save(struct atoms *, struct save *);
 struct atoms *atoms_load(struct save *);
 
@@ -0,0 +1,800 @@
+/* jit.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+// included in vm.c
+
+
+// -----------------------------------------------------------------------------
+// mode
+// -----------------------------------------------------------------------------
+
+void vm_jit_set(enum vm_jit_mode mode)
+{
+    vm_jit_current = vm_jit_supported() ? mode : vm_jit_off;
+}
+
+
+#if defined(__x86_64__) && defined(__linux__)
+
+bool vm_jit_supported(void) { return true; }
+
+
+// -----------------------------------------------------------------------------
+// asm
+// -----------------------------------------------------------------------------
+// Minimal x86-64 encoder which only covers what the templates need. All the
+// memory operands are relative to the vm in rbx or to its stack which is
+// indexed by sp in r12.
+
+enum vm_jit_reg : uint8_t
+{
+    jit_rax = 0, jit_rcx, jit_rdx, jit_rbx, jit_rsp, jit_rbp, jit_rsi, jit_rdi,
+    jit_r8, jit_r9, jit_r10, jit_r11, jit_r12, jit_r13, jit_r14, jit_r15,
+};
+
+enum vm_jit_cc : uint8_t
+{
+    jit_cc_b = 0x2, jit_cc_ae = 0x3, jit_cc_e = 0x4, jit_cc_ne = 0x5,
+    jit_cc_a = 0x7, jit_cc_l = 0xC, jit_cc_ge = 0xD, jit_cc_le = 0xE, jit_cc_g = 0xF,
+};
+
+struct vm_jit_fixup { uint32_t at; vm_ip ip; };
+
+struct vm_jit_asm
+{
+    uint8_t *data;
+    size_t len, cap;
+
+    size_t fixups_len, fixups_cap;
+    struct vm_jit_fixup *fixups;
+
+    size_t epilogue, dispatch;
+};
+
+static void jit_bytes(struct vm_jit_asm *as, const void *data, size_t len)
+{
+    if (as->len + len > as->cap) {
+        size_t old = as->cap;
+        as->cap = as->cap ? as->cap * 2 : sys_page_len;
+        as->data = mem_realloc(as->data, old, as->cap);
+    }
+
+    memcpy(as->data + as->len, data, len);
+    as->len += len;
+}
+
+static void jit_u8(struct vm_jit_asm *as, uint8_t value) { jit_bytes(as, &value, 1); }
+static void jit_u32(struct vm_jit_asm *as, uint32_t value) { jit_bytes(as, &value, 4); }
+static void jit_u64(struct vm_jit_asm *as, uint64_t value) { jit_bytes(as, &value, 8); }
+
+static void jit_rex(
+        struct vm_jit_asm *as, bool w,
+        enum vm_jit_reg reg, enum vm_jit_reg index, enum vm_jit_reg rm)
+{
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (rm >> 3);
+    if (rex != 0x40) jit_u8(as, rex);
+}
+
+// Opcodes above 0xFF are two bytes long with the first byte in the msb.
+static void jit_opcode(struct vm_jit_asm *as, uint16_t op)
+{
+    if (op > 0xFF) jit_u8(as, op >> 8);
+    jit_u8(as, op);
+}
+
+// op reg, rm
+static void jit_rr(
+        struct vm_jit_asm *as, bool w, uint16_t op,
+        enum vm_jit_reg reg, enum vm_jit_reg rm)
+{
+    jit_rex(as, w, reg, 0, rm);
+    jit_opcode(as, op);
+    jit_u8(as, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [rbx + disp]
+static void jit_rm(
+        struct vm_jit_asm *as, bool w, uint16_t op, enum vm_jit_reg reg, size_t disp)
+{
+    jit_rex(as, w, reg, 0, jit_rbx);
+    jit_opcode(as, op);
+    jit_u8(as, 0x80 | ((reg & 7) << 3) | jit_rbx);
+    jit_u32(as, disp);
+}
+
+// op reg, [rbx + r12 * 8 + disp] where disp selects the stack slot.
+static void jit_rs(
+        struct vm_jit_asm *as, bool w, uint16_t op, enum vm_jit_reg reg, int32_t disp)
+{
+    jit_rex(as, w, reg, jit_r12, jit_rbx);
+    jit_opcode(as, op);
+    jit_u8(as, 0x80 | ((reg & 7) << 3) | 0x4);
+    jit_u8(as, 0xC0 | ((jit_r12 & 7) << 3) | jit_rbx);
+    jit_u32(as, disp);
+}
+
+// Returns the position of the rel32 to patch.
+static size_t jit_jcc(struct vm_jit_asm *as, enum vm_jit_cc cc)
+{
+    jit_u8(as, 0x0F);
+    jit_u8(as, 0x80 | cc);
+    jit_u32(as, 0);
+    return as->len - 4;
+}
+
+static size_t jit_jmp(struct vm_jit_asm *as)
+{
+    jit_u8(as, 0xE9);
+    jit_u32(as, 0);
+    return as->len - 4;
+}
+
+static void jit_patch(struct vm_jit_asm *as, size_t at, size_t dst)
+{
+    int32_t rel = dst - (at + 4);
+    memcpy(as->data + at, &rel, sizeof(rel));
+}
+
+static void jit_patch_here(struct vm_jit_asm *as, size_t at)
+{
+    jit_patch(as, at, as->len);
+}
+
+static void jit_fixup(struct vm_jit_asm *as, size_t at, vm_ip ip)
+{
+    if (as->fixups_len == as->fixups_cap) {
+        size_t old = mem_array_len_grow(&as->fixups_cap, 8);
+        as->fixups = mem_array_realloc_t(as->fixups, old, as->fixups_cap);
+    }
+    as->fixups[as->fixups_len++] = (struct vm_jit_fixup) { .at = at, .ip = ip };
+}
+
+static void jit_mov_imm64(struct vm_jit_asm *as, enum vm_jit_reg reg, uint64_t value)
+{
+    jit_rex(as, true, 0, 0, reg);
+    jit_u8(as, 0xB8 | (reg & 7));
+    jit_u64(as, value);
+}
+
+static void jit_mov_imm32(struct vm_jit_asm *as, enum vm_jit_reg reg, uint32_t value)
+{
+    jit_rex(as, false, 0, 0, reg);
+    jit_u8(as, 0xB8 | (reg & 7));
+    jit_u32(as, value);
+}
+
+
+// -----------------------------------------------------------------------------
+// templates
+// -----------------------------------------------------------------------------
+// Register allocation:
+//   rbx: struct vm
+//   r12: vm->sp
+//   r13: cycles consumed which doubles as the tsc delta
+//   r14: cycles available
+//   r15: vm->tsc on entry
+//   rbp: pointer where the remaining cycles are written on exit
+//
+// Every exit goes through the epilogue with the return value in rax where
+// vm_jit_bail indicates that the interpreter must pick up at vm->ip with the
+// remaining cycles.
+
+constexpr uint64_t vm_jit_bail = 1ULL << 32;
+
+#define jit_off(field) offsetof(struct vm, field)
+
+static int32_t jit_slot(int32_t i)
+{
+    return offsetof(struct vm, stack) - (i + 1) * (int32_t) sizeof(vm_word);
+}
+
+static void jit_load(struct vm_jit_asm *as, enum vm_jit_reg reg, int32_t i)
+{
+    jit_rs(as, true, 0x8B, reg, jit_slot(i));
+}
+
+static void jit_store(struct vm_jit_asm *as, int32_t i, enum vm_jit_reg reg)
+{
+    jit_rs(as, true, 0x89, reg, jit_slot(i));
+}
+
+static void jit_sp(struct vm_jit_asm *as, int8_t delta)
+{
+    // add r12d, imm8
+    jit_rr(as, false, 0x83, 0, jit_r12);
+    jit_u8(as, delta);
+}
+
+static void jit_push(struct vm_jit_asm *as, enum vm_jit_reg reg)
+{
+    jit_store(as, -1, reg);
+    jit_sp(as, 1);
+}
+
+static void jit_exit(struct vm_jit_asm *as, vm_ip ip, uint64_t ret)
+{
+    jit_rm(as, false, 0xC7, 0, jit_off(ip));
+    jit_u32(as, ip);
+    jit_mov_imm64(as, jit_rax, ret);
+    jit_patch(as, jit_jmp(as), as->epilogue);
+}
+
+static void jit_flag(struct vm_jit_asm *as, enum flags flag)
+{
+    jit_rm(as, false, 0x80, 1, jit_off(flags));
+    jit_u8(as, flag);
+}
+
+// Equivalent of vm_enter for static targets.
+static void jit_enter(struct vm_jit_asm *as, const struct mod *mod, vm_ip ip)
+{
+    // Can't be entered so let the interpreter fault on it.
+    if (ip >= mod->len || mod->runs[ip].need == UINT8_MAX) {
+        jit_exit(as, ip, vm_jit_bail);
+        return;
+    }
+
+    struct vm_run run = mod->runs[ip];
+    size_t bail[2] = {0};
+
+    // cmp r12d, need
+    jit_rr(as, false, 0x81, 7, jit_r12);
+    jit_u32(as, run.need);
+    bail[0] = jit_jcc(as, jit_cc_b);
+
+    jit_rr(as, false, 0x89, jit_r12, jit_rax);
+    jit_rr(as, false, 0x81, 0, jit_rax);
+    jit_u32(as, run.grow);
+    jit_rm(as, false, 0x0FB6, jit_rcx, jit_off(specs.stack));
+    jit_rr(as, false, 0x39, jit_rcx, jit_rax);
+    bail[1] = jit_jcc(as, jit_cc_a);
+
+    jit_fixup(as, jit_jmp(as), ip);
+
+    jit_patch_here(as, bail[0]);
+    jit_patch_here(as, bail[1]);
+    jit_exit(as, ip, vm_jit_bail);
+}
+
+static void jit_prologue(struct vm_jit_asm *as)
+{
+    static const uint8_t push[] = {
+        0x55,       // push rbp
+        0x53,       // push rbx
+        0x41, 0x54, // push r12
+        0x41, 0x55, // push r13
+        0x41, 0x56, // push r14
+        0x41, 0x57, // push r15
+    };
+    jit_bytes(as, push, sizeof(push));
+
+    jit_rr(as, true, 0x89, jit_rdi, jit_rbx);
+    jit_rr(as, true, 0x89, jit_rdx, jit_rbp);
+
+    static const uint8_t cycles[] = { 0x4C, 0x8B, 0x32 }; // mov r14, [rdx]
+    jit_bytes(as, cycles, sizeof(cycles));
+
+    jit_rr(as, false, 0x31, jit_r13, jit_r13);
+    jit_rm(as, false, 0x0FB6, jit_r12, jit_off(sp));
+    jit_rm(as, false, 0x8B, jit_r15, jit_off(tsc));
+
+    jit_rr(as, false, 0xFF, 4, jit_rsi); // jmp rsi
+}
+
+static void jit_epilogue(struct vm_jit_asm *as)
+{
+    as->epilogue = as->len;
+
+    jit_rm(as, false, 0x88, jit_r12, jit_off(sp));
+    jit_rr(as, false, 0x01, jit_r13, jit_r15);
+    jit_rm(as, false, 0x89, jit_r15, jit_off(tsc));
+    jit_rr(as, true, 0x29, jit_r13, jit_r14);
+
+    static const uint8_t ret[] = {
+        0x4C, 0x89, 0x75, 0x00, // mov [rbp], r14
+        0x41, 0x5F,             // pop r15
+        0x41, 0x5E,             // pop r14
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5B,                   // pop rbx
+        0x5D,                   // pop rbp
+        0xC3,                   // ret
+    };
+    jit_bytes(as, ret, sizeof(ret));
+}
+
+// Equivalent of vm_enter for dynamic targets where the ip is in ecx.
+static void jit_dispatch(
+        struct vm_jit_asm *as, const struct mod *mod, const uint32_t *offs)
+{
+    as->dispatch = as->len;
+    size_t bail[3] = {0};
+
+    jit_rr(as, false, 0x81, 7, jit_rcx);
+    jit_u32(as, mod->len);
+    bail[0] = jit_jcc(as, jit_cc_ae);
+
+    jit_mov_imm64(as, jit_rax, (uintptr_t) mod->runs);
+
+    static const uint8_t need[] = { 0x0F, 0xB6, 0x14, 0x48 }; // movzx edx, [rax+rcx*2]
+    jit_bytes(as, need, sizeof(need));
+    jit_rr(as, false, 0x39, jit_rdx, jit_r12);
+    bail[1] = jit_jcc(as, jit_cc_b);
+
+    static const uint8_t grow[] = { 0x0F, 0xB6, 0x54, 0x48, 0x01 }; // movzx edx, [rax+rcx*2+1]
+    jit_bytes(as, grow, sizeof(grow));
+    jit_rr(as, false, 0x01, jit_r12, jit_rdx);
+    jit_rm(as, false, 0x0FB6, jit_rax, jit_off(specs.stack));
+    jit_rr(as, false, 0x39, jit_rax, jit_rdx);
+    bail[2] = jit_jcc(as, jit_cc_a);
+
+    jit_mov_imm64(as, jit_rax, (uintptr_t) offs);
+
+    static const uint8_t off[] = { 0x8B, 0x04, 0x88 }; // mov eax, [rax+rcx*4]
+    jit_bytes(as, off, sizeof(off));
+
+    static const uint8_t base[] = { 0x48, 0x8D, 0x15 }; // lea rdx, [rip + rel32]
+    jit_bytes(as, base, sizeof(base));
+    jit_u32(as, -(int32_t) (as->len + 4));
+
+    jit_rr(as, true, 0x01, jit_rdx, jit_rax);
+    jit_rr(as, false, 0xFF, 4, jit_rax); // jmp rax
+
+    for (size_t i = 0; i < array_len(bail); ++i) jit_patch_here(as, bail[i]);
+    jit_rm(as, false, 0x89, jit_rcx, jit_off(ip));
+    jit_mov_imm64(as, jit_rax, vm_jit_bail);
+    jit_patch(as, jit_jmp(as), as->epilogue);
+}
+
+static void jit_cycles(struct vm_jit_asm *as, vm_ip ip)
+{
+    jit_rr(as, true, 0x39, jit_r14, jit_r13);
+    size_t body = jit_jcc(as, jit_cc_b);
+    jit_exit(as, ip, 0);
+    jit_patch_here(as, body);
+    jit_rr(as, true, 0xFF, 0, jit_r13);
+}
+
+static void jit_binop(struct vm_jit_asm *as, uint16_t op)
+{
+    jit_load(as, jit_rax, 1);
+    jit_load(as, jit_rcx, 0);
+    jit_rr(as, true, op, jit_rcx, jit_rax);
+    jit_store(as, 1, jit_rax);
+    jit_sp(as, -1);
+}
+
+// Produces the boolean of rax and rcx which are both reduced to 0 or 1.
+static void jit_logic(struct vm_jit_asm *as, uint16_t op)
+{
+    jit_load(as, jit_rax, 1);
+    jit_load(as, jit_rcx, 0);
+    jit_rr(as, true, 0x85, jit_rax, jit_rax);
+    jit_rr(as, false, 0x0F90 | jit_cc_ne, 0, jit_rax);
+    jit_rr(as, true, 0x85, jit_rcx, jit_rcx);
+    jit_rr(as, false, 0x0F90 | jit_cc_ne, 0, jit_rcx);
+    jit_rr(as, false, op, jit_rcx, jit_rax);
+    jit_rr(as, false, 0x0FB6, jit_rax, jit_rax);
+    jit_store(as, 1, jit_rax);
+    jit_sp(as, -1);
+}
+
+// The vm compares the top of the stack against the value below it.
+static void jit_compare(struct vm_jit_asm *as, enum vm_jit_cc cc)
+{
+    jit_load(as, jit_rax, 0);
+    jit_load(as, jit_rcx, 1);
+    jit_rr(as, true, 0x39, jit_rcx, jit_rax);
+    jit_rr(as, false, 0x0F90 | cc, 0, jit_rax);
+    jit_rr(as, false, 0x0FB6, jit_rax, jit_rax);
+    jit_store(as, 1, jit_rax);
+    jit_sp(as, -1);
+}
+
+static void jit_div(struct vm_jit_asm *as, vm_ip next, enum vm_jit_reg result)
+{
+    jit_load(as, jit_rcx, 0);
+    jit_rr(as, true, 0x85, jit_rcx, jit_rcx);
+    size_t body = jit_jcc(as, jit_cc_ne);
+    jit_flag(as, FLAG_FAULT_MATH);
+    jit_exit(as, next, (mod_id) VM_FAULT);
+    jit_patch_here(as, body);
+
+    jit_load(as, jit_rax, 1);
+    jit_u8(as, 0x48); jit_u8(as, 0x99); // cqo
+    jit_rr(as, true, 0xF7, 7, jit_rcx);  // idiv rcx
+    jit_store(as, 1, result);
+    jit_sp(as, -1);
+}
+
+static void jit_insn(
+        struct vm_jit_asm *as, const struct mod *mod,
+        enum vm_op op, vm_word arg, vm_ip ip, vm_ip next)
+{
+    switch (op)
+    {
+    // Rare enough to not be worth a template so we hand the instruction off to
+    // the interpreter before it's executed.
+    case vm_op_lmul:
+    case vm_op_load:
+    case vm_op_reset: { jit_exit(as, ip, vm_jit_bail); return; }
+    case vm_op_call: {
+        if (((uint64_t) arg) >> 32) { jit_exit(as, ip, vm_jit_bail); return; }
+        break;
+    }
+    default: { break; }
+    }
+
+    jit_cycles(as, ip);
+
+    switch (op)
+    {
+
+    case vm_op_noop: { break; }
+
+    case vm_op_push: {
+        jit_mov_imm64(as, jit_rax, arg);
+        jit_push(as, jit_rax);
+        break;
+    }
+    case vm_op_pushr: {
+        jit_rm(as, true, 0x8B, jit_rax, jit_off(regs) + arg * sizeof(vm_word));
+        jit_push(as, jit_rax);
+        break;
+    }
+    case vm_op_pushf: {
+        jit_rm(as, false, 0x0FB6, jit_rax, jit_off(flags));
+        jit_push(as, jit_rax);
+        break;
+    }
+    case vm_op_pop: { jit_sp(as, -1); break; }
+    case vm_op_popr: {
+        jit_load(as, jit_rax, 0);
+        jit_rm(as, true, 0x89, jit_rax, jit_off(regs) + arg * sizeof(vm_word));
+        jit_sp(as, -1);
+        break;
+    }
+    case vm_op_dupe: {
+        jit_load(as, jit_rax, 0);
+        jit_push(as, jit_rax);
+        break;
+    }
+    case vm_op_swap: {
+        jit_load(as, jit_rax, 0);
+        jit_load(as, jit_rcx, 1);
+        jit_store(as, 0, jit_rcx);
+        jit_store(as, 1, jit_rax);
+        break;
+    }
+    case vm_op_arg0:
+    case vm_op_arg1:
+    case vm_op_arg2:
+    case vm_op_arg3: {
+        size_t reg = jit_off(regs) + (op - vm_op_arg0) * sizeof(vm_word);
+        jit_load(as, jit_rax, arg);
+        jit_rm(as, true, 0x8B, jit_rcx, reg);
+        jit_store(as, arg, jit_rcx);
+        jit_rm(as, true, 0x89, jit_rax, reg);
+        break;
+    }
+
+    case vm_op_not: {
+        jit_load(as, jit_rax, 0);
+        jit_rr(as, true, 0x85, jit_rax, jit_rax);
+        jit_rr(as, false, 0x0F90 | jit_cc_e, 0, jit_rax);
+        jit_rr(as, false, 0x0FB6, jit_rax, jit_rax);
+        jit_store(as, 0, jit_rax);
+        break;
+    }
+    case vm_op_and: { jit_logic(as, 0x21); break; }
+    case vm_op_or: { jit_logic(as, 0x09); break; }
+    case vm_op_xor: { jit_logic(as, 0x31); break; }
+
+    case vm_op_bnot: {
+        jit_load(as, jit_rax, 0);
+        jit_rr(as, true, 0xF7, 2, jit_rax);
+        jit_store(as, 0, jit_rax);
+        break;
+    }
+    case vm_op_band: { jit_binop(as, 0x21); break; }
+    case vm_op_bor: { jit_binop(as, 0x09); break; }
+    case vm_op_bxor: { jit_binop(as, 0x31); break; }
+    case vm_op_bsl:
+    case vm_op_bsr: {
+        jit_load(as, jit_rax, 1);
+        jit_load(as, jit_rcx, 0);
+        jit_rr(as, true, 0xD3, op == vm_op_bsl ? 4 : 5, jit_rax);
+        jit_store(as, 1, jit_rax);
+        jit_sp(as, -1);
+        break;
+    }
+
+    case vm_op_neg: {
+        jit_load(as, jit_rax, 0);
+        jit_rr(as, true, 0xF7, 3, jit_rax);
+        jit_store(as, 0, jit_rax);
+        break;
+    }
+    case vm_op_add: { jit_binop(as, 0x01); break; }
+    case vm_op_sub: { jit_binop(as, 0x29); break; }
+    case vm_op_mul: {
+        jit_load(as, jit_rax, 1);
+        jit_load(as, jit_rcx, 0);
+        jit_rr(as, true, 0x0FAF, jit_rax, jit_rcx);
+        jit_store(as, 1, jit_rax);
+        jit_sp(as, -1);
+        break;
+    }
+    case vm_op_div: { jit_div(as, next, jit_rax); break; }
+    case vm_op_rem: { jit_div(as, next, jit_rdx); break; }
+
+    case vm_op_eq: { jit_compare(as, jit_cc_e); break; }
+    case vm_op_ne: { jit_compare(as, jit_cc_ne); break; }
+    case vm_op_gt: { jit_compare(as, jit_cc_g); break; }
+    case vm_op_ge: { jit_compare(as, jit_cc_ge); break; }
+    case vm_op_lt: { jit_compare(as, jit_cc_l); break; }
+    case vm_op_le: { jit_compare(as, jit_cc_le); break; }
+    case vm_op_cmp: {
+        jit_load(as, jit_rax, 0);
+        jit_load(as, jit_rcx, 1);
+        jit_rr(as, true, 0x29, jit_rcx, jit_rax);
+        jit_store(as, 1, jit_rax);
+        jit_sp(as, -1);
+        break;
+    }
+
+    case vm_op_ret: {
+        jit_load(as, jit_rax, 0);
+        jit_sp(as, -1);
+
+        // sbp
+        jit_rr(as, true, 0x89, jit_rax, jit_rcx);
+        jit_rr(as, true, 0xC1, 5, jit_rcx); jit_u8(as, 24);
+        jit_rm(as, false, 0x88, jit_rcx, jit_off(sbp));
+
+        // ip
+        jit_rr(as, true, 0x89, jit_rax, jit_rcx);
+        jit_rr(as, false, 0x81, 4, jit_rcx); jit_u32(as, (1U << 24) - 1);
+
+        // mod
+        jit_rr(as, true, 0xC1, 5, jit_rax); jit_u8(as, 32);
+        size_t local = jit_jcc(as, jit_cc_e);
+        jit_rm(as, false, 0x89, jit_rcx, jit_off(ip));
+        jit_patch(as, jit_jmp(as), as->epilogue);
+
+        jit_patch_here(as, local);
+        jit_patch(as, jit_jmp(as), as->dispatch);
+        return;
+    }
+    case vm_op_call: {
+        jit_rm(as, false, 0x0FB6, jit_rax, jit_off(sbp));
+        jit_rr(as, false, 0xC1, 4, jit_rax); jit_u8(as, 24);
+        jit_rr(as, false, 0x81, 1, jit_rax); jit_u32(as, next);
+        jit_push(as, jit_rax);
+        jit_rm(as, false, 0x88, jit_r12, jit_off(sbp));
+        jit_enter(as, mod, arg);
+        return;
+    }
+    case vm_op_jmp: { jit_enter(as, mod, arg); return; }
+    case vm_op_jz:
+    case vm_op_jnz: {
+        jit_load(as, jit_rax, 0);
+        jit_sp(as, -1);
+        jit_rr(as, true, 0x85, jit_rax, jit_rax);
+        size_t skip = jit_jcc(as, op == vm_op_jz ? jit_cc_ne : jit_cc_e);
+        jit_enter(as, mod, arg);
+        jit_patch_here(as, skip);
+        jit_enter(as, mod, next);
+        return;
+    }
+
+    case vm_op_yield: { jit_exit(as, next, 0); return; }
+    case vm_op_tsc: {
+        jit_rr(as, false, 0x89, jit_r15, jit_rax);
+        jit_rr(as, false, 0x01, jit_r13, jit_rax);
+        jit_push(as, jit_rax);
+        break;
+    }
+    case vm_op_fault: {
+        jit_flag(as, FLAG_FAULT_USER);
+        jit_exit(as, next, (mod_id) VM_FAULT);
+        return;
+    }
+
+    case vm_op_io: {
+        jit_rm(as, false, 0xC6, 0, jit_off(io));
+        jit_u8(as, arg);
+        jit_flag(as, FLAG_IO);
+        jit_exit(as, next, 0);
+        return;
+    }
+    case vm_op_ios: {
+        jit_load(as, jit_rax, 0);
+        jit_sp(as, -1);
+        jit_rm(as, false, 0x88, jit_rax, jit_off(io));
+        jit_flag(as, FLAG_IO);
+        jit_exit(as, next, 0);
+        return;
+    }
+
+    case vm_op_pack: {
+        jit_load(as, jit_rax, 0);
+        jit_rr(as, true, 0xC1, 4, jit_rax); jit_u8(as, 32);
+        jit_load(as, jit_rcx, 1);
+        jit_rr(as, false, 0x89, jit_rcx, jit_rcx);
+        jit_rr(as, true, 0x09, jit_rcx, jit_rax);
+        jit_store(as, 1, jit_rax);
+        jit_sp(as, -1);
+        break;
+    }
+    case vm_op_unpack: {
+        jit_load(as, jit_rax, 0);
+        jit_rr(as, true, 0x89, jit_rax, jit_rcx);
+        jit_rr(as, true, 0xC1, 5, jit_rcx); jit_u8(as, 32);
+        jit_store(as, 0, jit_rcx);
+        jit_rr(as, false, 0x89, jit_rax, jit_rax);
+        jit_push(as, jit_rax);
+        break;
+    }
+
+    default: { assert(false); }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// compile
+// -----------------------------------------------------------------------------
+
+typedef uint64_t (*vm_jit_fn) (struct vm *, const void *entry, size_t *cycles);
+
+struct vm_jit
+{
+    size_t len;
+    uint8_t *code;
+
+    // Offset of the native code for every ip of the mod or UINT32_MAX if not
+    // on an instruction boundary.
+    uint32_t offs[];
+};
+
+// Published in place of the native code if it couldn't be generated such that
+// we don't try again on every exec.
+static const uintptr_t vm_jit_failed = 1;
+
+static void vm_jit_free(uintptr_t ptr)
+{
+    if (ptr <= vm_jit_failed) return;
+
+    struct vm_jit *jit = (void *) ptr;
+    munmap(jit->code, jit->len);
+    mem_free(jit);
+}
+
+static struct vm_jit *vm_jit_compile(const struct mod *mod)
+{
+    struct vm_jit *jit = mem_alloc(sizeof(*jit) + mod->len * sizeof(jit->offs[0]));
+    memset(jit->offs, 0xFF, mod->len * sizeof(jit->offs[0]));
+
+    struct vm_jit_asm as = {0};
+    jit_prologue(&as);
+    jit_epilogue(&as);
+    jit_dispatch(&as, mod, jit->offs);
+
+    for (vm_ip ip = 0; ip < mod->len;) {
+        enum vm_op op = mod->code[ip];
+        vm_ip next = ip + vm_decode_len(op);
+
+        jit->offs[ip] = as.len;
+        jit_insn(&as, mod, op, vm_decode_arg(op, mod->code + ip + sizeof(op)), ip, next);
+
+        ip = next;
+    }
+
+    for (size_t i = 0; i < as.fixups_len; ++i) {
+        const struct vm_jit_fixup *fixup = as.fixups + i;
+        jit_patch(&as, fixup->at, jit->offs[fixup->ip]);
+    }
+
+    jit->len = (as.len + sys_page_len - 1) & ~(sys_page_len - 1);
+    jit->code = mmap(0, jit->len, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if (jit->code == MAP_FAILED) {
+        errf_errno("unable to mmap jit for mod '%x'", mod->id);
+        jit->code = nullptr;
+    }
+    else {
+        memcpy(jit->code, as.data, as.len);
+        if (mprotect(jit->code, jit->len, PROT_READ | PROT_EXEC) == -1) {
+            errf_errno("unable to mprotect jit for mod '%x'", mod->id);
+            munmap(jit->code, jit->len);
+            jit->code = nullptr;
+        }
+    }
+
+    mem_free(as.data);
+    mem_free(as.fixups);
+
+    if (!jit->code) { mem_free(jit); return nullptr; }
+    return jit;
+}
+
+static const struct vm_jit *vm_jit(const struct mod *mod)
+{
+    legion_atomic uintptr_t *slot = (legion_atomic uintptr_t *) &mod->jit;
+
+    uintptr_t old = atomic_load_explicit(slot, memory_order_acquire);
+    if (likely(old)) return old == vm_jit_failed ? nullptr : (void *) old;
+
+    struct vm_jit *jit = vm_jit_compile(mod);
+    uintptr_t new = jit ? (uintptr_t) jit : vm_jit_failed;
+
+    if (atomic_compare_exchange_strong_explicit(
+                    slot, &old, new,
+                    memory_order_acq_rel, memory_order_acquire))
+        return jit;
+
+    vm_jit_free(new);
+    return old == vm_jit_failed ? nullptr : (void *) old;
+}
+
+static mod_id vm_jit_run(struct vm *vm, const struct mod *mod)
+{
+    const struct vm_jit *jit = vm_jit(mod);
+    if (!jit) return vm_exec_verified_n(vm, mod, vm->specs.speed);
+
+    size_t cycles = vm->specs.speed;
+    const void *entry = jit->code + jit->offs[vm->ip];
+    uint64_t ret = ((vm_jit_fn) jit->code)(vm, entry, &cycles);
+
+    if (unlikely(ret & vm_jit_bail)) return vm_exec_checked_n(vm, mod, cycles);
+    return ret;
+}
+
+#else // x86-64 linux
+
+bool vm_jit_supported(void) { return false; }
+
+static void vm_jit_free(uintptr_t) {}
+
+static mod_id vm_jit_run(struct vm *vm, const struct mod *mod)
+{
+    return vm_exec_verified_n(vm, mod, vm->specs.speed);
+}
+
+#endif // x86-64 linux
+
+
+// -----------------------------------------------------------------------------
+// exec
+// -----------------------------------------------------------------------------
+
+// Runs the interpreter on a copy of the vm and aborts on the first divergence
+// which includes the dead values above the top of the stack.
+static mod_id vm_jit_exec_diff(struct vm *vm, const struct mod *mod)
+{
+    uint8_t buffer[sizeof(*vm) + UINT8_MAX * sizeof(vm_word)] legion_aligned(8);
+    struct vm *ref = (void *) buffer;
+
+    size_t len = sizeof(*vm) + vm->specs.stack * sizeof(vm->stack[0]);
+    memcpy(ref, vm, len);
+    mod_id ref_ret = vm_exec_verified_n(ref, mod, ref->specs.speed);
+
+    mod_id ret = vm_jit_run(vm, mod);
+    if (likely(ret == ref_ret && !memcmp(vm, ref, len))) return ret;
+
+    char str[sys_page_len] = {0};
+    vm_dbg(ref, str, sizeof(str));
+    errf("<interpreter>\n%sret:   %x", str, ref_ret);
+    vm_dbg(vm, str, sizeof(str));
+    errf("<jit>\n%sret:   %x", str, ret);
+    failf("jit diverged from the interpreter on mod '%x'", mod->id);
+}
+
+static mod_id vm_jit_exec(struct vm *vm, const struct mod *mod)
+{
+    if (vm_jit_current == vm_jit_diff) return vm_jit_exec_diff(vm, mod);
+    return vm_jit_run(vm, mod);
+}
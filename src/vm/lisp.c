@@ -24,6 +24,7 @@ struct lisp
     struct atoms *atoms;
 
     size_t depth;
+    bool asm_ops; // disables lisp_opt
 
     struct token token;
     struct tokenizer in;
@@ -652,6 +653,7 @@ static void lisp_register_fn(uint64_t key, lisp_fn fn)
 #include "vm/lisp_eval.c"
 #include "vm/lisp_fn.c"
 #include "vm/lisp_asm.c"
+#include "vm/lisp_opt.c"
 
 
 // -----------------------------------------------------------------------------
@@ -665,6 +667,11 @@ void mod_compiler_init(void)
     lisp_eval_register();
 }
 
+void mod_compiler_opt(bool enable)
+{
+    lisp_opt_enabled = enable;
+}
+
 struct mod *mod_compile(
         mod_maj mod_maj,
         const char *src, size_t len,
@@ -686,6 +693,7 @@ struct mod *mod_compile(
     }
 
     lisp_label_unknown(&lisp);
+    lisp_opt(&lisp);
 
     struct mod *mod = mod_alloc(
             lisp.in.base, lisp.in.end - lisp.in.base,
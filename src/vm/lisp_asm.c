@@ -147,6 +147,8 @@ static void lisp_asm_mod(struct lisp *lisp, enum vm_op op)
 
 static void lisp_asm_label(struct lisp *lisp)
 {
+    lisp->asm_ops = true;
+
     struct token *token = lisp_expect(lisp, token_symbol);
     if (!token) { lisp_goto_close(lisp, true); return; }
 
@@ -158,6 +160,7 @@ static void lisp_asm_label(struct lisp *lisp)
 #define vm_op_fn(op, str, arg)                          \
     static void lisp_asm_ ## str(struct lisp *lisp)     \
     {                                                   \
+        lisp->asm_ops = true;                           \
         lisp_asm_ ## arg(lisp, op);                     \
     }
 #include "vm/opx.h"
@@ -0,0 +1,550 @@
+/* lisp_opt.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+// included in lisp.c
+
+
+// -----------------------------------------------------------------------------
+// opt
+// -----------------------------------------------------------------------------
+// Optimization pass over the emitted bytecode which is run once the whole mod
+// has been compiled. The code is decoded into a list of instructions where
+// jumps point to other instructions such that instructions can be freely
+// removed and the code is then re-encoded while patching all the ips held by
+// the jumps, the calls, the pubs and the index.
+//
+// Mods using raw asm ops are left untouched as they can jump to hardcoded ips
+// and don't follow the stack discipline of the compiler.
+
+static bool lisp_opt_enabled = true;
+
+struct lisp_opt_insn
+{
+    enum vm_op op;
+    bool live, label, jmp;
+    uint8_t regs_in, regs_out;
+
+    vm_ip ip, at;
+
+    // Index of the target instruction if jmp is set.
+    vm_word arg;
+};
+
+struct lisp_opt
+{
+    size_t len;
+    struct lisp_opt_insn *insns;
+
+    // old ip -> new ip for every instruction boundary including the end.
+    vm_ip *map;
+};
+
+constexpr uint8_t lisp_opt_regs_all = 0xF;
+
+static uint32_t lisp_opt_live(struct lisp_opt *opt, uint32_t i)
+{
+    while (i < opt->len && !opt->insns[i].live) i++;
+    return i;
+}
+
+static uint32_t lisp_opt_next(struct lisp_opt *opt, uint32_t i)
+{
+    return lisp_opt_live(opt, i + 1);
+}
+
+static uint32_t lisp_opt_index(struct lisp_opt *opt, vm_ip ip)
+{
+    uint32_t lo = 0, hi = opt->len;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (opt->insns[mid].ip < ip) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static bool lisp_opt_is_jmp(enum vm_op op)
+{
+    return op == vm_op_jmp || op == vm_op_jz || op == vm_op_jnz;
+}
+
+
+// -----------------------------------------------------------------------------
+// decode
+// -----------------------------------------------------------------------------
+
+static bool lisp_opt_decode(struct lisp *lisp, struct lisp_opt *opt)
+{
+    const uint8_t *code = lisp->out.base;
+    const vm_ip len = lisp_ip(lisp);
+
+    for (vm_ip ip = 0; ip < len; ip += vm_decode_len(code[ip])) opt->len++;
+    opt->insns = mem_array_alloc_t(*opt->insns, opt->len);
+
+    vm_ip ip = 0;
+    for (size_t i = 0; i < opt->len; ++i) {
+        enum vm_op op = code[ip];
+        opt->insns[i] = (struct lisp_opt_insn) {
+            .op = op,
+            .live = true,
+            .ip = ip,
+            .arg = vm_decode_arg(op, code + ip + sizeof(op)),
+        };
+        ip += vm_decode_len(op);
+    }
+    if (ip != len) return false;
+
+    for (size_t i = 0; i < opt->len; ++i) {
+        struct lisp_opt_insn *insn = opt->insns + i;
+
+        if (lisp_opt_is_jmp(insn->op)) insn->jmp = true;
+        else if (insn->op == vm_op_call && !(insn->arg >> 32)) insn->jmp = true;
+        if (!insn->jmp) continue;
+
+        vm_ip dst = insn->arg;
+        uint32_t index = lisp_opt_index(opt, dst);
+        if (index == opt->len || opt->insns[index].ip != dst) return false;
+        insn->arg = index;
+    }
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// labels
+// -----------------------------------------------------------------------------
+
+// Labels are instructions that can be reached from anything other then the
+// previous instruction and can therefore never be folded into it.
+static void lisp_opt_labels(struct lisp *lisp, struct lisp_opt *opt)
+{
+    for (size_t i = 0; i < opt->len; ++i) opt->insns[i].label = false;
+
+    void label(uint32_t i)
+    {
+        i = lisp_opt_live(opt, i);
+        if (i < opt->len) opt->insns[i].label = true;
+    }
+
+    label(0);
+
+    for (size_t i = 0; i < lisp->pub.len; ++i)
+        label(lisp_opt_index(opt, lisp->pub.list[i].ip));
+
+    for (uint32_t i = lisp_opt_live(opt, 0); i < opt->len; i = lisp_opt_next(opt, i)) {
+        const struct lisp_opt_insn *insn = opt->insns + i;
+        if (insn->jmp) label(insn->arg);
+        if (insn->op == vm_op_call) label(i + 1); // return point
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// jmp
+// -----------------------------------------------------------------------------
+
+// Jumps that land on an unconditional jump are redirected to its target.
+static bool lisp_opt_thread(struct lisp_opt *opt)
+{
+    bool changed = false;
+
+    for (uint32_t i = lisp_opt_live(opt, 0); i < opt->len; i = lisp_opt_next(opt, i)) {
+        struct lisp_opt_insn *insn = opt->insns + i;
+        if (!insn->jmp) continue;
+
+        uint32_t dst = lisp_opt_live(opt, insn->arg);
+        if (lisp_opt_is_jmp(insn->op)) {
+            for (size_t hops = 0; hops < opt->len; ++hops) {
+                if (dst == opt->len || opt->insns[dst].op != vm_op_jmp) break;
+                dst = lisp_opt_live(opt, opt->insns[dst].arg);
+            }
+        }
+
+        if (dst == insn->arg) continue;
+        insn->arg = dst;
+        changed = true;
+    }
+
+    return changed;
+}
+
+// Anything that can't be reached from the start of the mod, from its pubs or
+// by falling through is removed. Faults are assumed to fall through as their
+// vm could be resumed.
+static bool lisp_opt_reach(struct lisp *lisp, struct lisp_opt *opt)
+{
+    bool *seen = mem_array_alloc_t(*seen, opt->len);
+
+    size_t len = 0;
+    uint32_t *stack = mem_array_alloc_t(*stack, opt->len * 2 + lisp->pub.len + 1);
+
+    stack[len++] = lisp_opt_live(opt, 0);
+    for (size_t i = 0; i < lisp->pub.len; ++i)
+        stack[len++] = lisp_opt_live(opt, lisp_opt_index(opt, lisp->pub.list[i].ip));
+
+    while (len) {
+        uint32_t i = stack[--len];
+        if (i >= opt->len || seen[i]) continue;
+        seen[i] = true;
+
+        const struct lisp_opt_insn *insn = opt->insns + i;
+        if (insn->jmp) stack[len++] = lisp_opt_live(opt, insn->arg);
+
+        switch (insn->op) {
+        case vm_op_jmp: case vm_op_ret: case vm_op_reset: case vm_op_load: break;
+        default: { stack[len++] = lisp_opt_next(opt, i); }
+        }
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < opt->len; ++i) {
+        if (!opt->insns[i].live || seen[i]) continue;
+        opt->insns[i].live = false;
+        changed = true;
+    }
+
+    mem_free(stack);
+    mem_free(seen);
+    return changed;
+}
+
+
+// -----------------------------------------------------------------------------
+// regs
+// -----------------------------------------------------------------------------
+
+// Backward liveness analysis of the registers which is used to replace stores
+// to registers that are never read with a pop. Anything that leaves the mod is
+// assumed to read all the registers.
+static bool lisp_opt_regs(struct lisp_opt *opt)
+{
+    uint8_t regs_in(uint32_t i)
+    {
+        return i < opt->len ? opt->insns[i].regs_in : lisp_opt_regs_all;
+    }
+
+    for (size_t i = 0; i < opt->len; ++i)
+        opt->insns[i].regs_in = opt->insns[i].regs_out = 0;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t i = opt->len; i > 0; --i) {
+            struct lisp_opt_insn *insn = opt->insns + (i - 1);
+            if (!insn->live) continue;
+
+            uint8_t out = 0, use = 0, def = 0;
+            switch (insn->op)
+            {
+            case vm_op_ret:
+            case vm_op_load:
+            case vm_op_fault: { out = lisp_opt_regs_all; break; }
+            case vm_op_reset: { out = 0; break; }
+            case vm_op_jmp: { out = regs_in(lisp_opt_live(opt, insn->arg)); break; }
+            default: { out = regs_in(lisp_opt_next(opt, i - 1)); break; }
+            }
+
+            switch (insn->op)
+            {
+            case vm_op_jz:
+            case vm_op_jnz: { out |= regs_in(lisp_opt_live(opt, insn->arg)); break; }
+            case vm_op_pushr: { use = 1 << insn->arg; break; }
+            case vm_op_popr: { def = 1 << insn->arg; break; }
+            case vm_op_arg0: { use = 1 << 0; break; }
+            case vm_op_arg1: { use = 1 << 1; break; }
+            case vm_op_arg2: { use = 1 << 2; break; }
+            case vm_op_arg3: { use = 1 << 3; break; }
+            case vm_op_call: { use = lisp_opt_regs_all; break; }
+            default: { break; }
+            }
+
+            uint8_t in = use | (out & ~def);
+            insn->regs_out = out;
+            if (in == insn->regs_in) continue;
+
+            insn->regs_in = in;
+            changed = true;
+        }
+    }
+
+    bool dead = false;
+    for (size_t i = 0; i < opt->len; ++i) {
+        struct lisp_opt_insn *insn = opt->insns + i;
+        if (!insn->live || insn->op != vm_op_popr) continue;
+        if (insn->regs_out & (1 << insn->arg)) continue;
+
+        insn->op = vm_op_pop;
+        insn->arg = 0;
+        dead = true;
+    }
+
+    return dead;
+}
+
+
+// -----------------------------------------------------------------------------
+// fold
+// -----------------------------------------------------------------------------
+
+static bool lisp_opt_fold_1(enum vm_op op, vm_word val, vm_word *ret)
+{
+    switch (op)
+    {
+    case vm_op_not: { *ret = !val; return true; }
+    case vm_op_bnot: { *ret = ~val; return true; }
+    case vm_op_neg: { *ret = -((uint64_t) val); return true; }
+    default: { return false; }
+    }
+}
+
+// Mirrors the semantics of the interpreter where s0 is the top of the stack.
+// Anything that could fault or that relies on undefined behaviour is left for
+// the vm to deal with.
+static bool lisp_opt_fold_2(enum vm_op op, vm_word s1, vm_word s0, vm_word *ret)
+{
+    switch (op)
+    {
+    case vm_op_and: { *ret = s1 && s0; return true; }
+    case vm_op_or: { *ret = s1 || s0; return true; }
+    case vm_op_xor: { *ret = (s0 || s1) && !(s0 && s1); return true; }
+
+    case vm_op_band: { *ret = s1 & s0; return true; }
+    case vm_op_bor: { *ret = s1 | s0; return true; }
+    case vm_op_bxor: { *ret = s1 ^ s0; return true; }
+    case vm_op_bsl: {
+        if ((uint64_t) s0 >= 64) return false;
+        *ret = ((uint64_t) s1) << s0;
+        return true;
+    }
+    case vm_op_bsr: {
+        if ((uint64_t) s0 >= 64) return false;
+        *ret = ((uint64_t) s1) >> s0;
+        return true;
+    }
+
+    case vm_op_add: { *ret = ((uint64_t) s1) + ((uint64_t) s0); return true; }
+    case vm_op_sub: { *ret = ((uint64_t) s1) - ((uint64_t) s0); return true; }
+    case vm_op_mul: { *ret = ((uint64_t) s1) * ((uint64_t) s0); return true; }
+    case vm_op_div: {
+        if (!s0 || s0 == -1) return false;
+        *ret = s1 / s0;
+        return true;
+    }
+    case vm_op_rem: {
+        if (!s0 || s0 == -1) return false;
+        *ret = s1 % s0;
+        return true;
+    }
+
+    case vm_op_eq: { *ret = s0 == s1; return true; }
+    case vm_op_ne: { *ret = s0 != s1; return true; }
+    case vm_op_gt: { *ret = s0 > s1; return true; }
+    case vm_op_ge: { *ret = s0 >= s1; return true; }
+    case vm_op_lt: { *ret = s0 < s1; return true; }
+    case vm_op_le: { *ret = s0 <= s1; return true; }
+    case vm_op_cmp: { *ret = ((uint64_t) s0) - ((uint64_t) s1); return true; }
+
+    case vm_op_pack: { *ret = vm_pack(s0, s1); return true; }
+
+    default: { return false; }
+    }
+}
+
+// Returns the op to use if the two operands are swapped or vm_op_noop if none.
+static enum vm_op lisp_opt_mirror(enum vm_op op)
+{
+    switch (op)
+    {
+    case vm_op_and: case vm_op_or: case vm_op_xor:
+    case vm_op_band: case vm_op_bor: case vm_op_bxor:
+    case vm_op_add: case vm_op_mul:
+    case vm_op_eq: case vm_op_ne: { return op; }
+
+    case vm_op_gt: { return vm_op_lt; }
+    case vm_op_ge: { return vm_op_le; }
+    case vm_op_lt: { return vm_op_gt; }
+    case vm_op_le: { return vm_op_ge; }
+
+    default: { return vm_op_noop; }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// peephole
+// -----------------------------------------------------------------------------
+
+// b and c are only provided if they directly follow a and are not labels.
+static bool lisp_opt_window(
+        struct lisp_opt *opt, uint32_t index,
+        struct lisp_opt_insn *a,
+        struct lisp_opt_insn *b,
+        struct lisp_opt_insn *c)
+{
+    vm_word val = 0;
+
+    void kill(struct lisp_opt_insn *insn) { insn->live = false; }
+
+    if (a->op == vm_op_noop) { kill(a); return true; }
+
+    if (lisp_opt_is_jmp(a->op) &&
+            lisp_opt_live(opt, a->arg) == lisp_opt_next(opt, index))
+    {
+        if (a->op == vm_op_jmp) kill(a);
+        else { a->op = vm_op_pop; a->jmp = false; a->arg = 0; }
+        return true;
+    }
+
+    if (!b) return false;
+
+    if (b->op == vm_op_pop) {
+        switch (a->op) {
+        case vm_op_push: case vm_op_pushr: case vm_op_dupe: {
+            kill(a); kill(b);
+            return true;
+        }
+        default: { break; }
+        }
+    }
+
+    if (a->op == vm_op_swap) {
+        if (b->op == vm_op_swap) { kill(a); kill(b); return true; }
+
+        enum vm_op mirror = lisp_opt_mirror(b->op);
+        if (mirror != vm_op_noop) { b->op = mirror; kill(a); return true; }
+    }
+
+    if (a->op != vm_op_push) return false;
+
+    if (lisp_opt_fold_1(b->op, a->arg, &val)) {
+        a->arg = val;
+        kill(b);
+        return true;
+    }
+
+    if (b->op == vm_op_jz || b->op == vm_op_jnz) {
+        bool taken = !a->arg == (b->op == vm_op_jz);
+        if (!taken) kill(a);
+        else { a->op = vm_op_jmp; a->jmp = true; a->arg = b->arg; }
+        kill(b);
+        return true;
+    }
+
+    if (!c || b->op != vm_op_push) return false;
+
+    if (c->op == vm_op_swap) {
+        legion_swap(&a->arg, &b->arg);
+        kill(c);
+        return true;
+    }
+
+    if (lisp_opt_fold_2(c->op, a->arg, b->arg, &val)) {
+        a->arg = val;
+        kill(b); kill(c);
+        return true;
+    }
+
+    return false;
+}
+
+static bool lisp_opt_peephole(struct lisp *lisp, struct lisp_opt *opt)
+{
+    bool changed = false;
+    lisp_opt_labels(lisp, opt);
+
+    struct lisp_opt_insn *follow(uint32_t i)
+    {
+        if (i >= opt->len || opt->insns[i].label) return NULL;
+        return opt->insns + i;
+    }
+
+    for (uint32_t i = lisp_opt_live(opt, 0); i < opt->len; i = lisp_opt_next(opt, i)) {
+        uint32_t j = lisp_opt_next(opt, i);
+        struct lisp_opt_insn *b = follow(j);
+        struct lisp_opt_insn *c = b ? follow(lisp_opt_next(opt, j)) : NULL;
+        changed = lisp_opt_window(opt, i, opt->insns + i, b, c) || changed;
+    }
+
+    return changed;
+}
+
+
+// -----------------------------------------------------------------------------
+// encode
+// -----------------------------------------------------------------------------
+
+static void lisp_opt_encode(struct lisp *lisp, struct lisp_opt *opt)
+{
+    const vm_ip old = lisp_ip(lisp);
+
+    vm_ip ip = 0;
+    for (size_t i = 0; i < opt->len; ++i) {
+        struct lisp_opt_insn *insn = opt->insns + i;
+        insn->at = ip;
+        if (insn->live) ip += vm_decode_len(insn->op);
+    }
+
+    opt->map = mem_array_alloc_t(*opt->map, old + 1);
+    for (size_t i = 0; i < opt->len; ++i)
+        opt->map[opt->insns[i].ip] = opt->insns[i].at;
+    opt->map[old] = ip;
+
+    // Instructions only ever move towards the start of the code so it can be
+    // re-encoded in place.
+    lisp->out.it = lisp->out.base;
+    for (size_t i = 0; i < opt->len; ++i) {
+        const struct lisp_opt_insn *insn = opt->insns + i;
+        if (!insn->live) continue;
+
+        vm_word arg = insn->arg;
+        if (insn->jmp) arg = opt->insns[lisp_opt_live(opt, arg)].at;
+
+        lisp_write_op(lisp, insn->op);
+        lisp_write(lisp, &arg, vm_op_arg_bytes(vm_op_arg(insn->op)));
+    }
+    assert(lisp_ip(lisp) == ip);
+
+    for (size_t i = 0; i < lisp->pub.len; ++i)
+        lisp->pub.list[i].ip = opt->map[lisp->pub.list[i].ip];
+
+    // Removed instructions can leave multiple entries on the same ip in which
+    // case the last one wins as in lisp_index_at.
+    size_t len = 0;
+    for (size_t i = 0; i < lisp->index.len; ++i) {
+        struct mod_index index = lisp->index.list[i];
+        index.ip = opt->map[index.ip];
+
+        if (len && lisp->index.list[len - 1].ip == index.ip) len--;
+        lisp->index.list[len++] = index;
+    }
+    lisp->index.len = len;
+}
+
+
+// -----------------------------------------------------------------------------
+// pass
+// -----------------------------------------------------------------------------
+
+static void lisp_opt(struct lisp *lisp)
+{
+    if (!lisp_opt_enabled || lisp->asm_ops || lisp->err.len) return;
+
+    struct lisp_opt opt = {0};
+    if (!lisp_opt_decode(lisp, &opt)) { mem_free(opt.insns); return; }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        changed = lisp_opt_thread(&opt) || changed;
+        changed = lisp_opt_peephole(lisp, &opt) || changed;
+        changed = lisp_opt_reach(lisp, &opt) || changed;
+        changed = lisp_opt_regs(&opt) || changed;
+    }
+
+    lisp_opt_encode(lisp, &opt);
+
+    mem_free(opt.map);
+    mem_free(opt.insns);
+}
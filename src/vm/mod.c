@@ -8,6 +8,18 @@
 // mod
 // -----------------------------------------------------------------------------
 
+// Mods that pass verification can skip most of the checks in vm_exec.
+static void mod_verify(struct mod *mod)
+{
+    mod->runs = NULL;
+    if (!mod->len) return;
+
+    struct vm_run *runs = mem_array_alloc_t(*runs, mod->len);
+    if (vm_verify(mod->code, mod->len, runs)) { mod->runs = runs; return; }
+
+    mem_free(runs);
+}
+
 struct mod *mod_alloc(
         const char *src, size_t src_len,
         const uint8_t *code, size_t code_len,
@@ -50,11 +62,16 @@ struct mod *mod_alloc(
     while (len && !mod->src[len - 1]) len--;
     mod->src_hash = hash_str(mod->src, len);
 
+    mod_verify(mod);
     return mod;
 }
 
 void mod_free(const struct mod *mod)
 {
+    if (!mod) return;
+    mem_free(mod->runs);
+    mem_free((void *) atomic_load_explicit(&mod->decoded, memory_order_relaxed));
+    vm_jit_free(atomic_load_explicit(&mod->jit, memory_order_relaxed));
     mem_free((void *) mod);
 }
 
@@ -120,8 +137,9 @@ struct mod *mod_load(struct save *save)
     assert(it == ((void *) mod) + total_bytes);
 
     mod->src_hash = src_hash;
+    mod_verify(mod);
 
-    if (!save_read_magic(save, save_magic_mod)) { mem_free(mod); return NULL; }
+    if (!save_read_magic(save, save_magic_mod)) { mod_free(mod); return NULL; }
     return mod;
 }
 
@@ -301,6 +319,7 @@ size_t mod_hexdump(const struct mod *mod, char *dst, size_t len)
 struct mods
 {
     mod_maj maj;
+    bool fork;
     struct htable by_maj;
     struct htable by_mod;
 };
@@ -329,13 +348,47 @@ void mods_free(struct mods *mods)
         mem_free((struct mod_entry *) it->value);
     htable_reset(&mods->by_maj);
 
-    for (it = htable_next(&mods->by_mod, NULL); it; it = htable_next(&mods->by_mod, it))
-        mod_free((struct mod *) it->value);
+    // Forks only borrow their mods.
+    if (!mods->fork) {
+        for (it = htable_next(&mods->by_mod, NULL); it; it = htable_next(&mods->by_mod, it))
+            mod_free((struct mod *) it->value);
+    }
     htable_reset(&mods->by_mod);
 
     mem_free(mods);
 }
 
+// Forks are read-only copies that can be used to compile mods from another
+// thread. Mods are immutable and only freed alongside their mods so the fork
+// only borrows them and must be freed before its origin.
+struct mods *mods_fork(const struct mods *mods)
+{
+    struct mods *fork = mods_new();
+    fork->maj = mods->maj;
+    fork->fork = true;
+    fork->by_mod = htable_clone(&mods->by_mod);
+
+    htable_reserve(&fork->by_maj, mods->by_maj.len);
+    const struct htable_bucket *it = htable_next(&mods->by_maj, NULL);
+    for (; it; it = htable_next(&mods->by_maj, it)) {
+        struct mod_entry *entry = mem_alloc_t(entry);
+        *entry = *((const struct mod_entry *) it->value);
+
+        struct htable_ret ret = htable_put(&fork->by_maj, entry->maj, (uintptr_t) entry);
+        assert(ret.ok);
+    }
+
+    return fork;
+}
+
+// Registering or setting a mod always adds a new mod id so comparing the counts
+// is enough to tell whether anything changed since the fork.
+bool mods_fork_current(const struct mods *mods, const struct mods *fork)
+{
+    assert(fork->fork);
+    return mods->maj == fork->maj && mods->by_mod.len == fork->by_mod.len;
+}
+
 void mods_save(const struct mods *mods, struct save *save)
 {
     save_write_magic(save, save_magic_mods);
@@ -568,11 +621,11 @@ void mods_list_save(struct mods *mods, struct save *save, user_set filter)
     struct mods_list *list = mods_list(mods, filter);
     save_write_magic(save, save_magic_mods);
 
-    save_write_value(save, list->len);
+    save_write_uvar(save, list->len);
     for (size_t i = 0; i < list->len; ++i) {
         const struct mods_item *it = list->items + i;
-        save_write_value(save, it->maj);
-        save_write_value(save, it->ver);
+        save_write_uvar(save, it->maj);
+        save_write_uvar(save, it->ver);
         symbol_save(&it->str, save);
     }
 
@@ -585,7 +638,7 @@ bool mods_list_load_into(struct mods_list **ret, struct save *save)
     struct mods_list *list = *ret;
     if (!save_read_magic(save, save_magic_mods)) return false;
 
-    size_t len = save_read_type(save, typeof(list->len));
+    size_t len = save_read_uvar(save);
     if (!list || len > list->cap) {
         list = mem_array_realloc_t(list, list->cap, len);
         list->cap = len;
@@ -595,8 +648,8 @@ bool mods_list_load_into(struct mods_list **ret, struct save *save)
 
     for (size_t i = 0; i < list->len; ++i) {
         struct mods_item *it = list->items + i;
-        save_read_into(save, &it->maj);
-        save_read_into(save, &it->ver);
+        it->maj = save_read_uvar(save);
+        it->ver = save_read_uvar(save);
         if (!symbol_load(&it->str, save)) return false;
     }
 
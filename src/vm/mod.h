@@ -59,10 +59,22 @@ struct legion_packed mod
     struct mod_pub *pub;
     struct mod_err *errs;
     struct mod_index *index;
+
+    // Derived on creation and not saved. NULL if the code failed vm_verify.
+    struct vm_run *runs;
+
+    // struct vm_decoded built on first execution when runs is set.
+    legion_atomic uintptr_t decoded;
+
+    // struct vm_jit built on first execution when the jit is enabled.
+    legion_atomic uintptr_t jit;
+
+    legion_pad(40);
+
     uint8_t code[];
 };
 
-static_assert(sizeof(struct mod) == sys_cache_line_len);
+static_assert(sizeof(struct mod) == 2 * sys_cache_line_len);
 
 
 struct mod *mod_alloc(
@@ -87,6 +99,7 @@ inline size_t mod_len(const struct mod *mod)
 }
 
 void mod_compiler_init(void);
+void mod_compiler_opt(bool enable);
 struct mod *mod_compile(
         mod_maj, const char *src, size_t len, struct mods *, struct atoms *);
 
@@ -107,6 +120,9 @@ vm_ip mod_byte(const struct mod *, uint32_t pos);
 struct mods *mods_new(void);
 void mods_free(struct mods *);
 
+struct mods *mods_fork(const struct mods *);
+bool mods_fork_current(const struct mods *, const struct mods *fork);
+
 struct mods *mods_load(struct save *);
 void mods_save(const struct mods *, struct save *);
 
@@ -129,81 +129,310 @@ size_t vm_dbg(struct vm *vm, char *dst, size_t len)
 
 
 // -----------------------------------------------------------------------------
-// step
+// verify
 // -----------------------------------------------------------------------------
 
+struct vm_verify_op
+{
+    uint8_t len;
+    uint8_t need;
+    int8_t delta;
+    bool end;
+    vm_ip jmp;
+};
+
+// Stack effects must mirror the accesses made in execx.h. Ops that end a run
+// are the ones that can transfer control or leave vm_exec.
+static bool vm_verify_decode(
+        const uint8_t *code, size_t len, vm_ip ip, struct vm_verify_op *op)
+{
+    *op = (struct vm_verify_op) { .jmp = vm_ip_nil };
+
+    enum vm_op type = code[ip];
+    switch (type)
+    {
+    case vm_op_noop: { break; }
+
+    case vm_op_push:
+    case vm_op_pushr:
+    case vm_op_pushf:
+    case vm_op_tsc: { op->delta = 1; break; }
+
+    case vm_op_pop:
+    case vm_op_popr: { op->need = 1; op->delta = -1; break; }
+
+    case vm_op_dupe:
+    case vm_op_unpack: { op->need = 1; op->delta = 1; break; }
+
+    case vm_op_swap:
+    case vm_op_lmul: { op->need = 2; break; }
+
+    case vm_op_arg0:
+    case vm_op_arg1:
+    case vm_op_arg2:
+    case vm_op_arg3: { break; }
+
+    case vm_op_not:
+    case vm_op_bnot:
+    case vm_op_neg: { op->need = 1; break; }
+
+    case vm_op_and:
+    case vm_op_or:
+    case vm_op_xor:
+    case vm_op_band:
+    case vm_op_bor:
+    case vm_op_bxor:
+    case vm_op_bsl:
+    case vm_op_bsr:
+    case vm_op_add:
+    case vm_op_sub:
+    case vm_op_mul:
+    case vm_op_div:
+    case vm_op_rem:
+    case vm_op_eq:
+    case vm_op_ne:
+    case vm_op_gt:
+    case vm_op_ge:
+    case vm_op_lt:
+    case vm_op_le:
+    case vm_op_cmp:
+    case vm_op_pack: { op->need = 2; op->delta = -1; break; }
+
+    case vm_op_ret:
+    case vm_op_load:
+    case vm_op_ios: { op->need = 1; op->delta = -1; op->end = true; break; }
+
+    case vm_op_jz:
+    case vm_op_jnz: { op->need = 1; op->delta = -1; op->end = true; break; }
+    case vm_op_call: { op->delta = 1; op->end = true; break; }
+
+    case vm_op_jmp:
+    case vm_op_reset:
+    case vm_op_yield:
+    case vm_op_fault:
+    case vm_op_io: { op->end = true; break; }
+
+    default: { return false; }
+    }
 
-mod_id vm_exec(struct vm *vm, const struct mod *mod)
+    op->len = sizeof(type) + vm_op_arg_bytes(vm_op_arg(type));
+    if (ip + op->len > len) return false;
+    const uint8_t *arg = code + ip + sizeof(type);
+
+    switch (type)
+    {
+    case vm_op_pushr:
+    case vm_op_popr: {
+        if (*((const vm_reg *) arg) >= array_len(((struct vm *) NULL)->regs))
+            return false;
+        break;
+    }
+
+    case vm_op_arg0:
+    case vm_op_arg1:
+    case vm_op_arg2:
+    case vm_op_arg3: { op->need = *arg; break; }
+
+    case vm_op_jmp:
+    case vm_op_jz:
+    case vm_op_jnz: { op->jmp = *((const vm_ip *) arg); break; }
+
+    case vm_op_call: {
+        mod_id mod = 0; vm_ip ip = 0;
+        vm_unpack(*((const vm_word *) arg), &mod, &ip);
+        if (!mod) op->jmp = ip;
+        break;
+    }
+
+    default: { break; }
+    }
+
+    return true;
+}
+
+static const struct vm_run vm_run_nil = { .need = UINT8_MAX, .grow = UINT8_MAX };
+
+static struct vm_run vm_verify_run(
+        const struct vm_verify_op *op, struct vm_run next)
 {
-    if (unlikely(vm_fault(vm))) return VM_FAULT;
-    if (unlikely(vm->flags & FLAG_SUSPENDED)) return 0;
+    int need = op->need;
+    int grow = legion_max(op->delta, 0);
 
-    if (unlikely(vm->ip >= mod->len)) {
-        vm->flags |= FLAG_FAULT_CODE;
-        return VM_FAULT;
+    if (!op->end) {
+        if (next.need == UINT8_MAX) return vm_run_nil;
+        need = legion_max(need, next.need - op->delta);
+        grow = legion_max(grow, next.grow + op->delta);
+    }
+
+    if (need >= UINT8_MAX || grow >= UINT8_MAX) return vm_run_nil;
+    return (struct vm_run) { .need = need, .grow = grow };
+}
+
+bool vm_verify(const uint8_t *code, size_t len, struct vm_run *runs)
+{
+    for (size_t i = 0; i < len; ++i) runs[i] = vm_run_nil;
+    if (!len) return false;
+
+    bool ok = false;
+    struct vm_verify_op op = {0};
+
+    size_t ips_len = 0;
+    vm_ip *ips = mem_array_alloc_t(*ips, len);
+
+    for (vm_ip ip = 0; ip < len; ip += op.len) {
+        if (!vm_verify_decode(code, len, ip, &op)) goto done;
+        runs[ip] = (struct vm_run) {0};
+        ips[ips_len++] = ip;
+    }
+
+    // Falling off the end of the code would require a bounds check on every
+    // fetch.
+    if (!op.end) goto done;
+
+    for (size_t i = 0; i < ips_len; ++i) {
+        (void) vm_verify_decode(code, len, ips[i], &op);
+        if (op.jmp == vm_ip_nil) continue;
+        if (op.jmp >= len || runs[op.jmp].need == UINT8_MAX) goto done;
+    }
+
+    struct vm_run next = vm_run_nil;
+    for (size_t i = ips_len; i > 0; --i) {
+        (void) vm_verify_decode(code, len, ips[i - 1], &op);
+        next = runs[ips[i - 1]] = vm_verify_run(&op, next);
+    }
+
+    ok = true;
+
+  done:
+    mem_free(ips);
+    if (!ok) for (size_t i = 0; i < len; ++i) runs[i] = vm_run_nil;
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// ngrams
+// -----------------------------------------------------------------------------
+
+size_t vm_ngrams(const uint8_t *code, size_t len, size_t n, struct htable *counts)
+{
+    assert(n && n <= vm_ngrams_cap);
+
+    size_t ops = 0;
+    size_t straight = 0;
+    uint64_t window = 0;
+    struct vm_verify_op op = {0};
+
+    for (vm_ip ip = 0; ip < len; ip += op.len, ops++) {
+        if (!vm_verify_decode(code, len, ip, &op)) break;
+
+        window = (window << 8) | code[ip];
+
+        if (straight + 1 >= n) {
+            uint64_t key = (1ULL << 32) | (window & ((1ULL << (n * 8)) - 1));
+            struct htable_ret ret = htable_get(counts, key);
+            if (ret.ok) htable_xchg(counts, key, ret.value + 1);
+            else htable_put(counts, key, 1);
+        }
+
+        straight = op.end ? 0 : straight + 1;
     }
 
-    static const void *opcodes[] = {
-        [vm_op_noop]   = &&op_noop,
-
-        [vm_op_push]   = &&op_push,
-        [vm_op_pushr]  = &&op_pushr,
-        [vm_op_pushf]  = &&op_pushf,
-        [vm_op_pop]    = &&op_pop,
-        [vm_op_popr]   = &&op_popr,
-        [vm_op_dupe]   = &&op_dupe,
-        [vm_op_swap]   = &&op_swap,
-        [vm_op_arg0]   = &&op_arg0,
-        [vm_op_arg1]   = &&op_arg1,
-        [vm_op_arg2]   = &&op_arg2,
-        [vm_op_arg3]   = &&op_arg3,
-
-        [vm_op_not]    = &&op_not,
-        [vm_op_and]    = &&op_and,
-        [vm_op_or]     = &&op_or,
-        [vm_op_xor]    = &&op_xor,
-        [vm_op_bnot]   = &&op_bnot,
-        [vm_op_band]   = &&op_band,
-        [vm_op_bor]    = &&op_bor,
-        [vm_op_bxor]   = &&op_bxor,
-        [vm_op_bsl]    = &&op_bsl,
-        [vm_op_bsr]    = &&op_bsr,
-
-        [vm_op_neg]    = &&op_neg,
-        [vm_op_add]    = &&op_add,
-        [vm_op_sub]    = &&op_sub,
-        [vm_op_mul]    = &&op_mul,
-        [vm_op_lmul]   = &&op_lmul,
-        [vm_op_div]    = &&op_div,
-        [vm_op_rem]    = &&op_rem,
-
-        [vm_op_eq]     = &&op_eq,
-        [vm_op_ne]     = &&op_ne,
-        [vm_op_gt]     = &&op_gt,
-        [vm_op_ge]     = &&op_ge,
-        [vm_op_lt]     = &&op_lt,
-        [vm_op_le]     = &&op_le,
-        [vm_op_cmp]    = &&op_cmp,
-
-        [vm_op_ret]    = &&op_ret,
-        [vm_op_call]   = &&op_call,
-        [vm_op_load]   = &&op_load,
-        [vm_op_jmp]    = &&op_jmp,
-        [vm_op_jz]     = &&op_jz,
-        [vm_op_jnz]    = &&op_jnz,
-
-        [vm_op_yield]  = &&op_yield,
-        [vm_op_reset]  = &&op_reset,
-        [vm_op_tsc]    = &&op_tsc,
-        [vm_op_fault]  = &&op_fault,
-
-        [vm_op_io]     = &&op_io,
-        [vm_op_ios]    = &&op_ios,
-
-        [vm_op_pack]   = &&op_pack,
-        [vm_op_unpack] = &&op_unpack,
-    };
+    return ops;
+}
+
+
+// -----------------------------------------------------------------------------
+// decode
+// -----------------------------------------------------------------------------
+
+static size_t vm_decode_len(enum vm_op op)
+{
+    return sizeof(op) + vm_op_arg_bytes(vm_op_arg(op));
+}
+
+static vm_word vm_decode_arg(enum vm_op op, const uint8_t *arg)
+{
+    switch (vm_op_arg(op))
+    {
+    case vm_op_arg_nil: { return 0; }
+    case vm_op_arg_reg: { return *((const vm_reg *) arg); }
+    case vm_op_arg_len: { return *((const uint8_t *) arg); }
+    case vm_op_arg_off: { return *((const vm_ip *) arg); }
+    case vm_op_arg_lit:
+    case vm_op_arg_mod: { return *((const vm_word *) arg); }
+    default: { assert(false); }
+    }
+}
+
+// Built on the first execution of a verified mod and shared by all the vms
+// running it. Multiple shards can race to build it so the loser just throws
+// its copy away.
+static const struct vm_decoded *vm_decode(
+        const struct mod *mod, const void *const *labels)
+{
+    legion_atomic uintptr_t *slot = (legion_atomic uintptr_t *) &mod->decoded;
+    uintptr_t old = atomic_load_explicit(slot, memory_order_acquire);
+    if (likely(old)) return (const struct vm_decoded *) old;
+
+    assert(mod->runs);
+
+    size_t len = 0;
+    for (vm_ip ip = 0; ip < mod->len; ip += vm_decode_len(mod->code[ip])) len++;
+
+    struct vm_decoded *decoded = mem_alloc(
+            sizeof(*decoded) +
+            len * sizeof(decoded->insns[0]) +
+            mod->len * sizeof(decoded->map[0]));
+    decoded->len = len;
+    decoded->map = (void *) (decoded->insns + len);
+    memset(decoded->map, 0xFF, mod->len * sizeof(decoded->map[0]));
+
+    vm_ip ip = 0;
+    for (size_t i = 0; i < len; ++i) {
+        enum vm_op op = mod->code[ip];
+        vm_ip next = ip + vm_decode_len(op);
+
+        decoded->insns[i] = (struct vm_insn) {
+            .label = labels[op],
+            .arg = vm_decode_arg(op, mod->code + ip + sizeof(op)),
+            .ip = ip,
+            .next = next,
+        };
+        decoded->map[ip] = i;
+
+        ip = next;
+    }
+
+    if (atomic_compare_exchange_strong_explicit(
+                    slot, &old, (uintptr_t) decoded,
+                    memory_order_acq_rel, memory_order_acquire))
+        return decoded;
+
+    mem_free(decoded);
+    return (const struct vm_decoded *) old;
+}
+
+
+// -----------------------------------------------------------------------------
+// exec
+// -----------------------------------------------------------------------------
+// The checked variant must handle any bytes thrown at it while the verified
+// variant relies on vm_verify to drop the per-instruction checks and runs off
+// the pre-decoded form of the mod. Stack bounds are instead checked once
+// whenever we enter a run through vm_enter. If that check fails we hand off to
+// the checked variant which will fault at the exact same instruction.
+
+static bool vm_run_check(const struct vm *vm, struct vm_run run)
+{
+    return vm->sp >= run.need && vm->sp + run.grow <= vm->specs.stack;
+}
+
+static thread_local struct vm_prof *vm_prof_bound = nullptr;
+static uint64_t *vm_prof_counts(const struct mod *);
 
+#define vm_exec_fn vm_exec_checked_n
+#define vm_exec_verified false
 
 #define vm_code(arg_type_t)                                             \
     ({                                                                  \
@@ -253,203 +482,221 @@ mod_id vm_exec(struct vm *vm, const struct mod *mod)
         vm->stack[vm->sp++] = (val);                    \
     })
 
+#define vm_enter() do {} while (false)
 
-    size_t cycles = vm->specs.speed;
-    for (size_t i = 0; i < cycles; ++i) {
-        vm->tsc++;
+#include "vm/execx.h"
 
-        uint8_t opcode = vm_code(uint8_t);
-        const void *label = opcodes[opcode];
-        if (unlikely(!label)) { vm->flags |= FLAG_FAULT_CODE; return 0; }
-        goto *label;
 
-      op_noop: { continue; }
+#define vm_exec_fn vm_exec_verified_n
+#define vm_exec_verified true
 
-      op_push: { vm_push(vm_code(vm_word)); continue; }
-      op_pushr: { vm_push(vm->regs[vm_code(vm_reg)]); continue; }
-      op_pushf: { vm_push(vm->flags); continue; }
+#define vm_code(arg_type_t) ((arg_type_t) insn->arg)
 
-      op_pop: { vm_pop(); continue; }
-      op_popr: { vm->regs[vm_code(vm_reg)] = vm_pop(); continue; }
+#define vm_stack(i) vm->stack[vm->sp - 1 - (i)]
+#define vm_ensure(c) do {} while (false)
+#define vm_peek() vm_stack(0)
+#define vm_pop() ({ vm->stack[--vm->sp]; })
+#define vm_push(val)                            \
+    ({                                          \
+        vm_word val_ = (val);                   \
+        vm->stack[vm->sp++] = val_;             \
+    })
 
-      op_dupe: { vm_push(vm_peek()); continue; }
-      op_swap: {
-            vm_ensure(2);
-            vm_word tmp = vm_stack(0);
-            vm_stack(0) = vm_stack(1);
-            vm_stack(1) = tmp;
-            continue;
-        }
+#define vm_enter()                                                      \
+    do {                                                                \
+        if (unlikely(vm->ip >= mod->len ||                              \
+                        !vm_run_check(vm, mod->runs[vm->ip])))          \
+            return vm_exec_checked_n(vm, mod, cycles - i - 1);          \
+        pc = decoded->insns + decoded->map[vm->ip];                     \
+    } while (false)
 
-      op_arg0: {
-            uint8_t sp = vm_code(vm_reg);
-            vm_ensure(sp);
-            vm_word tmp = vm_stack(sp);
-            vm_stack(sp) = vm->regs[0];
-            vm->regs[0] = tmp;
-            continue;
-        }
-      op_arg1: {
-            uint8_t sp = vm_code(vm_reg);
-            vm_ensure(sp);
-            vm_word tmp = vm_stack(sp);
-            vm_stack(sp) = vm->regs[1];
-            vm->regs[1] = tmp;
-            continue;
-        }
-      op_arg2: {
-            uint8_t sp = vm_code(vm_reg);
-            vm_ensure(sp);
-            vm_word tmp = vm_stack(sp);
-            vm_stack(sp) = vm->regs[2];
-            vm->regs[2] = tmp;
-            continue;
-        }
-      op_arg3: {
-            uint8_t sp = vm_code(vm_reg);
-            vm_ensure(sp);
-            vm_word tmp = vm_stack(sp);
-            vm_stack(sp) = vm->regs[3];
-            vm->regs[3] = tmp;
-            continue;
-        }
+#include "vm/execx.h"
 
-      op_not: { vm_ensure(1); vm_stack(0) = !vm_stack(0); continue; }
-      op_and: {
-            vm_ensure(2);
-            vm_stack(1) = vm_stack(1) && vm_stack(0);
-            vm_pop();
-            continue;
-        }
-      op_or: {
-            vm_ensure(2);
-            vm_stack(1) = vm_stack(1) || vm_stack(0);
-            vm_pop();
-            continue;
-        }
-      op_xor: {
-            vm_ensure(2);
-            uint64_t x = vm_stack(0);
-            uint64_t y = vm_stack(1);
-            vm_stack(1) = (x || y) && !(x && y);
-            vm_pop();
-            continue;
-        }
 
-      op_bnot: { vm_ensure(1); vm_stack(0) = ~vm_stack(0); continue; }
-      op_band: { vm_ensure(2); vm_stack(1) &= vm_stack(0); vm_pop(); continue; }
-      op_bor: { vm_ensure(2); vm_stack(1) |= vm_stack(0); vm_pop(); continue; }
-      op_bxor: { vm_ensure(2); vm_stack(1) ^= vm_stack(0); vm_pop(); continue; }
-      op_bsl: {
-            vm_ensure(2);
-            vm_stack(1) = ((uint64_t)vm_stack(1)) << vm_stack(0);
-            vm_pop();
-            continue;
-        }
-      op_bsr: {
-            vm_ensure(2);
-            vm_stack(1) = ((uint64_t)vm_stack(1)) >> vm_stack(0);
-            vm_pop();
-            continue;
-        }
+mod_id vm_exec_checked(struct vm *vm, const struct mod *mod)
+{
+    if (unlikely(vm_fault(vm))) return VM_FAULT;
+    if (unlikely(vm->flags & FLAG_SUSPENDED)) return 0;
 
-      op_neg: { vm_ensure(1); vm_stack(0) = -vm_stack(0); continue; }
-      op_add: { vm_ensure(2); vm_stack(1) += vm_stack(0); vm_pop(); continue; }
-      op_sub: { vm_ensure(2); vm_stack(1) -= vm_stack(0); vm_pop(); continue; }
-      op_mul: { vm_ensure(2); vm_stack(1) *= vm_stack(0); vm_pop(); continue; }
-      op_lmul: {
-            vm_ensure(2);
-            int128_t ret = ((int128_t) vm_stack(0)) * ((int128_t) vm_stack(1));
-            vm_stack(0) = ret >> 64;
-            vm_stack(1) = ret & ((((__int128) 1) << 64) - 1);
-            continue;
-        }
-      op_div: {
-            vm_ensure(2);
-            int64_t div = vm_stack(0);
-            if (unlikely(!div)) { vm->flags |= FLAG_FAULT_MATH; return VM_FAULT; }
-            vm_stack(1) /= div;
-            vm_pop();
-            continue;
-        }
-      op_rem: {
-            vm_ensure(2);
-            int64_t div = vm_stack(0);
-            if (unlikely(!div)) { vm->flags |= FLAG_FAULT_MATH; return VM_FAULT; }
-            vm_stack(1) %= div;
-            vm_pop();
-            continue;
-        }
+    if (unlikely(vm->ip >= mod->len)) {
+        vm->flags |= FLAG_FAULT_CODE;
+        return VM_FAULT;
+    }
 
-      op_eq:  { vm_ensure(2); vm_stack(1) = vm_stack(0) == vm_stack(1); vm_pop(); continue; }
-      op_ne:  { vm_ensure(2); vm_stack(1) = vm_stack(0) != vm_stack(1); vm_pop(); continue; }
-      op_gt:  { vm_ensure(2); vm_stack(1) = vm_stack(0) >  vm_stack(1); vm_pop(); continue; }
-      op_ge:  { vm_ensure(2); vm_stack(1) = vm_stack(0) >= vm_stack(1); vm_pop(); continue; }
-      op_lt:  { vm_ensure(2); vm_stack(1) = vm_stack(0) <  vm_stack(1); vm_pop(); continue; }
-      op_le:  { vm_ensure(2); vm_stack(1) = vm_stack(0) <= vm_stack(1); vm_pop(); continue; }
-      op_cmp: { vm_ensure(2); vm_stack(1) = vm_stack(0) -  vm_stack(1); vm_pop(); continue; }
-
-      op_ret: {
-            mod_id mod_id = 0;
-            vm_unpack_ret(vm_pop(), &vm->ip, &vm->sbp, &mod_id);
-            if (unlikely(mod_id)) return mod_id;
-            continue;
-        }
-      op_call: {
-            vm_ip ip = 0; mod_id mod_id = 0;
-            vm_unpack(vm_code(vm_word), &mod_id, &ip);
-            vm_push(vm_pack_ret(vm->ip, vm->sbp, unlikely(mod_id) ? mod->id : 0));
-            vm->ip = ip; vm->sbp = vm->sp;
-            if (unlikely(mod_id)) { return mod_id; }
-            continue;
-        }
-      op_load: {
-            vm_word mod_id = vm_pop();
-            if (unlikely(mod_id > UINT32_MAX)) { vm->flags |= FLAG_FAULT_CODE; return VM_FAULT; }
-            vm_reset(vm);
-            return mod_id;
-        }
-      op_jmp: { vm->ip = vm_code(vm_ip); continue; }
-      op_jz:  { vm_ip dst = vm_code(vm_ip); if (!vm_pop()) vm->ip = dst; continue; }
-      op_jnz: { vm_ip dst = vm_code(vm_ip); if ( vm_pop()) vm->ip = dst; continue; }
-
-      op_reset: { vm_reset(vm); return VM_RESET; }
-      op_yield: { return 0; }
-      op_tsc: { vm_push(vm->tsc); continue; }
-      op_fault: { vm->flags |= FLAG_FAULT_USER; return VM_FAULT; }
-
-      op_io:  {
-            vm->io = vm_code(uint8_t);
-            vm->flags |= FLAG_IO;
-            return 0;
-        }
-      op_ios: {
-            vm->io = vm_pop();
-            vm->flags |= FLAG_IO;
-            return 0;
-        }
+    return vm_exec_checked_n(vm, mod, vm->specs.speed);
+}
 
-      op_pack: {
-            vm_ensure(2);
-            vm_stack(1) = vm_pack(vm_stack(0), vm_stack(1));
-            vm_pop();
-            continue;
-        }
-      op_unpack: {
-            uint32_t msb = 0, lsb = 0;
-            vm_unpack(vm_pop(), &msb, &lsb);
-            vm_push(msb);
-            vm_push(lsb);
+static enum vm_jit_mode vm_jit_current;
+static mod_id vm_jit_exec(struct vm *, const struct mod *);
+
+mod_id vm_exec(struct vm *vm, const struct mod *mod)
+{
+    if (!mod->runs) return vm_exec_checked(vm, mod);
+    if (unlikely(vm_prof_bound != nullptr) && vm_prof_watched(vm_prof_bound, mod->id))
+        return vm_exec_checked(vm, mod);
+
+    if (unlikely(vm->flags & (flag_faults | FLAG_SUSPENDED)) ||
+            unlikely(vm->ip >= mod->len) ||
+            unlikely(!vm_run_check(vm, mod->runs[vm->ip])))
+        return vm_exec_checked(vm, mod);
+
+    if (vm_jit_current != vm_jit_off) return vm_jit_exec(vm, mod);
+    return vm_exec_verified_n(vm, mod, vm->specs.speed);
+}
+
+
+// -----------------------------------------------------------------------------
+// prof
+// -----------------------------------------------------------------------------
+
+struct vm_prof_mod
+{
+    mod_id id;
+    uint32_t len;
+    uint64_t counts[];
+};
+
+struct vm_prof { struct htable mods, watch; };
+
+struct vm_prof *vm_prof_new(void)
+{
+    return mem_alloc(sizeof(struct vm_prof));
+}
+
+void vm_prof_free(struct vm_prof *prof)
+{
+    if (!prof) return;
+    vm_prof_clear(prof);
+    htable_reset(&prof->mods);
+    htable_reset(&prof->watch);
+    mem_free(prof);
+}
+
+void vm_prof_clear(struct vm_prof *prof)
+{
+    for (const struct htable_bucket *it = htable_next(&prof->mods, NULL);
+         it; it = htable_next(&prof->mods, it))
+        mem_free((struct vm_prof_mod *) it->value);
+    htable_clear(&prof->mods);
+}
+
+// Replaces the set of watched mods.
+void vm_prof_watch(struct vm_prof *prof, const mod_id *mods, size_t len)
+{
+    htable_clear(&prof->watch);
+    for (size_t i = 0; i < len; ++i)
+        (void) htable_put(&prof->watch, mods[i], true);
+}
+
+void vm_prof_watch_copy(struct vm_prof *dst, const struct vm_prof *src)
+{
+    htable_clear(&dst->watch);
+    for (const struct htable_bucket *it = htable_next(&src->watch, NULL);
+         it; it = htable_next(&src->watch, it))
+        (void) htable_put(&dst->watch, it->key, it->value);
+}
+
+bool vm_prof_watched(const struct vm_prof *prof, mod_id id)
+{
+    return htable_get(&prof->watch, id).ok;
+}
+
+void vm_prof_bind(struct vm_prof *prof)
+{
+    vm_prof_bound = prof;
+}
+
+static struct vm_prof_mod *vm_prof_mod_alloc(mod_id id, size_t len)
+{
+    struct vm_prof_mod *entry =
+        mem_alloc(sizeof(*entry) + len * sizeof(entry->counts[0]));
+    entry->id = id;
+    entry->len = len;
+    return entry;
+}
+
+// Looked up once per call to the checked interpreter which then only pays for
+// a predictable branch per instruction when nothing is bound.
+static uint64_t *vm_prof_counts(const struct mod *mod)
+{
+    struct vm_prof *prof = vm_prof_bound;
+    if (likely(!prof) || !vm_prof_watched(prof, mod->id)) return nullptr;
+
+    struct htable_ret ret = htable_get(&prof->mods, mod->id);
+    if (ret.ok) return ((struct vm_prof_mod *) ret.value)->counts;
+
+    struct vm_prof_mod *entry = vm_prof_mod_alloc(mod->id, mod->len);
+    ret = htable_put(&prof->mods, mod->id, (uintptr_t) entry);
+    assert(ret.ok);
+    return entry->counts;
+}
+
+// Leaves src empty.
+void vm_prof_merge(struct vm_prof *dst, struct vm_prof *src)
+{
+    for (const struct htable_bucket *it = htable_next(&src->mods, NULL);
+         it; it = htable_next(&src->mods, it))
+    {
+        struct vm_prof_mod *entry = (struct vm_prof_mod *) it->value;
+
+        struct htable_ret ret = htable_get(&dst->mods, it->key);
+        if (!ret.ok) {
+            ret = htable_put(&dst->mods, it->key, it->value);
+            assert(ret.ok);
             continue;
         }
+
+        struct vm_prof_mod *sum = (struct vm_prof_mod *) ret.value;
+        assert(sum->len == entry->len);
+        for (size_t i = 0; i < sum->len; ++i) sum->counts[i] += entry->counts[i];
+        mem_free(entry);
+    }
+
+    htable_clear(&src->mods);
+}
+
+const uint64_t *vm_prof_get(const struct vm_prof *prof, mod_id id, size_t *len)
+{
+    struct htable_ret ret = htable_get(&prof->mods, id);
+    if (!ret.ok) { *len = 0; return nullptr; }
+
+    const struct vm_prof_mod *entry = (const struct vm_prof_mod *) ret.value;
+    *len = entry->len;
+    return entry->counts;
+}
+
+void vm_prof_save(const struct vm_prof *prof, mod_id id, struct save *save)
+{
+    size_t len = 0;
+    const uint64_t *counts = vm_prof_get(prof, id, &len);
+
+    uint32_t hits = 0;
+    for (size_t ip = 0; ip < len; ++ip) hits += counts[ip] != 0;
+
+    save_write_magic(save, save_magic_prof);
+    save_write_value(save, id);
+    save_write_value(save, hits);
+
+    for (size_t ip = 0; ip < len; ++ip) {
+        if (!counts[ip]) continue;
+        save_write_value(save, (vm_ip) ip);
+        save_write_value(save, counts[ip]);
     }
 
-    return 0;
+    save_write_magic(save, save_magic_prof);
+}
+
+bool vm_prof_load(struct save *save, mod_id id, uint64_t *counts, size_t len)
+{
+    if (!save_read_magic(save, save_magic_prof)) return false;
+    bool match = save_read_type(save, mod_id) == id;
+    uint32_t hits = save_read_type(save, uint32_t);
+
+    for (size_t i = 0; i < hits; ++i) {
+        vm_ip ip = save_read_type(save, vm_ip);
+        uint64_t count = save_read_type(save, uint64_t);
+        if (match && ip < len) counts[ip] += count;
+    }
 
-#undef vm_code
-#undef vm_stack
-#undef vm_ensure
-#undef vm_peek
-#undef vm_pop
-#undef vm_push
+    return save_read_magic(save, save_magic_prof);
 }
@@ -58,6 +58,7 @@ void vm_init(struct vm *, uint8_t stack, uint8_t speed);
 static const mod_id VM_FAULT = -1;
 static const mod_id VM_RESET = -2;
 mod_id vm_exec(struct vm *, const struct mod *);
+mod_id vm_exec_checked(struct vm *, const struct mod *);
 
 void vm_reset(struct vm *);
 void vm_suspend(struct vm *);
@@ -101,3 +102,100 @@ inline void vm_unpack_ret(vm_word value, vm_ip *ip, uint8_t *sbp, mod_id *mod)
 }
 
 size_t vm_dbg(struct vm *, char *dst, size_t len);
+
+
+// -----------------------------------------------------------------------------
+// verify
+// -----------------------------------------------------------------------------
+// A run is the straight-line sequence of instructions starting at an ip up to
+// the next instruction that can transfer control. need is the minimum stack
+// depth required to execute the run without underflowing and grow is the
+// maximum depth it reaches above its starting depth.
+//
+// Entries that are not on an instruction boundary are set to UINT8_MAX which
+// can never be satisfied.
+
+struct legion_packed vm_run { uint8_t need, grow; };
+
+bool vm_verify(const uint8_t *code, size_t len, struct vm_run *runs);
+
+
+// -----------------------------------------------------------------------------
+// ngrams
+// -----------------------------------------------------------------------------
+// Counts the sequences of len ops found within straight-line runs which
+// excludes any sequence where an op other than the last ends a run.
+// Counts are keyed by the ops packed with the first op in the most significant
+// byte along with bit 32 set to avoid nil keys. Returns the number of ops
+// visited.
+
+struct htable;
+
+enum : size_t { vm_ngrams_cap = 4 };
+size_t vm_ngrams(const uint8_t *code, size_t len, size_t n, struct htable *counts);
+
+// -----------------------------------------------------------------------------
+// decode
+// -----------------------------------------------------------------------------
+// Direct-threaded form of a verified mod built lazily by vm_exec. Operands are
+// decoded and aligned and ip is kept around to map back to the bytecode.
+
+struct vm_insn
+{
+    const void *label;
+    vm_word arg;
+    vm_ip ip, next;
+};
+
+struct vm_decoded
+{
+    size_t len;
+    uint32_t *map; // ip -> insns index
+    struct vm_insn insns[];
+};
+
+
+
+// -----------------------------------------------------------------------------
+// jit
+// -----------------------------------------------------------------------------
+// Template JIT used by vm_exec for verified mods which is only available on
+// x86-64 linux. Instructions that it doesn't handle are handed off to the
+// interpreter. The diff mode also runs the interpreter on a copy of the vm and
+// aborts if the two ever disagree.
+
+enum vm_jit_mode : uint8_t { vm_jit_off = 0, vm_jit_on, vm_jit_diff };
+
+bool vm_jit_supported(void);
+void vm_jit_set(enum vm_jit_mode);
+
+
+
+// -----------------------------------------------------------------------------
+// prof
+// -----------------------------------------------------------------------------
+// Opt-in count of the instructions executed per mod and ip. Counts go to the
+// vm_prof bound to the executing thread so that every thread counts without
+// contention and the results are merged once the threads are done. Only the
+// watched mods are counted and vm_exec moves them to the checked interpreter,
+// as it's the only one instrumented, while every other mod stays on its fast
+// path.
+
+struct vm_prof;
+
+struct vm_prof *vm_prof_new(void);
+void vm_prof_free(struct vm_prof *);
+void vm_prof_clear(struct vm_prof *);
+
+void vm_prof_watch(struct vm_prof *, const mod_id *, size_t len);
+void vm_prof_watch_copy(struct vm_prof *dst, const struct vm_prof *src);
+bool vm_prof_watched(const struct vm_prof *, mod_id);
+
+void vm_prof_bind(struct vm_prof *);
+void vm_prof_merge(struct vm_prof *dst, struct vm_prof *src);
+const uint64_t *vm_prof_get(const struct vm_prof *, mod_id, size_t *len);
+
+// Sparse encoding of the counts of a single mod. Load adds the saved counts to
+// counts, which holds one entry per ip, if they belong to the given mod.
+void vm_prof_save(const struct vm_prof *, mod_id, struct save *);
+bool vm_prof_load(struct save *, mod_id, uint64_t *counts, size_t len);
@@ -192,6 +192,184 @@ void test_ports_reset(void)
     world_free(world);
 }
 
+void test_ports_park(void)
+{
+    struct star star = {0};
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    world_populate_user(world, user_admin);
+    struct shard *shard = shard_alloc(0, world);
+    struct chunk *chunk = shard_chunk_alloc(shard, &star, user_admin, 0);
+
+    enum item item = item_memory;
+    im_id src = make_im_id(item_extract, 1);
+    im_id dst = make_im_id(item_deploy, 1);
+
+    chunk_create(chunk, im_id_item(src));
+    chunk_create(chunk, im_id_item(dst));
+    chunk_create(chunk, item_worker);
+    shard_step(shard);
+
+    for (size_t i = 0; i < 3; ++i) {
+        const vm_word args[] = { item, 1 };
+        assert(chunk_io(chunk, io_item, 0, dst, args, array_len(args)));
+
+        // The first step places the request and the second finds it unfilled.
+        shard_step(shard);
+        assert(!chunk_ports_parked(chunk, dst));
+        shard_step(shard);
+        assert(chunk_ports_parked(chunk, dst));
+
+        for (size_t j = 0; j < 10; ++j) {
+            shard_step(shard);
+            assert(chunk_ports_parked(chunk, dst));
+            assert(chunk_workers(chunk)->fail == 1);
+        }
+
+        // Items are stepped before the workers so the delivery only unparks
+        // the deploy which then completes on the following step.
+        const ssize_t count = chunk_count(chunk, item);
+        assert(chunk_ports_produce(chunk, src, item));
+        shard_step(shard);
+        assert(!chunk_ports_parked(chunk, dst));
+        assert(chunk_count(chunk, item) == count);
+
+        shard_step(shard);
+        shard_step(shard);
+        assert(!chunk_ports_parked(chunk, dst));
+        assert(chunk_count(chunk, item) == count + 1);
+    }
+
+    chunk_free(chunk);
+    shard_free(shard);
+    world_free(world);
+}
+
+
+// -----------------------------------------------------------------------------
+// sleep
+// -----------------------------------------------------------------------------
+
+// Mirrors chunk_sleep_period and chunk_sleep_timer.
+enum { sleep_period = 16, sleep_timer = 1024 };
+
+// Steps the world and returns whether its only chunk slept through the step.
+bool step_asleep(struct world *world)
+{
+    struct metrics *metrics = world_metrics(world);
+
+    uint64_t awake = 0, asleep = 0;
+    for (size_t i = 0; i < array_len(metrics->shard); ++i) {
+        awake -= metrics->shard[i].chunk.awake.n;
+        asleep -= metrics->shard[i].chunk.asleep.n;
+    }
+
+    world_step(world);
+
+    for (size_t i = 0; i < array_len(metrics->shard); ++i) {
+        awake += metrics->shard[i].chunk.awake.n;
+        asleep += metrics->shard[i].chunk.asleep.n;
+    }
+
+    assert(awake + asleep == 1);
+    return asleep;
+}
+
+// Steps until the chunk falls asleep which must happen within two periods.
+void wait_asleep(struct world *world)
+{
+    for (size_t i = 0; i < 2 * sleep_period; ++i)
+        if (step_asleep(world)) return;
+    assert(false);
+}
+
+void test_sleep_idle(void)
+{
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    const struct sector *sector = world_sector(world, coord_center());
+    struct chunk *chunk =
+        world_chunk_alloc(world, sector->stars[0].coord, user_admin);
+
+    chunk_create(chunk, item_memory);
+    chunk_create(chunk, item_worker);
+
+    wait_asleep(world);
+
+    // The timer starts on the step that put the chunk to sleep which counts as
+    // awake and wait_asleep already consumed the first step of sleep.
+    for (size_t i = 0; i < sleep_timer - 2; ++i) assert(step_asleep(world));
+    assert(!step_asleep(world));
+
+    // Nothing changed so it should go right back to sleep.
+    wait_asleep(world);
+    assert(step_asleep(world));
+
+    world_free(world);
+}
+
+void test_sleep_io(void)
+{
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    const struct sector *sector = world_sector(world, coord_center());
+    struct chunk *chunk =
+        world_chunk_alloc(world, sector->stars[0].coord, user_admin);
+
+    const im_id memory = make_im_id(item_memory, 1);
+    chunk_create(chunk, im_id_item(memory));
+    wait_asleep(world);
+
+    for (size_t i = 0; i < 3; ++i) {
+        for (size_t j = 0; j < 10; ++j) assert(step_asleep(world));
+
+        const vm_word args[] = { 0, i + 1 };
+        assert(chunk_io(chunk, io_set, 0, memory, args, array_len(args)));
+        assert(!step_asleep(world));
+
+        wait_asleep(world);
+    }
+
+    world_free(world);
+}
+
+void test_sleep_lanes(void)
+{
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    const struct sector *sector = world_sector(world, coord_center());
+
+    const enum item item = item_pill;
+    const struct coord src = sector->stars[0].coord;
+    const struct coord dst = sector->stars[1].coord;
+    struct chunk *chunk = world_chunk_alloc(world, dst, user_admin);
+
+    const size_t speed = lanes_travel(1, src, dst) / 100;
+    const world_ts_delta travel = lanes_travel(speed, src, dst);
+    assert(travel > 1 && travel < sleep_timer / 2);
+
+    wait_asleep(world);
+
+    lanes_launch(world_lanes(world), (struct lanes_packet) {
+                .owner = user_admin,
+                .item = item,
+                .speed = speed,
+                .src = src,
+                .dst = dst,
+            });
+
+    // The launch goes through the source star which has no chunk so the
+    // destination must only wake up on the tick of the arrival.
+    for (world_ts_delta i = 1; i < travel; ++i) assert(step_asleep(world));
+    assert(chunk_count(chunk, item) == 0);
+
+    assert(!step_asleep(world));
+    assert(chunk_count(chunk, item) == 1);
+
+    world_free(world);
+}
+
+
 int main(int argc, char **argv)
 {
     (void) argc, (void) argv;
@@ -202,6 +380,10 @@ int main(int argc, char **argv)
     test_ports_2on1();
     test_ports_1on2();
     test_ports_reset();
+    test_ports_park();
+    test_sleep_idle();
+    test_sleep_io();
+    test_sleep_lanes();
 
     return 0;
 }
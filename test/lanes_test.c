@@ -146,6 +146,239 @@ void test_speed(void)
 }
 
 
+// -----------------------------------------------------------------------------
+// wheel
+// -----------------------------------------------------------------------------
+
+struct arrival { world_ts launch, at; size_t speed; };
+
+// Star of the sector that is the furthest away from src.
+struct coord furthest(const struct sector *sector, struct coord src)
+{
+    struct coord dst = src;
+    for (size_t i = 0; i < sector->stars_len; ++i) {
+        struct coord it = sector->stars[i].coord;
+        if (lanes_travel(1, src, it) > lanes_travel(1, src, dst)) dst = it;
+    }
+    return dst;
+}
+
+void arrivals_init(
+        struct arrival *list, size_t len, struct coord src, struct coord dst)
+{
+    for (size_t i = 0; i < len; ++i)
+        list[i].at = list[i].launch + lanes_travel(list[i].speed, src, dst);
+}
+
+// Launches the packets on their tick and steps the world up to the given tick
+// while checking that every packet arrives on its exact tick. Packets whose
+// launch tick has passed are assumed to already be in flight.
+void check_arrivals(
+        struct world *world, world_ts until,
+        struct coord src, struct coord dst, enum item item,
+        const struct arrival *list, size_t len)
+{
+    struct chunk *chunk = world_chunk(world, dst);
+    assert(chunk);
+
+    while (world_time(world) < until) {
+        for (size_t i = 0; i < len; ++i) {
+            if (list[i].launch != world_time(world)) continue;
+            launch(world, user_admin, item, list[i].speed, src, dst);
+        }
+
+        world_step(world);
+
+        ssize_t exp = 0;
+        for (size_t i = 0; i < len; ++i) exp += list[i].at <= world_time(world);
+
+        ssize_t count = chunk_count(chunk, item);
+        if (count == exp) continue;
+
+        dbgf("tick %lu: count %zd != %zd", world_time(world), count, exp);
+        abort();
+    }
+}
+
+world_ts arrivals_last(const struct arrival *list, size_t len)
+{
+    world_ts last = 0;
+    for (size_t i = 0; i < len; ++i) last = legion_max(last, list[i].at);
+    return last;
+}
+
+// Arrivals that span a level of the timing wheel must be cascaded into the
+// lower levels before they can arrive.
+void test_wheel(void)
+{
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    const struct sector *sector = world_sector(world, coord_center());
+
+    const enum item item = item_pill;
+    const struct coord src = sector->stars[0].coord;
+    const struct coord dst = furthest(sector, src);
+    world_chunk_alloc(world, dst, user_admin);
+
+    const world_ts_delta dist = lanes_travel(1, src, dst);
+    assert(dist > 65536);
+
+    struct arrival list[] = {
+        { .launch = 0, .speed = dist / 10 },
+        { .launch = 0, .speed = dist / 300 },
+        { .launch = 250, .speed = dist / 10 },
+        { .launch = 65530, .speed = dist / 20 },
+        { .launch = 0, .speed = 1 },
+    };
+    arrivals_init(list, array_len(list), src, dst);
+
+    assert(list[1].at > 256);
+    assert((list[2].launch >> 8) != (list[2].at >> 8));
+    assert((list[3].launch >> 16) != (list[3].at >> 16));
+    assert(list[4].at > 65536);
+
+    const world_ts last = arrivals_last(list, array_len(list));
+    check_arrivals(world, last, src, dst, item, list, array_len(list));
+    check_hset_nil(lanes_set(world_lanes(world), src));
+
+    world_free(world);
+}
+
+// Packets in flight must survive a save and still arrive on their tick.
+void test_save(void)
+{
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    const struct sector *sector = world_sector(world, coord_center());
+
+    const enum item item = item_pill;
+    const struct coord src = sector->stars[0].coord;
+    const struct coord dst = sector->stars[1].coord;
+    world_chunk_alloc(world, dst, user_admin);
+
+    const world_ts_delta dist = lanes_travel(1, src, dst);
+    struct arrival list[] = {
+        { .launch = 0, .speed = dist / 10 },
+        { .launch = 0, .speed = dist / 100 },
+        { .launch = 20, .speed = dist / 300 },
+        { .launch = 40, .speed = dist / 1000 },
+    };
+    arrivals_init(list, array_len(list), src, dst);
+
+    const world_ts mid = 50;
+    check_arrivals(world, mid, src, dst, item, list, array_len(list));
+    check_hset(lanes_set(world_lanes(world), src), coord_to_u64(dst));
+
+    struct save *save = save_mem_new();
+    world_save(world, save);
+    world_free(world);
+
+    save_mem_reset(save);
+    world = world_load(save);
+    assert(world);
+    save_mem_free(save);
+
+    assert(world_time(world) == mid);
+    check_hset(lanes_set(world_lanes(world), src), coord_to_u64(dst));
+
+    const world_ts last = arrivals_last(list, array_len(list));
+    check_arrivals(world, last, src, dst, item, list, array_len(list));
+    check_hset_nil(lanes_set(world_lanes(world), src));
+
+    world_free(world);
+}
+
+// Saves from before the timing wheel stored the packets of a lane as a heap
+// with spare capacity. Packets that should have already arrived by the time the
+// save is loaded are delivered on the next tick.
+void test_migrate(void)
+{
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    struct lanes *lanes = world_lanes(world);
+    const struct sector *sector = world_sector(world, coord_center());
+
+    const enum item item = item_pill;
+    const struct coord src = sector->stars[0].coord;
+    const struct coord dst = sector->stars[1].coord;
+    world_chunk_alloc(world, dst, user_admin);
+
+    const world_ts_delta dist = lanes_travel(1, src, dst);
+    struct arrival list[] = {
+        { .launch = 0, .speed = dist / 100 },
+        { .launch = 0, .speed = dist / 300 },
+    };
+    arrivals_init(list, array_len(list), src, dst);
+
+    const world_ts now = 50;
+    check_arrivals(world, now, src, dst, item, list, array_len(list));
+
+    struct save *save = save_mem_new();
+    lanes_save(lanes, save);
+    const size_t total = save_len(save);
+    save_mem_reset(save);
+
+    // Rewrites the lane in the original layout: heap order is not arrival
+    // order, cap is past len and the first packet is overdue.
+    struct save *old = save_mem_new();
+    {
+        assert(save_read_magic(save, save_magic_lanes));
+        save_write_magic(old, save_magic_lanes);
+
+        uint32_t lanes_len = save_read_type(save, uint32_t);
+        assert(lanes_len == 1);
+        save_write_value(old, lanes_len);
+
+        assert(save_read_magic(save, save_magic_lane));
+        save_write_magic(old, save_magic_lane);
+        save_write_value(old, save_read_type(save, struct coord));
+        save_write_value(old, save_read_type(save, struct coord));
+
+        uint16_t len = save_read_type(save, uint16_t);
+        uint16_t cap = save_read_type(save, uint16_t);
+        assert(len == 2 && cap == len);
+        save_write_value(old, len);
+        save_write_value(old, (uint16_t) (len + 1));
+
+        uint64_t packets[2] = {0};
+        save_read_into(save, &packets[0]);
+        save_read_into(save, &packets[1]);
+
+        struct { world_ts ts; uint32_t data; } first = {0};
+        static_assert(sizeof(first) == sizeof(packets[0]));
+        memcpy(&first, &packets[0], sizeof(first));
+        first.ts = now - 10;
+        memcpy(&packets[0], &first, sizeof(first));
+
+        save_write_value(old, packets[1]);
+        save_write_value(old, packets[0]);
+        save_write_value(old, (uint64_t) -1);
+
+        assert(save_read_magic(save, save_magic_lane));
+        save_write_magic(old, save_magic_lane);
+
+        size_t rest = total - save_len(save);
+        assert(save_copy(old, save, rest) == rest);
+    }
+    save_mem_free(save);
+
+    lanes_free(lanes);
+    memset(lanes, 0, sizeof(*lanes));
+    lanes_init(lanes, world);
+
+    save_mem_reset(old);
+    assert(lanes_load(lanes, world, old));
+    save_mem_free(old);
+
+    list[0].at = now + 1;
+    const world_ts last = arrivals_last(list, array_len(list));
+    check_arrivals(world, last, src, dst, item, list, array_len(list));
+    check_hset_nil(lanes_set(lanes, src));
+
+    world_free(world);
+}
+
+
 int main(int argc, char **argv)
 {
     (void) argc, (void) argv;
@@ -154,6 +387,9 @@ int main(int argc, char **argv)
 
     test_basics();
     test_speed();
+    test_wheel();
+    test_save();
+    test_migrate();
 
     return 0;
 }
@@ -189,9 +189,76 @@ bool check_mod(
         struct atoms *atoms)
 {
     if (!vm || !mod) return false;
+
+    // Verified mods go through a different interpreter which must end up in
+    // the exact same state as the checked interpreter including the dead
+    // values above the top of the stack.
+    size_t vm_bytes = sizeof(*vm) + vm->specs.stack * sizeof(vm->stack[0]);
+    struct vm *ref = mem_alloc(vm_bytes);
+    memcpy(ref, vm, vm_bytes);
+
+    // The profiler forces the checked interpreter on the watched mods and counts
+    // every instruction which starts within the mod. Other mods are untouched.
+    uint32_t tsc = vm->tsc;
+    struct vm *prof_vm = mem_alloc(vm_bytes);
+    memcpy(prof_vm, vm, vm_bytes);
+    struct vm_prof *prof = vm_prof_new();
+    vm_prof_watch(prof, &mod->id, 1);
+
+    struct vm *skip_vm = mem_alloc(vm_bytes);
+    memcpy(skip_vm, vm, vm_bytes);
+    struct vm_prof *skip = vm_prof_new();
+    const mod_id other = make_mod(mod_major(mod->id) + 1, 0);
+    vm_prof_watch(skip, &other, 1);
+
+    vm_ip ref_ret = vm_exec_checked(ref, mod);
+
+    vm_prof_bind(prof);
+    vm_ip prof_ret = vm_exec(prof_vm, mod);
+    vm_prof_bind(skip);
+    vm_ip skip_ret = vm_exec(skip_vm, mod);
+    vm_prof_bind(nullptr);
+
     vm_ip ret = vm_exec(vm, mod);
 
     bool ok = true;
+    if (ret != ref_ret || memcmp(vm, ref, vm_bytes)) {
+        dbgf("verified exec diverged from checked exec: verified=%u, jit=%u",
+                mod->runs != NULL, mod->jit > 1);
+        ok = false;
+    }
+
+    if (prof_ret != ref_ret || memcmp(prof_vm, ref, vm_bytes)) {
+        dbg("profiled exec diverged from checked exec");
+        ok = false;
+    }
+
+    size_t skip_len = 0;
+    (void) vm_prof_get(skip, mod->id, &skip_len);
+    if (skip_ret != ref_ret || memcmp(skip_vm, ref, vm_bytes) || skip_len) {
+        dbg("unwatched exec diverged or was counted");
+        ok = false;
+    }
+
+    // Faults stop the count early while load and reset clear the tsc.
+    if (!prof_ret) {
+        size_t len = 0;
+        uint64_t sum = 0;
+        const uint64_t *counts = vm_prof_get(prof, mod->id, &len);
+        for (size_t i = 0; i < len; ++i) sum += counts[i];
+
+        if (sum != prof_vm->tsc - tsc) {
+            dbgf("profiled count mismatch: %lu != %u", sum, prof_vm->tsc - tsc);
+            ok = false;
+        }
+    }
+
+    vm_prof_free(prof);
+    mem_free(prof_vm);
+    vm_prof_free(skip);
+    mem_free(skip_vm);
+
+    mem_free(ref);
     struct field field = {0};
     struct field flags = {0};
     while ((field = token_field(tok, atoms)).type != field_nil) {
@@ -315,12 +382,23 @@ int main(int argc, char **argv)
     (void) argc, (void) argv;
 
     engine_populate_tests();
-    struct dir_it *it = dir_it("./test/lisp");
 
+    // The optimizer must not change the observable behaviour of any mods so
+    // every test is ran with and without it. Same goes for the jit which is
+    // checked against the interpreter by check_mod.
     bool ok = true;
-    while (dir_it_next(it))
-        ok = check_file(dir_it_path(it)) && ok;
+    for (size_t jit = 0; jit < (vm_jit_supported() ? 2 : 1); ++jit) {
+        vm_jit_set(jit ? vm_jit_on : vm_jit_off);
+
+        for (size_t opt = 0; opt < 2; ++opt) {
+            mod_compiler_opt(opt);
+
+            struct dir_it *it = dir_it("./test/lisp");
+            while (dir_it_next(it))
+                ok = check_file(dir_it_path(it)) && ok;
+            dir_it_free(it);
+        }
+    }
 
-    dir_it_free(it);
     return ok ? 0 : 1;
 }
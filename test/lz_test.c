@@ -0,0 +1,150 @@
+/* lz_test.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "common.h"
+#include "utils/lz.h"
+#include "utils/rng.h"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static size_t check_round(const uint8_t *data, size_t len)
+{
+    size_t cap = lz_bound(len);
+    uint8_t *wire = mem_alloc(cap);
+    uint8_t *raw = mem_alloc(len + 1);
+
+    size_t wire_len = lz_compress(data, len, wire, cap);
+    assert(wire_len && wire_len <= cap);
+
+    assert(lz_decompress(wire, wire_len, raw, len));
+    assert(!memcmp(data, raw, len));
+
+    // The raw length is carried by the caller so any mismatch must be caught.
+    if (len) assert(!lz_decompress(wire, wire_len, raw, len - 1));
+    assert(!lz_decompress(wire, wire_len, raw, len + 1));
+
+    mem_free(wire);
+    mem_free(raw);
+    return wire_len;
+}
+
+
+// -----------------------------------------------------------------------------
+// tests
+// -----------------------------------------------------------------------------
+
+static void check_small(void)
+{
+    const uint8_t data[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    for (size_t len = 0; len <= sizeof(data); ++len)
+        check_round(data, len);
+}
+
+static void check_runs(void)
+{
+    enum { len = 64 * 1024 };
+    uint8_t *data = mem_alloc(len);
+
+    // Zero padding is the bulk of what we compress and is encoded as one long
+    // overlapping match.
+    assert(check_round(data, len) < len / 100);
+
+    for (size_t i = 0; i < len; ++i) data[i] = (i / 7) % 3;
+    assert(check_round(data, len) < len / 10);
+
+    for (size_t i = 0; i < len; ++i) data[i] = i % 251;
+    assert(check_round(data, len) < len / 10);
+
+    mem_free(data);
+}
+
+static void check_noise(void)
+{
+    enum { len = 64 * 1024 };
+    uint8_t *data = mem_alloc(len);
+
+    struct rng rng = rng_make(0);
+    for (size_t i = 0; i < len; ++i) data[i] = rng_step(&rng);
+    assert(check_round(data, len) <= lz_bound(len));
+
+    // Incompressible input must not fit in a buffer smaller than the input.
+    uint8_t *wire = mem_alloc(len);
+    assert(!lz_compress(data, len, wire, len - 1));
+    mem_free(wire);
+
+    // Mix of noise and padding which exercises the literal extensions.
+    for (size_t i = 0; i < len; i += 1024)
+        memset(data + i, 0, 300 + (i % 700));
+    check_round(data, len);
+
+    mem_free(data);
+}
+
+static void check_window(void)
+{
+    enum { len = 256 * 1024 };
+    uint8_t *data = mem_alloc(len);
+
+    // Repeats that are further apart than the 16 bits window must fall back
+    // to literals.
+    struct rng rng = rng_make(1);
+    for (size_t i = 0; i < len / 2; ++i) data[i] = rng_step(&rng);
+    memcpy(data + len / 2, data, len / 2);
+    check_round(data, len);
+
+    mem_free(data);
+}
+
+static void check_corrupt(void)
+{
+    enum { len = 4 * 1024 };
+    uint8_t *data = mem_alloc(len);
+    for (size_t i = 0; i < len; ++i) data[i] = (i * 13) % 17;
+
+    size_t cap = lz_bound(len);
+    uint8_t *wire = mem_alloc(cap);
+    size_t wire_len = lz_compress(data, len, wire, cap);
+    assert(wire_len);
+
+    uint8_t *raw = mem_alloc(len);
+
+    // Any prefix of a block must be rejected and not read past its end.
+    for (size_t i = 0; i < wire_len; ++i)
+        assert(!lz_decompress(wire, i, raw, len));
+
+    // Flipped bytes can decode to garbage but must stay within bounds.
+    struct rng rng = rng_make(2);
+    for (size_t i = 0; i < 1000; ++i) {
+        size_t index = rng_uni(&rng, 0, wire_len);
+        uint8_t old = wire[index];
+        wire[index] ^= rng_uni(&rng, 1, 256);
+        (void) lz_decompress(wire, wire_len, raw, len);
+        wire[index] = old;
+    }
+
+    assert(lz_decompress(wire, wire_len, raw, len));
+    assert(!memcmp(data, raw, len));
+
+    mem_free(raw);
+    mem_free(wire);
+    mem_free(data);
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    check_small();
+    check_runs();
+    check_noise();
+    check_window();
+    check_corrupt();
+    return 0;
+}
@@ -177,6 +177,13 @@ void check(void)
             struct vec16 *wd_items = chunk_list(wd_chunk);
             struct vec16 *st_items = chunk_list(st_chunk);
             assert(vec16_eq(wd_items, st_items));
+
+            for (size_t i = 0; i < wd_items->len; ++i) {
+                im_id id = wd_items->vals[i];
+                size_t len = im_config(im_id_item(id))->size;
+                assert(!memcmp(chunk_get(wd_chunk, id), chunk_get(st_chunk, id), len));
+            }
+
             vec16_free(wd_items);
             vec16_free(st_items);
         }
@@ -83,6 +83,77 @@ void check_file(const char *path)
     world_free(old);
 }
 
+// Version 1 of the sim save must stay loadable such that existing worlds
+// survive an upgrade.
+void check_version(const char *path)
+{
+    struct metrics metrics = {0};
+    struct world *world = world_new(0, &metrics);
+    world_populate(world);
+    world_step(world);
+
+    {
+        struct save *save = save_file_create(path, 1);
+        assert(save);
+        save_write_magic(save, save_magic_sim);
+        save_write_value(save, (enum speed) speed_fast);
+        save_write_magic(save, save_magic_sim);
+        world_save(world, save);
+        save_file_close(save);
+    }
+
+    struct sim *sim = sim_new(0, path);
+    assert(sim_load(sim));
+    sim_save(sim);
+    sim_free(sim);
+
+    {
+        struct save *save = save_file_load(path);
+        assert(save);
+        assert(save_file_version(save) == 1);
+        save_file_close(save);
+    }
+
+    world_free(world);
+}
+
+void check_varint(void)
+{
+    const uint64_t uvals[] = {
+        0, 1, 0x7F, 0x80, 0x3FFF, 0x4000, UINT32_MAX, UINT64_MAX - 1, UINT64_MAX,
+    };
+    const int64_t svals[] = { 0, 1, -1, 63, -64, 64, -65, INT64_MAX, INT64_MIN };
+
+    struct save *save = save_mem_new();
+
+    for (size_t i = 0; i < array_len(uvals); ++i) save_write_uvar(save, uvals[i]);
+    for (size_t i = 0; i < array_len(svals); ++i) save_write_svar(save, svals[i]);
+
+    uint64_t prev = 0;
+    for (size_t i = 0; i < array_len(uvals); ++i) save_write_delta(save, &prev, uvals[i]);
+
+    save_write_uvar(save, 0x7F);
+    size_t small = save_len(save);
+    save_write_svar(save, -64);
+    assert(save_len(save) - small == 1);
+
+    size_t len = save_len(save);
+    save_mem_reset(save);
+
+    for (size_t i = 0; i < array_len(uvals); ++i) assert(save_read_uvar(save) == uvals[i]);
+    for (size_t i = 0; i < array_len(svals); ++i) assert(save_read_svar(save) == svals[i]);
+
+    prev = 0;
+    for (size_t i = 0; i < array_len(uvals); ++i)
+        assert(save_read_delta(save, &prev) == uvals[i]);
+
+    assert(save_read_uvar(save) == 0x7F);
+    assert(save_read_svar(save) == -64);
+    assert(save_len(save) == len);
+
+    save_mem_free(save);
+}
+
 void check_ring(void)
 {
     enum {
@@ -174,6 +245,8 @@ int main(int argc, char **argv)
     (void) unlink(path);
 
     check_file(path);
+    check_version(path);
+    check_varint();
     check_ring();
 
     return 0;
@@ -0,0 +1,195 @@
+/* stream_test.c
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "game.h"
+#include "utils/lz.h"
+#include "utils/rng.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+// The stream lives in the legion binary which doesn't have a library of its
+// own.
+#include "legion/stream.c"
+
+
+// -----------------------------------------------------------------------------
+// frames
+// -----------------------------------------------------------------------------
+
+// Frames are regenerated from their sequence number when read back. Even frames
+// compress well while odd ones are noise which is sent as is.
+static size_t frame_fill(uint64_t seq, uint8_t *dst, size_t cap)
+{
+    struct rng rng = rng_make(seq);
+    size_t len = sizeof(struct header) + rng_uni(&rng, 0, 3 * 1024);
+    if (len > cap) return 0;
+    if (!dst) return len;
+
+    struct header head = make_header(header_state, len);
+    memcpy(dst, &head, sizeof(head));
+
+    for (size_t i = sizeof(head); i < len; ++i)
+        dst[i] = seq % 2 ? rng_step(&rng) : (i / 16) % 7;
+
+    return len;
+}
+
+// Writes frames into the ring until it's full.
+static uint64_t frames_write(struct save_ring *ring, uint64_t seq, uint64_t end)
+{
+    struct save *save = save_ring_write(ring);
+
+    for (; seq < end; ++seq) {
+        size_t cap = save_cap(save) - save_len(save);
+        size_t len = frame_fill(seq, nullptr, cap);
+        if (!len) break;
+
+        frame_fill(seq, save_bytes(save) + save_len(save), cap);
+        save_ring_consume(save, len);
+    }
+
+    save_ring_commit(ring, save);
+    return seq;
+}
+
+// Reads and checks at most max frames from the ring.
+static uint64_t frames_read(struct save_ring *ring, uint64_t seq, size_t max)
+{
+    struct save *save = save_ring_read(ring);
+    uint8_t exp[sizeof(struct header) + 3 * 1024];
+
+    for (size_t i = 0; i < max; ++i, ++seq) {
+        size_t left = save_cap(save) - save_len(save);
+        if (left < sizeof(struct header)) break;
+
+        const uint8_t *src = save_bytes(save) + save_len(save);
+        struct header head = {0};
+        memcpy(&head, src, sizeof(head));
+        assert(head.magic == header_magic);
+        if (left < head.len) break;
+
+        size_t len = frame_fill(seq, exp, sizeof(exp));
+        assert(head.len == len);
+        assert(!memcmp(src, exp, len));
+
+        save_ring_consume(save, len);
+    }
+
+    save_ring_commit(ring, save);
+    return seq;
+}
+
+
+// -----------------------------------------------------------------------------
+// tests
+// -----------------------------------------------------------------------------
+
+// Pushes frames from one ring to the other through the codec with a socket that
+// delivers arbitrary chunks and a reader that drains in bursts. The rings are
+// small enough that both wrap many times over and the receiving end regularly
+// fills up which must hold the frames back in the buffer until drained.
+static void check_round(void)
+{
+    enum { cap = 4 * sys_page_len, frames = 5000 };
+
+    struct save_ring *out = save_ring_new(cap);
+    struct save_ring *in = save_ring_new(cap);
+    struct stream_buf tx = {0}, rx = {0};
+    struct rng rng = rng_make(0);
+
+    uint64_t written = 0, read = 0;
+    size_t raw = 0, wire = 0, blocked = 0;
+
+    while (read < frames) {
+        uint64_t seq = written;
+        written = frames_write(out, written, frames);
+        for (; seq < written; ++seq) raw += frame_fill(seq, nullptr, SIZE_MAX);
+
+        stream_pack(&tx, out);
+
+        // The socket hands over whatever it feels like which splits frames and
+        // their headers at arbitrary points.
+        size_t len = legion_min(tx.len - tx.it, rng_uni(&rng, 1, cap));
+        memcpy(stream_buf_reserve(&rx, len), tx.data + tx.it, len);
+        stream_buf_commit(&rx, len);
+        tx.it += len;
+        wire += len;
+        if (tx.it == tx.len) tx.it = tx.len = 0;
+
+        assert(stream_unpack(&rx, in));
+        if (stream_unpack_blocked(&rx)) blocked++;
+
+        if (rng_prob(&rng, 0.3)) read = frames_read(in, read, rng_uni(&rng, 1, 20));
+    }
+
+    assert(written == frames);
+    assert(tx.len == tx.it && rx.len == rx.it);
+    assert(raw > cap * 100);
+    assert(wire < raw);
+    assert(blocked);
+
+    stream_buf_free(&tx);
+    stream_buf_free(&rx);
+    save_ring_free(out);
+    save_ring_free(in);
+}
+
+static void check_corrupt(void)
+{
+    struct save_ring *in = save_ring_new(sys_page_len);
+    struct stream_buf rx = {0};
+
+    // Blocks can't expand past their raw length.
+    struct stream_frame frame = { .raw = 8, .wire = 9 };
+    memcpy(stream_buf_reserve(&rx, sizeof(frame)), &frame, sizeof(frame));
+    stream_buf_commit(&rx, sizeof(frame));
+    assert(!stream_unpack(&rx, in));
+
+    // Nor can they be larger than anything the sim would send.
+    rx.it = rx.len = 0;
+    frame = (struct stream_frame) { .raw = sim_out_len, .wire = 8 };
+    memcpy(stream_buf_reserve(&rx, sizeof(frame)), &frame, sizeof(frame));
+    stream_buf_commit(&rx, sizeof(frame));
+    assert(!stream_unpack(&rx, in));
+
+    // Truncated frames wait for the rest.
+    rx.it = rx.len = 0;
+    frame = (struct stream_frame) { .raw = 16, .wire = 16 };
+    memcpy(stream_buf_reserve(&rx, sizeof(frame)), &frame, sizeof(frame));
+    stream_buf_commit(&rx, sizeof(frame));
+    assert(stream_unpack(&rx, in));
+    assert(!stream_unpack_blocked(&rx));
+    assert(rx.it == 0);
+
+    stream_buf_free(&rx);
+    save_ring_free(in);
+}
+
+static void check_hello(void)
+{
+    struct stream_hello hello = stream_hello_client();
+    assert(stream_hello_is_client(&hello));
+
+    // Clients that predate the hello start with a command frame.
+    struct header head = make_header(header_cmd, sizeof(head) + 8);
+    memcpy(&hello, &head, sizeof(head));
+    assert(!stream_hello_is_client(&hello));
+
+    hello = (struct stream_hello) { .magic = stream_magic, .codecs = stream_lz };
+    assert(!stream_hello_is_client(&hello));
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+int main(void)
+{
+    check_round();
+    check_corrupt();
+    check_hello();
+    return 0;
+}